@@ -19,8 +19,19 @@ main (int argc, const char *argv[])
         return EXIT_FAILURE;
     }
 
-    gzm_read(&gzm1, argv[1]);
-    gzm_read(&gzm2, argv[2]);
+    if (gzm_read(&gzm1, argv[1]) != 0)
+    {
+        printf("Could not read %s\n", argv[1]);
+        gzm_free(&gzm1);
+        return EXIT_FAILURE;
+    }
+    if (gzm_read(&gzm2, argv[2]) != 0)
+    {
+        printf("Could not read %s\n", argv[2]);
+        gzm_free(&gzm1);
+        gzm_free(&gzm2);
+        return EXIT_FAILURE;
+    }
     if (gzm_cat_r(&gzm_out, &gzm1, &gzm2) != 0)
     {
         printf("Could not concat %s with %s\n", argv[1], argv[2]);
@@ -32,8 +43,15 @@ main (int argc, const char *argv[])
     }
     else
     {
-        gzm_write(&gzm_out, argv[3]);
-        exc = EXIT_SUCCESS;
+        if (gzm_write(&gzm_out, argv[3]) != 0)
+        {
+            printf("Could not write %s\n", argv[3]);
+            exc = EXIT_FAILURE;
+        }
+        else
+        {
+            exc = EXIT_SUCCESS;
+        }
     }
     gzm_free(&gzm1);
     gzm_free(&gzm2);
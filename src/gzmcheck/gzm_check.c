@@ -0,0 +1,243 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../libgzx/files.h"
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_cache.h"
+#include "../libgzx/gzm_check.h"
+#include "../libgzx/gzm_journal.h"
+
+#define DEFAULT_CACHE_NAME ".gzmcheck-cache"
+#define CACHE_TAG (0x434B0000 | GZM_CHECK_NUM_FLAGS)  // the verdicts change with the set of checks
+
+struct check_file
+{
+    const char              *path;
+    struct stat              st;
+    uint32_t                 flags;
+    bool                     error;
+    bool                     cached;
+};
+
+struct check_work
+{
+    struct check_file       *files;
+    struct gzm_cache        *cache;
+};
+
+/* As gzm_check_data, with the saves in the journal of `path` applied before the macro is checked */
+static int
+check_journaled (uint32_t *flags, const void *data, size_t size, const char *path)
+{
+    struct gz_macro gzm;
+    int complete;
+    int ret = 0;
+
+    *flags = 0;
+    if (gzm_detect_version(data, size, &complete) < 0)
+        *flags |= (complete == GZM_VERSION_LATEST) ? GZM_CHECK_TRAILING_DATA : GZM_CHECK_TRUNCATED;
+
+    gzm_decode(&gzm, data, size);
+    if (gzm_journal_replay(&gzm, path, data, size) != 0)
+        ret = -1;
+    else
+        *flags |= gzm_check(&gzm);
+    gzm_free(&gzm);
+    return ret;
+}
+
+static void
+check_one (struct check_file *f, struct gzm_cache *cache)
+{
+    const struct gzm_cache_entry *ent;
+    struct gzm_fingerprint fp;
+    uint64_t key;
+    void *data = NULL;
+    size_t size;
+
+    // pipes and stdin have no size to stat and nothing to cache
+    if (strcmp(f->path, "-") == 0 || (stat(f->path, &f->st) == 0 && !S_ISREG(f->st.st_mode)))
+    {
+        if (files_read_whole_file(f->path, true, &data, &size) != 0)
+        {
+            f->error = true;
+            return;
+        }
+        f->flags = gzm_check_data(data, size);
+        free(data);
+        return;
+    }
+    if (stat(f->path, &f->st) != 0)
+    {
+        f->error = true;
+        return;
+    }
+
+    // saves in a journal are not part of the file's size, time or contents, so neither cache can vouch for it
+    if (gzm_journal_exists(f->path))
+    {
+        if (files_read_whole_file(f->path, true, &data, &size) != 0 ||
+            check_journaled(&f->flags, data, size, f->path) != 0)
+            f->error = true;
+        free(data);
+        return;
+    }
+
+    // unchanged since the last run, costs only the stat
+    ent = gzm_cache_find(cache, f->path, &f->st);
+    if (ent != NULL && ent->data_size == sizeof(f->flags))
+    {
+        memcpy(&f->flags, ent->data, sizeof(f->flags));
+        f->cached = true;
+        return;
+    }
+
+    if (files_read_whole_file(f->path, true, &data, &size) != 0)
+    {
+        f->error = true;
+        return;
+    }
+
+    // same contents as something already checked
+    gzm_fingerprint(&fp, data, size);
+    key = gzm_fingerprint_key(&fp, GZM_SECTIONS_ALL);
+    ent = gzm_cache_find_key(cache, key);
+    if (ent != NULL && ent->data_size == sizeof(f->flags))
+    {
+        memcpy(&f->flags, ent->data, sizeof(f->flags));
+        f->cached = true;
+    }
+    else
+    {
+        f->flags = gzm_check_data(data, size);
+    }
+    free(data);
+
+    gzm_cache_add(cache, f->path, &f->st, key, &f->flags, sizeof(f->flags));
+}
+
+static void
+check_job (void *arg, size_t i)
+{
+    struct check_work *work = arg;
+
+    check_one(&work->files[i], work->cache);
+}
+
+static void
+usage (const char *prog)
+{
+    printf("%s: Check macros for structural problems.\n", prog);
+    printf("Usage: %s [-j <jobs>] [-c <cache> | -n] [-v] <input|dir> [<input|dir> ...]\n", prog);
+    printf("  -j <jobs>   number of files to check at once (default: number of cpus)\n");
+    printf("  -c <cache>  verdict cache file (default: " DEFAULT_CACHE_NAME ")\n");
+    printf("  -n          do not use a verdict cache\n");
+    printf("  -v          also list macros without problems\n");
+}
+
+int
+main (int argc, const char *argv[])
+{
+    struct files_list list = { 0 };
+    struct check_file *files;
+    struct gzm_cache cache;
+    const char *cache_name = DEFAULT_CACHE_NAME;
+    bool verbose = false;
+    long n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            n_jobs = atol(argv[++i]);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            cache_name = argv[++i];
+        else if (strcmp(argv[i], "-n") == 0)
+            cache_name = NULL;
+        else if (strcmp(argv[i], "-v") == 0)
+            verbose = true;
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (i == argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (n_jobs < 1)
+        n_jobs = 1;
+
+    for (; i < argc; i++)
+    {
+        if (files_list_add_arg(&list, argv[i]) != 0)
+        {
+            fprintf(stderr, "error: out of memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+    files = calloc(list.n + 1, sizeof(struct check_file));
+    if (files == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t f = 0; f < list.n; f++)
+        files[f].path = list.paths[f];
+
+    gzm_cache_open(&cache, cache_name, CACHE_TAG);
+
+    // Check files in parallel
+    struct check_work work = { .files = files, .cache = &cache };
+    files_run_jobs(list.n, n_jobs, check_job, &work);
+
+    // Report in argument order
+    size_t n_bad = 0;
+    size_t n_cached = 0;
+    for (size_t f = 0; f < list.n; f++)
+    {
+        struct check_file *file = &files[f];
+
+        n_cached += file->cached;
+        if (file->error)
+        {
+            printf("%s: could not read file\n", file->path);
+            n_bad++;
+            continue;
+        }
+        if (file->flags == 0)
+        {
+            if (verbose)
+                printf("%s: ok\n", file->path);
+            continue;
+        }
+
+        n_bad++;
+        printf("%s:", file->path);
+        const char *sep = " ";
+        for (int b = 0; b < GZM_CHECK_NUM_FLAGS; b++)
+        {
+            if (file->flags & (1u << b))
+            {
+                printf("%s%s", sep, gzm_check_str(1u << b));
+                sep = ", ";
+            }
+        }
+        printf("\n");
+    }
+    printf("%zu macros checked, %zu with problems (%zu from cache)\n", list.n, n_bad, n_cached);
+
+    if (gzm_cache_save(&cache) != 0)
+        fprintf(stderr, "warning: could not write cache '%s': %s\n", cache_name, strerror(errno));
+    gzm_cache_close(&cache);
+
+    return (n_bad == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
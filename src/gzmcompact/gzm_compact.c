@@ -0,0 +1,32 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_journal.h"
+
+int
+main (int argc, const char *argv[])
+{
+    int exc = EXIT_SUCCESS;
+
+    if (argc < 2)
+    {
+        printf("%s: Fold the journal of incremental saves back into a macro.\n", argv[0]);
+        printf("Usage: %s <input> [<input> ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!gzm_journal_exists(argv[i]))
+            continue;
+
+        if (gzm_journal_compact(argv[i]) != 0)
+        {
+            printf("Could not compact %s\n", argv[i]);
+            exc = EXIT_FAILURE;
+        }
+    }
+    return exc;
+}
@@ -0,0 +1,1485 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_journal.h"
+#include "../libgzx/gzm_shm.h"
+#include "../libgzx/gzm_stream.h"
+#include "../libgzx/hash.h"
+
+/*
+ * Protocol, over a Unix stream socket. Every message is a u32 length of what follows, then for a request a u8
+ * op and its arguments, and for a response a u8 status and its result. Integers are in host byte order,
+ * strings are NUL-terminated, paths are absolute. A connection carries any number of requests, in turn.
+ *
+ *   STAT   path                         -> 7 x u32 counts as gzmstat prints them, then n_seed x (frame, old, new)
+ *   SLICE  path, out, u32 start, end    -> writes out, as gzmslice
+ *   CAT    path1, path2, out            -> writes out, as gzmcat
+ *   QUERY  path, u32 start, n           -> u32 n, then n x (u16 pad, i8 x, i8 y)
+ *   WRITE  path, u32 start, n, inputs   -> replaces or appends n inputs as for QUERY and saves the macro
+ *   STATS                               -> text of the request counts and latency histograms
+ *   PUBLISH path, name                  -> publishes the macro in shared memory segment name, see gzm_shm.h,
+ *                                          and republishes it after every WRITE to it
+ */
+
+#define MAX_MESSAGE (64 << 20)
+#define DEFAULT_MEMORY_MB 256
+#define HIST_BUCKETS 32                         // powers of two of microseconds
+
+enum gzmd_op
+{
+    OP_STAT = 1,
+    OP_SLICE,
+    OP_CAT,
+    OP_QUERY,
+    OP_WRITE,
+    OP_STATS,
+    OP_PUBLISH,
+    OP_MAX
+};
+
+enum gzmd_status
+{
+    STATUS_OK,
+    STATUS_BAD_REQUEST,
+    STATUS_READ_FAILED,
+    STATUS_BAD_RANGE,
+    STATUS_WRITE_FAILED,
+    STATUS_PUBLISH_FAILED,
+};
+
+static const char *op_names[OP_MAX] = { "", "stat", "slice", "cat", "query", "write", "stats", "publish" };
+
+static const char *status_strs[] =
+{
+    "ok", "bad request", "could not read macro", "frames out of range", "could not write macro",
+    "could not publish macro",
+};
+
+// The state of a file a cached macro was read from, including its journal
+struct file_id
+{
+    int64_t                  size;
+    int64_t                  mtime_sec;
+    int64_t                  mtime_nsec;
+    int64_t                  journal_size;
+    int64_t                  journal_mtime_sec;
+    int64_t                  journal_mtime_nsec;
+};
+
+/*
+ * A decoded macro. Entries are shared by the requests using them and freed once they have left the cache and
+ * the last of those is done. The rwlock orders WRITE requests against everything else on the same macro.
+ */
+struct cache_entry
+{
+    char                    *path;
+    uint64_t                 hash;
+    struct file_id           id;
+    struct gz_macro          gzm;
+    size_t                   bytes;
+    int                      refs;
+    bool                     detached;          // no longer in the cache
+    bool                     writing;           // a WRITE is replacing the file, readers wait on lock
+    pthread_rwlock_t         lock;
+    struct cache_entry      *next;              // hash chain
+    struct cache_entry      *lru_prev;          // most recently used first
+    struct cache_entry      *lru_next;
+};
+
+struct cache
+{
+    pthread_mutex_t          lock;
+    struct cache_entry     **buckets;
+    size_t                   n_buckets;
+    struct cache_entry      *lru_head;
+    struct cache_entry      *lru_tail;
+    size_t                   bytes;
+    size_t                   limit;
+    uint64_t                 hits;
+    uint64_t                 misses;
+    uint64_t                 evictions;
+};
+
+struct op_stats
+{
+    uint64_t                 count;
+    uint64_t                 total_us;
+    uint64_t                 bucket[HIST_BUCKETS];
+};
+
+// Connections with a request waiting for a worker
+struct conn_queue
+{
+    pthread_mutex_t          lock;
+    pthread_cond_t           cond;
+    int                     *fds;
+    size_t                   cap;
+    size_t                   head;
+    size_t                   n;
+    bool                     stopping;          // workers finish their request and exit
+};
+
+// Connections between requests, polled by the main thread
+struct conn_idle
+{
+    pthread_mutex_t          lock;
+    int                     *fds;
+    size_t                   cap;
+    size_t                   n;
+    int                      wake[2];           // pipe to make the main thread poll the new set
+};
+
+struct msg
+{
+    uint8_t                 *data;
+    size_t                   len;
+    size_t                   cap;
+};
+
+struct msg_reader
+{
+    const uint8_t           *p;
+    const uint8_t           *end;
+    bool                     bad;
+};
+
+// A shared memory segment kept up to date with a macro
+struct publication
+{
+    char                    *path;
+    char                    *name;
+    struct gzm_shm           shm;
+};
+
+static struct cache cache;
+static struct publication *pubs;
+static size_t n_pubs;
+static pthread_mutex_t pubs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct op_stats op_stats[OP_MAX];
+static struct conn_queue queue;
+static struct conn_idle idle = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static volatile sig_atomic_t stop;
+
+static void *
+xrealloc (void *p, size_t size)
+{
+    p = realloc(p, size);
+    if (p == NULL && size != 0)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// Messages
+
+static void
+msg_put (struct msg *m, const void *data, size_t size)
+{
+    if (m->len + size > m->cap)
+    {
+        while (m->len + size > m->cap)
+            m->cap = (m->cap != 0) ? m->cap * 2 : 256;
+        m->data = xrealloc(m->data, m->cap);
+    }
+    memcpy(&m->data[m->len], data, size);
+    m->len += size;
+}
+
+static void
+msg_put_u8 (struct msg *m, uint8_t v)
+{
+    msg_put(m, &v, sizeof(v));
+}
+
+static void
+msg_put_u32 (struct msg *m, uint32_t v)
+{
+    msg_put(m, &v, sizeof(v));
+}
+
+static void
+msg_put_str (struct msg *m, const char *str)
+{
+    msg_put(m, str, strlen(str) + 1);
+}
+
+static void
+msg_get (struct msg_reader *r, void *data, size_t size)
+{
+    if (r->bad || (size_t)(r->end - r->p) < size)
+    {
+        r->bad = true;
+        memset(data, 0, size);
+        return;
+    }
+    memcpy(data, r->p, size);
+    r->p += size;
+}
+
+static uint32_t
+msg_get_u32 (struct msg_reader *r)
+{
+    uint32_t v;
+    msg_get(r, &v, sizeof(v));
+    return v;
+}
+
+static const char *
+msg_get_str (struct msg_reader *r)
+{
+    const uint8_t *nul;
+
+    if (r->bad || (nul = memchr(r->p, '\0', r->end - r->p)) == NULL)
+    {
+        r->bad = true;
+        return "";
+    }
+    const char *str = (const char *)r->p;
+    r->p = nul + 1;
+    return str;
+}
+
+static int
+read_full (int fd, void *buf, size_t size)
+{
+    uint8_t *p = buf;
+
+    while (size != 0)
+    {
+        ssize_t n = read(fd, p, size);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int
+write_full (int fd, const void *buf, size_t size)
+{
+    const uint8_t *p = buf;
+
+    while (size != 0)
+    {
+        ssize_t n = write(fd, p, size);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/* Send the message in `m`, whose first 4 bytes are reserved for the length */
+static int
+msg_send (int fd, struct msg *m)
+{
+    uint32_t len = m->len - sizeof(uint32_t);
+
+    memcpy(m->data, &len, sizeof(len));
+    return write_full(fd, m->data, m->len);
+}
+
+static int
+msg_recv (int fd, struct msg *m)
+{
+    uint32_t len;
+
+    if (read_full(fd, &len, sizeof(len)) != 0 || len == 0 || len > MAX_MESSAGE)
+        return -1;
+    m->len = 0;
+    if (len > m->cap)
+    {
+        m->cap = len;
+        m->data = xrealloc(m->data, m->cap);
+    }
+    if (read_full(fd, m->data, len) != 0)
+        return -1;
+    m->len = len;
+    return 0;
+}
+
+// Cache
+
+static int
+file_id_get (struct file_id *id, const char *path)
+{
+    struct stat st;
+    char journal[PATH_MAX];
+
+    memset(id, 0, sizeof(struct file_id));
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+    id->size = st.st_size;
+    id->mtime_sec = st.st_mtim.tv_sec;
+    id->mtime_nsec = st.st_mtim.tv_nsec;
+
+    snprintf(journal, sizeof(journal), "%s" GZM_JOURNAL_EXT, path);
+    if (stat(journal, &st) == 0)
+    {
+        id->journal_size = st.st_size;
+        id->journal_mtime_sec = st.st_mtim.tv_sec;
+        id->journal_mtime_nsec = st.st_mtim.tv_nsec;
+    }
+    return 0;
+}
+
+static size_t
+gzm_bytes (const struct gz_macro *gzm)
+{
+    return sizeof(struct gz_macro) + gzm->n_input * sizeof(struct movie_input) + gzm->n_seed * sizeof(struct movie_seed) +
+           gzm->n_oca_input * sizeof(struct movie_oca_input) + gzm->n_oca_sync * sizeof(struct movie_oca_sync) +
+           gzm->n_room_load * sizeof(struct movie_room_load);
+}
+
+/*
+ * Save a macro over `path` without ever leaving it half written: the macro goes to a temporary file in the
+ * same directory, which replaces `path` once it is on disk. The journal is only dropped after that.
+ */
+static int
+save_macro (const struct gz_macro *gzm, const char *path)
+{
+    char tmp[PATH_MAX];
+    struct stat st;
+    FILE *file;
+    int fd;
+    int ret;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp) || (fd = mkstemp(tmp)) < 0)
+        return -1;
+    if ((file = fdopen(fd, "wb")) == NULL)
+    {
+        close(fd);
+        remove(tmp);
+        return -1;
+    }
+    ret = gzm_stream_write(gzm, GZM_VERSION_LATEST, file);
+    if (ret == 0 && stat(path, &st) == 0)
+        ret = fchmod(fd, st.st_mode & 07777);
+    if (ret == 0 && (fflush(file) != 0 || fsync(fd) != 0))
+        ret = -1;
+    if (fclose(file) != 0)
+        ret = -1;
+    if (ret == 0 && rename(tmp, path) != 0)
+        ret = -1;
+    if (ret != 0)
+    {
+        remove(tmp);
+        return -1;
+    }
+    return gzm_journal_discard(path);
+}
+
+static void
+entry_free (struct cache_entry *ent)
+{
+    gzm_free(&ent->gzm);
+    pthread_rwlock_destroy(&ent->lock);
+    free(ent->path);
+    free(ent);
+}
+
+static void
+lru_unlink (struct cache_entry *ent)
+{
+    if (ent->lru_prev != NULL)
+        ent->lru_prev->lru_next = ent->lru_next;
+    else
+        cache.lru_head = ent->lru_next;
+    if (ent->lru_next != NULL)
+        ent->lru_next->lru_prev = ent->lru_prev;
+    else
+        cache.lru_tail = ent->lru_prev;
+    ent->lru_prev = ent->lru_next = NULL;
+}
+
+static void
+lru_push (struct cache_entry *ent)
+{
+    ent->lru_prev = NULL;
+    ent->lru_next = cache.lru_head;
+    if (cache.lru_head != NULL)
+        cache.lru_head->lru_prev = ent;
+    cache.lru_head = ent;
+    if (cache.lru_tail == NULL)
+        cache.lru_tail = ent;
+}
+
+/* Take an entry out of the cache, it is freed now or when its last user lets go. Cache lock held */
+static void
+cache_detach (struct cache_entry *ent)
+{
+    struct cache_entry **link = &cache.buckets[ent->hash & (cache.n_buckets - 1)];
+
+    while (*link != ent)
+        link = &(*link)->next;
+    *link = ent->next;
+    lru_unlink(ent);
+    cache.bytes -= ent->bytes;
+    ent->detached = true;
+    if (ent->refs == 0)
+        entry_free(ent);
+}
+
+/* Evict the least recently used entries until the cache fits, entries in use count but are not evicted */
+static void
+cache_evict (void)
+{
+    struct cache_entry *ent = cache.lru_tail;
+
+    while (cache.bytes > cache.limit && ent != NULL)
+    {
+        struct cache_entry *prev = ent->lru_prev;
+
+        if (ent->refs == 0 && ent != cache.lru_head)
+        {
+            cache_detach(ent);
+            cache.evictions++;
+        }
+        ent = prev;
+    }
+}
+
+static struct cache_entry *
+cache_find (const char *path, uint64_t hash)
+{
+    for (struct cache_entry *ent = cache.buckets[hash & (cache.n_buckets - 1)]; ent != NULL; ent = ent->next)
+    {
+        if (ent->hash == hash && strcmp(ent->path, path) == 0)
+            return ent;
+    }
+    return NULL;
+}
+
+/* The decoded macro for `path` as it is on disk now, NULL if it cannot be read. Release with cache_put */
+static struct cache_entry *
+cache_get (const char *path)
+{
+    uint64_t hash = hash64(path, strlen(path), 0);
+    struct cache_entry *ent;
+    struct cache_entry *loaded;
+    struct file_id id;
+
+    if (file_id_get(&id, path) != 0)
+        return NULL;
+
+    pthread_mutex_lock(&cache.lock);
+    ent = cache_find(path, hash);
+    // while a WRITE replaces the file the entry is what it will hold, once the writer releases the lock
+    if (ent != NULL && (ent->writing || memcmp(&ent->id, &id, sizeof(id)) == 0))
+    {
+        ent->refs++;
+        lru_unlink(ent);
+        lru_push(ent);
+        cache.hits++;
+        pthread_mutex_unlock(&cache.lock);
+        return ent;
+    }
+    if (ent != NULL)
+        cache_detach(ent);
+    cache.misses++;
+    pthread_mutex_unlock(&cache.lock);
+
+    // decode without holding the cache, two requests for the same new file may both decode it
+    loaded = calloc(1, sizeof(struct cache_entry));
+    if (loaded == NULL || gzm_read(&loaded->gzm, path) != 0)
+    {
+        if (loaded != NULL)
+            gzm_free(&loaded->gzm);
+        free(loaded);
+        return NULL;
+    }
+    loaded->path = strdup(path);
+    loaded->hash = hash;
+    loaded->id = id;
+    loaded->bytes = gzm_bytes(&loaded->gzm);
+    loaded->refs = 1;
+    pthread_rwlock_init(&loaded->lock, NULL);
+
+    pthread_mutex_lock(&cache.lock);
+    ent = cache_find(path, hash);
+    if (ent != NULL && (ent->writing || memcmp(&ent->id, &id, sizeof(id)) == 0))
+    {
+        ent->refs++;
+        pthread_mutex_unlock(&cache.lock);
+        entry_free(loaded);
+        return ent;
+    }
+    if (ent != NULL)
+        cache_detach(ent);
+    loaded->next = cache.buckets[hash & (cache.n_buckets - 1)];
+    cache.buckets[hash & (cache.n_buckets - 1)] = loaded;
+    lru_push(loaded);
+    cache.bytes += loaded->bytes;
+    cache_evict();
+    pthread_mutex_unlock(&cache.lock);
+    return loaded;
+}
+
+static void
+cache_put (struct cache_entry *ent)
+{
+    pthread_mutex_lock(&cache.lock);
+    if (--ent->refs == 0 && ent->detached)
+        entry_free(ent);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/* Mark the entry as being written, so requests for its path wait for the WRITE instead of reading the file */
+static void
+cache_begin_write (struct cache_entry *ent)
+{
+    pthread_mutex_lock(&cache.lock);
+    ent->writing = true;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/*
+ * After a WRITE that saved the entry's macro, the entry describes the file as it is on disk. After one that
+ * failed its id is kept, so if the file changed anyway the next request reads it again. Entry locked for
+ * writing.
+ */
+static void
+cache_end_write (struct cache_entry *ent, bool saved)
+{
+    size_t bytes = gzm_bytes(&ent->gzm);
+
+    pthread_mutex_lock(&cache.lock);
+    ent->writing = false;
+    if (!saved)
+    {
+        pthread_mutex_unlock(&cache.lock);
+        return;
+    }
+    if (!ent->detached)
+        cache.bytes += bytes - ent->bytes;
+    ent->bytes = bytes;
+    if (!ent->detached && file_id_get(&ent->id, ent->path) != 0)
+        cache_detach(ent);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// Requests
+
+static int
+do_stat (struct msg_reader *req, struct msg *res)
+{
+    const char *path = msg_get_str(req);
+    struct cache_entry *ent;
+
+    if (req->bad)
+        return STATUS_BAD_REQUEST;
+    if ((ent = cache_get(path)) == NULL)
+        return STATUS_READ_FAILED;
+
+    pthread_rwlock_rdlock(&ent->lock);
+    const struct gz_macro *gzm = &ent->gzm;
+    uint32_t counts[7] =
+    {
+        gzm->n_input, gzm->n_seed, gzm->n_oca_input, gzm->n_oca_sync, gzm->n_room_load,
+        gzm->rerecords, gzm->last_recorded_frame,
+    };
+    msg_put(res, counts, sizeof(counts));
+    msg_put(res, gzm->seed, gzm->n_seed * sizeof(struct movie_seed));
+    pthread_rwlock_unlock(&ent->lock);
+
+    cache_put(ent);
+    return STATUS_OK;
+}
+
+static int
+do_slice (struct msg_reader *req, struct msg *res)
+{
+    const char *path = msg_get_str(req);
+    const char *out_path = msg_get_str(req);
+    uint32_t start = msg_get_u32(req);
+    uint32_t end = msg_get_u32(req);
+    struct cache_entry *ent;
+    struct gz_macro out;
+    int status = STATUS_OK;
+
+    if (req->bad)
+        return STATUS_BAD_REQUEST;
+    if ((ent = cache_get(path)) == NULL)
+        return STATUS_READ_FAILED;
+
+    pthread_rwlock_rdlock(&ent->lock);
+    if (gzm_slice(&out, &ent->gzm, start, end) != 0)
+        status = STATUS_BAD_RANGE;
+    pthread_rwlock_unlock(&ent->lock);
+    cache_put(ent);
+
+    if (status == STATUS_OK)
+    {
+        if (gzm_write(&out, out_path) != 0)
+            status = STATUS_WRITE_FAILED;
+        gzm_free(&out);
+    }
+    return status;
+}
+
+static int
+do_cat (struct msg_reader *req, struct msg *res)
+{
+    const char *path1 = msg_get_str(req);
+    const char *path2 = msg_get_str(req);
+    const char *out_path = msg_get_str(req);
+    struct cache_entry *ent1;
+    struct cache_entry *ent2;
+    struct gz_macro out;
+    int status = STATUS_OK;
+
+    if (req->bad)
+        return STATUS_BAD_REQUEST;
+    if ((ent1 = cache_get(path1)) == NULL)
+        return STATUS_READ_FAILED;
+    if ((ent2 = cache_get(path2)) == NULL)
+    {
+        cache_put(ent1);
+        return STATUS_READ_FAILED;
+    }
+
+    // the same macro twice is locked once
+    pthread_rwlock_rdlock(&ent1->lock);
+    if (ent2 != ent1)
+        pthread_rwlock_rdlock(&ent2->lock);
+    if (gzm_cat_r(&out, &ent1->gzm, &ent2->gzm) != 0)
+        status = STATUS_BAD_RANGE;
+    if (ent2 != ent1)
+        pthread_rwlock_unlock(&ent2->lock);
+    pthread_rwlock_unlock(&ent1->lock);
+    cache_put(ent2);
+    cache_put(ent1);
+
+    if (status == STATUS_OK)
+    {
+        if (gzm_write(&out, out_path) != 0)
+            status = STATUS_WRITE_FAILED;
+        gzm_free(&out);
+    }
+    return status;
+}
+
+static int
+do_query (struct msg_reader *req, struct msg *res)
+{
+    const char *path = msg_get_str(req);
+    uint32_t start = msg_get_u32(req);
+    uint32_t n = msg_get_u32(req);
+    struct cache_entry *ent;
+    int status = STATUS_OK;
+
+    if (req->bad)
+        return STATUS_BAD_REQUEST;
+    if ((ent = cache_get(path)) == NULL)
+        return STATUS_READ_FAILED;
+
+    pthread_rwlock_rdlock(&ent->lock);
+    if (start > ent->gzm.n_input)
+    {
+        status = STATUS_BAD_RANGE;
+    }
+    else
+    {
+        if (n > ent->gzm.n_input - start)
+            n = ent->gzm.n_input - start;
+        msg_put_u32(res, n);
+        for (uint32_t i = 0; i < n; i++)
+            msg_put(res, &ent->gzm.input[start + i].raw, sizeof(z64_controller_t));
+    }
+    pthread_rwlock_unlock(&ent->lock);
+
+    cache_put(ent);
+    return status;
+}
+
+static int
+do_write (struct msg_reader *req, struct msg *res)
+{
+    const char *path = msg_get_str(req);
+    uint32_t start = msg_get_u32(req);
+    uint32_t n = msg_get_u32(req);
+    struct cache_entry *ent;
+    int status = STATUS_OK;
+
+    if (req->bad || (size_t)(req->end - req->p) != (size_t)n * sizeof(z64_controller_t))
+        return STATUS_BAD_REQUEST;
+    if ((ent = cache_get(path)) == NULL)
+        return STATUS_READ_FAILED;
+
+    // edit a copy, the entry keeps describing the file until the edit is saved
+    pthread_rwlock_wrlock(&ent->lock);
+    struct gz_macro gzm;
+    if (start > ent->gzm.n_input)
+    {
+        status = STATUS_BAD_RANGE;
+        goto end;
+    }
+    if (gzm_dup(&gzm, &ent->gzm) != 0)
+    {
+        gzm_free(&gzm);
+        status = STATUS_WRITE_FAILED;
+        goto end;
+    }
+    if (start + n > gzm.n_input)
+    {
+        gzm.input = xrealloc(gzm.input, (start + n) * sizeof(struct movie_input));
+        gzm.n_input = start + n;
+    }
+    for (uint32_t i = 0; i < n; i++)
+        msg_get(req, &gzm.input[start + i].raw, sizeof(z64_controller_t));
+
+    // pad_delta of the new inputs and of the one after them
+    for (uint32_t i = start; i < start + n + 1 && i < gzm.n_input; i++)
+        gzm.input[i].pad_delta = PAD_DELTA((i == 0) ? gzm.input_start.pad : gzm.input[i - 1].raw.pad, gzm.input[i].raw.pad);
+
+    cache_begin_write(ent);
+    if (save_macro(&gzm, ent->path) != 0)
+    {
+        // the file was left as it was, and so is the entry
+        gzm_free(&gzm);
+        cache_end_write(ent, false);
+        status = STATUS_WRITE_FAILED;
+        goto end;
+    }
+    gzm_free(&ent->gzm);
+    ent->gzm = gzm;
+    cache_end_write(ent, true);
+
+    pthread_mutex_lock(&pubs_lock);
+    for (size_t i = 0; i < n_pubs; i++)
+    {
+        if (strcmp(pubs[i].path, ent->path) == 0 && gzm_shm_publish(&pubs[i].shm, &ent->gzm) != 0)
+            fprintf(stderr, "error: could not republish '%s': %s\n", pubs[i].name, strerror(errno));
+    }
+    pthread_mutex_unlock(&pubs_lock);
+end:
+    pthread_rwlock_unlock(&ent->lock);
+    cache_put(ent);
+    return status;
+}
+
+/* Publish the macro, taking over the segment if it was published from another macro before */
+static int
+do_publish (struct msg_reader *req, struct msg *res)
+{
+    const char *path = msg_get_str(req);
+    const char *name = msg_get_str(req);
+    struct cache_entry *ent;
+    struct publication *pub = NULL;
+    int status = STATUS_OK;
+
+    if (req->bad || name[0] != '/')
+        return STATUS_BAD_REQUEST;
+    if ((ent = cache_get(path)) == NULL)
+        return STATUS_READ_FAILED;
+
+    pthread_rwlock_rdlock(&ent->lock);
+    pthread_mutex_lock(&pubs_lock);
+    for (size_t i = 0; i < n_pubs; i++)
+    {
+        if (strcmp(pubs[i].name, name) == 0)
+            pub = &pubs[i];
+    }
+    if (pub == NULL)
+    {
+        pubs = xrealloc(pubs, (n_pubs + 1) * sizeof(struct publication));
+        pub = &pubs[n_pubs];
+        if (gzm_shm_create(&pub->shm, name) == 0)
+        {
+            pub->path = NULL;
+            pub->name = strdup(name);
+            n_pubs++;
+        }
+        else
+        {
+            pub = NULL;
+        }
+    }
+    if (pub != NULL)
+    {
+        free(pub->path);
+        pub->path = strdup(ent->path);
+    }
+    if (pub == NULL || gzm_shm_publish(&pub->shm, &ent->gzm) != 0)
+        status = STATUS_PUBLISH_FAILED;
+    pthread_mutex_unlock(&pubs_lock);
+    pthread_rwlock_unlock(&ent->lock);
+
+    cache_put(ent);
+    return status;
+}
+
+/* Upper bound of the histogram bucket holding the given fraction of the requests */
+static uint64_t
+percentile_us (const struct op_stats *s, uint64_t count, double fraction)
+{
+    uint64_t seen = 0;
+
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        seen += __atomic_load_n(&s->bucket[b], __ATOMIC_RELAXED);
+        if (seen >= fraction * count)
+            return 1ull << b;
+    }
+    return 1ull << (HIST_BUCKETS - 1);
+}
+
+static void
+print_stats (struct msg *out)
+{
+    char line[256];
+
+    pthread_mutex_lock(&cache.lock);
+    snprintf(line, sizeof(line), "cache: %zu of %zu KiB, %llu hits, %llu misses, %llu evictions\n",
+             cache.bytes / 1024, cache.limit / 1024, (unsigned long long)cache.hits,
+             (unsigned long long)cache.misses, (unsigned long long)cache.evictions);
+    pthread_mutex_unlock(&cache.lock);
+    msg_put(out, line, strlen(line));
+
+    for (int op = OP_STAT; op < OP_MAX; op++)
+    {
+        const struct op_stats *s = &op_stats[op];
+        uint64_t count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+
+        if (count == 0)
+            continue;
+        snprintf(line, sizeof(line), "%s: %llu requests, mean %llu us, p50 < %llu us, p99 < %llu us\n",
+                 op_names[op], (unsigned long long)count,
+                 (unsigned long long)(__atomic_load_n(&s->total_us, __ATOMIC_RELAXED) / count),
+                 (unsigned long long)percentile_us(s, count, 0.5), (unsigned long long)percentile_us(s, count, 0.99));
+        msg_put(out, line, strlen(line));
+        for (int b = 0; b < HIST_BUCKETS; b++)
+        {
+            uint64_t n = __atomic_load_n(&s->bucket[b], __ATOMIC_RELAXED);
+
+            if (n == 0)
+                continue;
+            snprintf(line, sizeof(line), "  < %10llu us: %llu\n", 1ull << b, (unsigned long long)n);
+            msg_put(out, line, strlen(line));
+        }
+    }
+}
+
+static int
+do_stats (struct msg_reader *req, struct msg *res)
+{
+    print_stats(res);
+    msg_put_u8(res, '\0');
+    return STATUS_OK;
+}
+
+static int (*const handlers[OP_MAX])(struct msg_reader *req, struct msg *res) =
+{
+    [OP_STAT]    = do_stat,
+    [OP_SLICE]   = do_slice,
+    [OP_CAT]     = do_cat,
+    [OP_QUERY]   = do_query,
+    [OP_WRITE]   = do_write,
+    [OP_STATS]   = do_stats,
+    [OP_PUBLISH] = do_publish,
+};
+
+static uint64_t
+now_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+record_latency (int op, uint64_t us)
+{
+    int b = 0;
+
+    while (b < HIST_BUCKETS - 1 && (1ull << b) <= us)
+        b++;
+    __atomic_fetch_add(&op_stats[op].count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&op_stats[op].total_us, us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&op_stats[op].bucket[b], 1, __ATOMIC_RELAXED);
+}
+
+/* Serve one request, returns whether the connection stays open for the next */
+static bool
+serve_request (int fd, struct msg *req, struct msg *res)
+{
+    if (msg_recv(fd, req) != 0)
+        return false;
+
+    uint64_t t0 = now_us();
+    struct msg_reader r = { &req->data[1], &req->data[req->len], false };
+    int op = req->data[0];
+    uint8_t status;
+
+    res->len = 0;
+    msg_put_u32(res, 0);
+    msg_put_u8(res, 0);
+
+    status = (op > 0 && op < OP_MAX) ? handlers[op](&r, res) : STATUS_BAD_REQUEST;
+    if (status != STATUS_OK)
+        res->len = sizeof(uint32_t) + 1;
+    res->data[sizeof(uint32_t)] = status;
+    if (msg_send(fd, res) != 0)
+        return false;
+
+    if (op > 0 && op < OP_MAX)
+        record_latency(op, now_us() - t0);
+    return true;
+}
+
+static void
+wake_main (void)
+{
+    // the pipe is non-blocking, when it is full the main thread is awake anyway
+    ssize_t ret = write(idle.wake[1], "", 1);
+    (void)ret;
+}
+
+static void
+idle_add (int fd)
+{
+    pthread_mutex_lock(&idle.lock);
+    if (idle.n == idle.cap)
+    {
+        idle.cap = (idle.cap != 0) ? idle.cap * 2 : 64;
+        idle.fds = xrealloc(idle.fds, idle.cap * sizeof(int));
+    }
+    idle.fds[idle.n++] = fd;
+    pthread_mutex_unlock(&idle.lock);
+    wake_main();
+}
+
+/*
+ * Workers serve a single request at a time, then hand the connection back to the main thread to wait for
+ * the next, so clients keeping their connection open do not hold on to a worker.
+ */
+static void *
+worker (void *arg)
+{
+    struct msg req = { 0 };
+    struct msg res = { 0 };
+
+    while (true)
+    {
+        int fd;
+
+        pthread_mutex_lock(&queue.lock);
+        while (queue.n == 0 && !queue.stopping)
+            pthread_cond_wait(&queue.cond, &queue.lock);
+        if (queue.stopping)
+        {
+            pthread_mutex_unlock(&queue.lock);
+            break;
+        }
+        fd = queue.fds[queue.head];
+        queue.head = (queue.head + 1) % queue.cap;
+        queue.n--;
+        pthread_mutex_unlock(&queue.lock);
+
+        if (serve_request(fd, &req, &res))
+            idle_add(fd);
+        else
+            close(fd);
+    }
+    free(req.data);
+    free(res.data);
+    return NULL;
+}
+
+static void
+queue_push (int fd)
+{
+    pthread_mutex_lock(&queue.lock);
+    if (queue.n == queue.cap)
+    {
+        size_t cap = (queue.cap != 0) ? queue.cap * 2 : 64;
+        int *fds = xrealloc(NULL, cap * sizeof(int));
+
+        for (size_t i = 0; i < queue.n; i++)
+            fds[i] = queue.fds[(queue.head + i) % queue.cap];
+        free(queue.fds);
+        queue.fds = fds;
+        queue.cap = cap;
+        queue.head = 0;
+    }
+    queue.fds[(queue.head + queue.n) % queue.cap] = fd;
+    queue.n++;
+    pthread_cond_signal(&queue.cond);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+static void
+on_signal (int sig)
+{
+    stop = 1;
+    wake_main();
+}
+
+static void
+default_socket (char *buf, size_t size)
+{
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+
+    if (dir != NULL && dir[0] != '\0')
+        snprintf(buf, size, "%s/gzmd.sock", dir);
+    else
+        snprintf(buf, size, "/tmp/gzmd-%u.sock", (unsigned)getuid());
+}
+
+static int
+socket_addr (struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return -1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static int
+serve (const char *socket_path, long n_jobs, size_t limit)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    int fd;
+
+    if (socket_addr(&addr, socket_path) != 0)
+    {
+        printf("Could not use socket path %s\n", socket_path);
+        return EXIT_FAILURE;
+    }
+
+    // a socket nobody answers on is left over from a daemon that did not exit cleanly
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        printf("gzmd is already running on %s\n", socket_path);
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    unlink(socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0)
+    {
+        printf("Could not listen on %s: %s\n", socket_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_init(&cache.lock, NULL);
+    cache.n_buckets = 4096;
+    cache.buckets = calloc(cache.n_buckets, sizeof(struct cache_entry *));
+    cache.limit = limit;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.cond, NULL);
+    if (pipe(idle.wake) != 0)
+    {
+        printf("Could not create a pipe: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(idle.wake[i], F_SETFL, O_NONBLOCK);
+        fcntl(idle.wake[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;          // also wakes poll through the pipe
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // signals go to the main thread only, to interrupt its poll
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    pthread_t *threads = malloc(n_jobs * sizeof(pthread_t));
+    for (long t = 0; t < n_jobs; t++)
+        pthread_create(&threads[t], NULL, worker, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+    printf("gzmd listening on %s\n", socket_path);
+    fflush(stdout);
+
+    // Wait for new connections and for requests on the idle ones, then hand those to the workers
+    struct pollfd *pfds = NULL;
+    size_t n_pfds = 0;
+    while (!stop)
+    {
+        pthread_mutex_lock(&idle.lock);
+        n_pfds = idle.n + 2;
+        pfds = xrealloc(pfds, n_pfds * sizeof(struct pollfd));
+        pfds[0] = (struct pollfd){ .fd = fd, .events = POLLIN };
+        pfds[1] = (struct pollfd){ .fd = idle.wake[0], .events = POLLIN };
+        for (size_t i = 0; i < idle.n; i++)
+            pfds[i + 2] = (struct pollfd){ .fd = idle.fds[i], .events = POLLIN };
+        pthread_mutex_unlock(&idle.lock);
+
+        if (poll(pfds, n_pfds, -1) < 0)
+        {
+            if (errno != EINTR)
+                break;
+            continue;
+        }
+
+        if (pfds[1].revents & POLLIN)
+        {
+            char buf[64];
+            while (read(idle.wake[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+
+        pthread_mutex_lock(&idle.lock);
+        for (size_t i = 2; i < n_pfds; i++)
+        {
+            if (pfds[i].revents == 0)
+                continue;
+            for (size_t k = 0; k < idle.n; k++)
+            {
+                if (idle.fds[k] == pfds[i].fd)
+                {
+                    idle.fds[k] = idle.fds[--idle.n];
+                    break;
+                }
+            }
+            queue_push(pfds[i].fd);
+        }
+        pthread_mutex_unlock(&idle.lock);
+
+        if (pfds[0].revents & POLLIN)
+        {
+            int conn = accept(fd, NULL, NULL);
+
+            if (conn >= 0)
+            {
+                // a client stalling mid-message only holds a worker for so long
+                struct timeval timeout = { .tv_sec = 10 };
+
+                fcntl(conn, F_SETFD, FD_CLOEXEC);
+                setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                idle_add(conn);
+            }
+        }
+    }
+    free(pfds);
+
+    // Stop accepting, let the workers finish the requests they are in, a write in particular
+    close(fd);
+    unlink(socket_path);
+    pthread_mutex_lock(&queue.lock);
+    queue.stopping = true;
+    pthread_cond_broadcast(&queue.cond);
+    pthread_mutex_unlock(&queue.lock);
+    for (long t = 0; t < n_jobs; t++)
+        pthread_join(threads[t], NULL);
+    free(threads);
+    for (size_t i = 0; i < queue.n; i++)
+        close(queue.fds[(queue.head + i) % queue.cap]);
+    for (size_t i = 0; i < idle.n; i++)
+        close(idle.fds[i]);
+
+    // readers keep what they have mapped
+    for (size_t i = 0; i < n_pubs; i++)
+        gzm_shm_remove(pubs[i].name);
+
+    struct msg out = { 0 };
+    print_stats(&out);
+    fwrite(out.data, 1, out.len, stdout);
+    free(out.data);
+    return EXIT_SUCCESS;
+}
+
+// Client
+
+static int
+client_connect (const char *socket_path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (socket_addr(&addr, socket_path) != 0)
+        return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* An absolute path for the daemon, which does not share our working directory */
+static void
+put_path (struct msg *m, const char *path)
+{
+    char buf[PATH_MAX];
+
+    if (realpath(path, buf) != NULL)
+    {
+        msg_put_str(m, buf);
+    }
+    else if (path[0] != '/' && getcwd(buf, sizeof(buf)) != NULL)
+    {
+        // an output that does not exist yet
+        msg_put(m, buf, strlen(buf));
+        msg_put(m, "/", 1);
+        msg_put_str(m, path);
+    }
+    else
+    {
+        msg_put_str(m, path);
+    }
+}
+
+static int
+parse_input (z64_controller_t *input, const char *str)
+{
+    unsigned pad;
+    int x;
+    int y;
+
+    if (sscanf(str, "%x:%d:%d", &pad, &x, &y) != 3 || pad > 0xFFFF || x < -128 || x > 127 || y < -128 || y > 127)
+        return -1;
+    input->pad = pad;
+    input->x = x;
+    input->y = y;
+    return 0;
+}
+
+static int
+client (const char *socket_path, int argc, const char *argv[])
+{
+    const char *cmd = argv[0];
+    struct msg req = { 0 };
+    struct msg res = { 0 };
+    int fd;
+    int op;
+
+    msg_put_u32(&req, 0);
+    if (strcmp(cmd, "stat") == 0 && argc == 2)
+    {
+        op = OP_STAT;
+        msg_put_u8(&req, op);
+        put_path(&req, argv[1]);
+    }
+    else if (strcmp(cmd, "slice") == 0 && argc == 5)
+    {
+        op = OP_SLICE;
+        msg_put_u8(&req, op);
+        put_path(&req, argv[1]);
+        put_path(&req, argv[2]);
+        msg_put_u32(&req, strtoul(argv[3], NULL, 0));
+        msg_put_u32(&req, strtoul(argv[4], NULL, 0));
+    }
+    else if (strcmp(cmd, "cat") == 0 && argc == 4)
+    {
+        op = OP_CAT;
+        msg_put_u8(&req, op);
+        put_path(&req, argv[1]);
+        put_path(&req, argv[2]);
+        put_path(&req, argv[3]);
+    }
+    else if (strcmp(cmd, "query") == 0 && argc == 4)
+    {
+        op = OP_QUERY;
+        msg_put_u8(&req, op);
+        put_path(&req, argv[1]);
+        msg_put_u32(&req, strtoul(argv[2], NULL, 0));
+        msg_put_u32(&req, strtoul(argv[3], NULL, 0));
+    }
+    else if (strcmp(cmd, "write") == 0 && argc >= 3)
+    {
+        op = OP_WRITE;
+        msg_put_u8(&req, op);
+        put_path(&req, argv[1]);
+        msg_put_u32(&req, strtoul(argv[2], NULL, 0));
+        msg_put_u32(&req, argc - 3);
+        for (int i = 3; i < argc; i++)
+        {
+            z64_controller_t input;
+
+            if (parse_input(&input, argv[i]) != 0)
+            {
+                printf("Could not parse input %s, expected <pad>:<x>:<y>\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            msg_put(&req, &input, sizeof(input));
+        }
+    }
+    else if (strcmp(cmd, "publish") == 0 && argc == 3)
+    {
+        op = OP_PUBLISH;
+        msg_put_u8(&req, op);
+        put_path(&req, argv[1]);
+        if (argv[2][0] != '/')
+            msg_put(&req, "/", 1);
+        msg_put_str(&req, argv[2]);
+    }
+    else if (strcmp(cmd, "stats") == 0 && argc == 1)
+    {
+        op = OP_STATS;
+        msg_put_u8(&req, op);
+    }
+    else
+    {
+        printf("Unknown command %s\n", cmd);
+        return EXIT_FAILURE;
+    }
+
+    fd = client_connect(socket_path);
+    if (fd < 0)
+    {
+        printf("Could not connect to gzmd on %s\n", socket_path);
+        return EXIT_FAILURE;
+    }
+    if (msg_send(fd, &req) != 0 || msg_recv(fd, &res) != 0)
+    {
+        printf("Could not talk to gzmd on %s\n", socket_path);
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    struct msg_reader r = { &res.data[1], &res.data[res.len], false };
+    if (res.data[0] != STATUS_OK)
+    {
+        printf("Could not %s: %s\n", cmd, (res.data[0] <= STATUS_PUBLISH_FAILED) ? status_strs[res.data[0]] : "error");
+        return EXIT_FAILURE;
+    }
+
+    if (op == OP_STAT)
+    {
+        struct gz_macro gzm;
+        uint32_t counts[7];
+
+        gzm_new(&gzm);
+        msg_get(&r, counts, sizeof(counts));
+        gzm.n_input = counts[0];
+        gzm.n_seed = counts[1];
+        gzm.n_oca_input = counts[2];
+        gzm.n_oca_sync = counts[3];
+        gzm.n_room_load = counts[4];
+        gzm.rerecords = counts[5];
+        gzm.last_recorded_frame = counts[6];
+        if ((size_t)(r.end - r.p) != gzm.n_seed * sizeof(struct movie_seed))
+            return EXIT_FAILURE;
+        gzm.seed = malloc(gzm.n_seed * sizeof(struct movie_seed) + 1);
+        msg_get(&r, gzm.seed, gzm.n_seed * sizeof(struct movie_seed));
+
+        printf("%s:\n", argv[1]);
+        gzm_print_stats(&gzm);
+        gzm_print_seeds(&gzm);
+        gzm_free(&gzm);
+    }
+    else if (op == OP_QUERY)
+    {
+        uint32_t start = strtoul(argv[2], NULL, 0);
+        uint32_t n = msg_get_u32(&r);
+
+        for (uint32_t i = 0; i < n && !r.bad; i++)
+        {
+            z64_controller_t input;
+
+            msg_get(&r, &input, sizeof(input));
+            printf("%u: ", start + i);
+            gzm_print_pad(&input);
+        }
+    }
+    else if (op == OP_STATS)
+    {
+        printf("%s", (const char *)r.p);
+    }
+    free(req.data);
+    free(res.data);
+    return EXIT_SUCCESS;
+}
+
+static void
+usage (const char *prog)
+{
+    printf("%s: Keep decoded macros in memory and serve requests on them.\n", prog);
+    printf("Usage: %s [-s <socket>] serve [-j <threads>] [-m <MiB>]\n", prog);
+    printf("       %s [-s <socket>] stat <input>\n", prog);
+    printf("       %s [-s <socket>] slice <input> <output> <start_frame> <end_frame>\n", prog);
+    printf("       %s [-s <socket>] cat <input1> <input2> <output>\n", prog);
+    printf("       %s [-s <socket>] query <input> <start_frame> <n_frames>\n", prog);
+    printf("       %s [-s <socket>] write <input> <start_frame> <pad>:<x>:<y> ...\n", prog);
+    printf("       %s [-s <socket>] publish <input> <shm_name>\n", prog);
+    printf("       %s [-s <socket>] stats\n", prog);
+    printf("  -s <socket>   socket path (default: $XDG_RUNTIME_DIR/gzmd.sock)\n");
+    printf("  -j <threads>  number of connections served at once (default: number of cpus)\n");
+    printf("  -m <MiB>      memory for decoded macros (default: %d)\n", DEFAULT_MEMORY_MB);
+}
+
+int
+main (int argc, const char *argv[])
+{
+    char socket_path[PATH_MAX];
+    int i = 1;
+
+    default_socket(socket_path, sizeof(socket_path));
+    if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+    {
+        snprintf(socket_path, sizeof(socket_path), "%s", argv[i + 1]);
+        i += 2;
+    }
+    if (i == argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(argv[i], "serve") == 0)
+    {
+        long n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t limit = (size_t)DEFAULT_MEMORY_MB << 20;
+
+        for (i++; i < argc; i++)
+        {
+            if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+                n_jobs = atol(argv[++i]);
+            else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+                limit = (size_t)atol(argv[++i]) << 20;
+            else
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        if (n_jobs < 1)
+            n_jobs = 1;
+        return serve(socket_path, n_jobs, limit);
+    }
+
+    return client(socket_path, argc - i, &argv[i]);
+}
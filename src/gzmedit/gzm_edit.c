@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_edit.h"
+
+int
+main (int argc, const char *argv[])
+{
+    struct gz_macro gzm;
+    struct gzm_edit_op *ops;
+    int n_ops = argc - 3;
+    int exc = EXIT_SUCCESS;
+
+    if (argc < 4)
+    {
+        printf("%s: Apply a list of edits to a macro in one pass.\n", argv[0]);
+        printf("Usage: %s <input> <output> <op>[@<start>[-[<end>]]] ...\n", argv[0]);
+        printf("Ops:\n");
+        printf("  clear:<buttons>           release buttons, e.g. clear:A+B\n");
+        printf("  press:<buttons>           press buttons\n");
+        printf("  noreset                   release the reset signal\n");
+        printf("  clamp:<x|y|xy>:<lo>:<hi>  clamp the stick\n");
+        printf("  scale:<x|y|xy>:<mul>/<div> scale the stick\n");
+        printf("  offset:<x|y|xy>:<add>     offset the stick\n");
+        printf("  stick:<x|y|xy>:<value>    set the stick\n");
+        printf("  shift:<delta>             move seeds, ocarina and room load events in range\n");
+        printf("  start:<buttons>:<x>:<y>   set the starting input\n");
+        printf("  slice                     keep only the range, after all other ops\n");
+        printf("Ranges are frames <start> up to but not including <end>, the whole macro by default.\n");
+        return EXIT_FAILURE;
+    }
+
+    ops = malloc(n_ops * sizeof(struct gzm_edit_op));
+    for (int i = 0; i < n_ops; i++)
+    {
+        if (gzm_edit_parse(&ops[i], argv[3 + i]) != 0)
+        {
+            printf("Invalid op %s\n", argv[3 + i]);
+            free(ops);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (gzm_read(&gzm, argv[1]) != 0)
+    {
+        printf("Could not read %s\n", argv[1]);
+        gzm_free(&gzm);
+        free(ops);
+        return EXIT_FAILURE;
+    }
+    if (gzm_edit(&gzm, ops, n_ops) != 0)
+    {
+        printf("Could not edit %s\n", argv[1]);
+        exc = EXIT_FAILURE;
+    }
+    else if (gzm_write(&gzm, argv[2]) != 0)
+    {
+        printf("Could not write %s\n", argv[2]);
+        exc = EXIT_FAILURE;
+    }
+    gzm_free(&gzm);
+    free(ops);
+    return exc;
+}
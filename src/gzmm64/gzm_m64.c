@@ -0,0 +1,205 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_journal.h"
+#include "../libgzx/gzm_m64.h"
+
+struct convert_job
+{
+    const char              *input;
+    char                    *output;
+    bool                     error;
+};
+
+struct convert_work
+{
+    struct convert_job      *jobs;
+    size_t                   n;
+    size_t                   next;
+    bool                     export;
+    pthread_mutex_t          lock;
+};
+
+static FILE *
+open_file (const char *file_name, const char *mode)
+{
+    if (strcmp(file_name, "-") == 0)
+        return (mode[0] == 'r') ? stdin : stdout;
+    return fopen(file_name, mode);
+}
+
+static void
+close_file (FILE *file)
+{
+    if (file != stdin && file != stdout)
+        fclose(file);
+}
+
+static int
+convert (const char *input, const char *output, bool export)
+{
+    FILE *in;
+    FILE *out;
+    int ret;
+
+    // Conversion streams the file as it is, saves still in a journal would be missed
+    if (export && strcmp(input, "-") != 0 && gzm_journal_exists(input))
+    {
+        printf("%s has a journal of incremental saves, run gzmcompact on it first\n", input);
+        return -1;
+    }
+
+    in = open_file(input, "rb");
+    if (in == NULL)
+    {
+        printf("Could not open %s for reading\n", input);
+        return -1;
+    }
+    out = open_file(output, "wb");
+    if (out == NULL)
+    {
+        printf("Could not open %s for writing\n", output);
+        close_file(in);
+        return -1;
+    }
+
+    ret = export ? gzm_m64_export(in, out) : gzm_m64_import(in, out);
+    if (ret != 0)
+        printf("Could not convert %s\n", input);
+    close_file(in);
+    close_file(out);
+    return ret;
+}
+
+static void *
+convert_worker (void *arg)
+{
+    struct convert_work *work = arg;
+
+    while (true)
+    {
+        size_t i;
+
+        pthread_mutex_lock(&work->lock);
+        i = work->next++;
+        pthread_mutex_unlock(&work->lock);
+
+        if (i >= work->n)
+            break;
+        work->jobs[i].error = (convert(work->jobs[i].input, work->jobs[i].output, work->export) != 0);
+    }
+    return NULL;
+}
+
+/* Output path for batch mode, the input's file name in `dir` with the other extension */
+static char *
+batch_output (const char *dir, const char *input, bool export)
+{
+    const char *name = strrchr(input, '/');
+    const char *ext = export ? ".m64" : ".gzm";
+    const char *dot;
+    char *path;
+
+    name = (name != NULL) ? name + 1 : input;
+    dot = strrchr(name, '.');
+    if (dot == NULL)
+        dot = name + strlen(name);
+
+    path = malloc(strlen(dir) + (dot - name) + strlen(ext) + 2);
+    sprintf(path, "%s/%.*s%s", dir, (int)(dot - name), name, ext);
+    return path;
+}
+
+static void
+usage (const char *prog)
+{
+    printf("%s: Convert between macros and Mupen64 .m64 movies.\n", prog);
+    printf("Usage: %s export|import <input> <output>\n", prog);
+    printf("       %s export|import [-j <jobs>] -d <dir> <input> [<input> ...]\n", prog);
+    printf("  export converts a macro to a movie, import a movie to a macro\n");
+    printf("  -d <dir>    convert every input into <dir>, with the extension changed\n");
+    printf("  -j <jobs>   number of files to convert at once (default: number of cpus)\n");
+    printf("Pass - to read from stdin or write to stdout.\n");
+}
+
+int
+main (int argc, const char *argv[])
+{
+    const char *dir = NULL;
+    long n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool export;
+    int i;
+
+    if (argc < 3 || (strcmp(argv[1], "export") != 0 && strcmp(argv[1], "import") != 0))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    export = (strcmp(argv[1], "export") == 0);
+
+    for (i = 2; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            n_jobs = atol(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (dir == NULL)
+    {
+        if (argc - i != 2)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return (convert(argv[i], argv[i + 1], export) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (i == argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (n_jobs < 1)
+        n_jobs = 1;
+
+    // Batch, files are converted in parallel
+    struct convert_work work = { .n = argc - i, .next = 0, .export = export };
+    pthread_t *threads = malloc(n_jobs * sizeof(pthread_t));
+
+    work.jobs = calloc(work.n, sizeof(struct convert_job));
+    for (size_t j = 0; j < work.n; j++)
+    {
+        work.jobs[j].input = argv[i + j];
+        work.jobs[j].output = batch_output(dir, argv[i + j], export);
+    }
+
+    pthread_mutex_init(&work.lock, NULL);
+    for (long t = 0; t < n_jobs; t++)
+        pthread_create(&threads[t], NULL, convert_worker, &work);
+    for (long t = 0; t < n_jobs; t++)
+        pthread_join(threads[t], NULL);
+    pthread_mutex_destroy(&work.lock);
+    free(threads);
+
+    size_t n_failed = 0;
+    for (size_t j = 0; j < work.n; j++)
+    {
+        n_failed += work.jobs[j].error;
+        free(work.jobs[j].output);
+    }
+    free(work.jobs);
+    printf("%zu files converted, %zu failed\n", work.n - n_failed, n_failed);
+    return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,194 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libgzx/files.h"
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_rng.h"
+
+#define DEFAULT_MAX_PER_FRAME 1000
+
+// How the rng got from one seed event to the next
+struct rng_link
+{
+    uint32_t                 frame_from;
+    uint32_t                 frame_to;
+    uint32_t                 steps;
+    bool                     bad;
+};
+
+struct rng_file
+{
+    const char              *path;
+    struct rng_link         *links;             // one per consecutive pair of seeds
+    uint32_t                 n_links;
+    uint32_t                 n_bad;
+    bool                     error;
+};
+
+struct rng_work
+{
+    struct rng_file         *files;
+    uint32_t                 max_per_frame;
+};
+
+/*
+ * Between two seed events the game runs from the new seed of the first to the old seed of the second. The
+ * number of rng calls that takes is recovered exactly; a chain is implausible when it goes back in frames or
+ * needs more calls than the frames in between could have made.
+ */
+static void
+rng_one (struct rng_file *f, uint32_t max_per_frame)
+{
+    struct gz_macro gzm;
+
+    // gzm_read fails on a file that cannot be read, it may have been removed since it was listed
+    if (gzm_read(&gzm, f->path) != 0)
+    {
+        f->error = true;
+        gzm_free(&gzm);
+        return;
+    }
+
+    if (gzm.n_seed > 1)
+    {
+        f->links = malloc((gzm.n_seed - 1) * sizeof(struct rng_link));
+        if (f->links == NULL)
+        {
+            f->error = true;
+            gzm_free(&gzm);
+            return;
+        }
+        f->n_links = gzm.n_seed - 1;
+    }
+    for (uint32_t i = 0; i < f->n_links; i++)
+    {
+        const struct movie_seed *a = &gzm.seed[i];
+        const struct movie_seed *b = &gzm.seed[i + 1];
+        struct rng_link *link = &f->links[i];
+        uint64_t limit;
+
+        link->frame_from = a->frame_idx;
+        link->frame_to = b->frame_idx;
+        link->steps = gzm_rng_distance(a->new_seed, b->old_seed);
+
+        // a seed set and read back on the same frame still leaves that frame's calls
+        limit = (b->frame_idx > a->frame_idx) ? (uint64_t)(b->frame_idx - a->frame_idx) * max_per_frame : max_per_frame;
+        link->bad = (b->frame_idx < a->frame_idx || link->steps > limit);
+        f->n_bad += link->bad;
+    }
+    gzm_free(&gzm);
+}
+
+static void
+rng_job (void *arg, size_t i)
+{
+    struct rng_work *work = arg;
+
+    rng_one(&work->files[i], work->max_per_frame);
+}
+
+static void
+print_link (uint32_t i, const struct rng_link *link)
+{
+    uint32_t frames = link->frame_to - link->frame_from;
+
+    printf("  seed %u -> %u: frames %u -> %u, %u rng calls", i, i + 1, link->frame_from, link->frame_to, link->steps);
+    if (link->frame_to > link->frame_from)
+        printf(" (%.1f per frame)", (double)link->steps / frames);
+    printf("%s\n", link->bad ? ", implausible" : "");
+}
+
+static void
+usage (const char *prog)
+{
+    printf("%s: Check that the rng seeds of macros chain together.\n", prog);
+    printf("Usage: %s [-j <jobs>] [-m <calls>] [-v] <input|dir> [<input|dir> ...]\n", prog);
+    printf("  -j <jobs>   number of files to check at once (default: number of cpus)\n");
+    printf("  -m <calls>  most rng calls a frame can make (default: %d)\n", DEFAULT_MAX_PER_FRAME);
+    printf("  -v          list every pair of seeds, not only implausible ones\n");
+}
+
+int
+main (int argc, const char *argv[])
+{
+    struct files_list list = { 0 };
+    struct rng_file *files;
+    uint32_t max_per_frame = DEFAULT_MAX_PER_FRAME;
+    bool verbose = false;
+    long n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            n_jobs = atol(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            max_per_frame = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-v") == 0)
+            verbose = true;
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (i == argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (n_jobs < 1)
+        n_jobs = 1;
+
+    for (; i < argc; i++)
+    {
+        if (files_list_add_arg(&list, argv[i]) != 0)
+        {
+            fprintf(stderr, "error: out of memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+    files = calloc(list.n + 1, sizeof(struct rng_file));
+    if (files == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t f = 0; f < list.n; f++)
+        files[f].path = list.paths[f];
+
+    // Check files in parallel
+    struct rng_work work = { .files = files, .max_per_frame = max_per_frame };
+    files_run_jobs(list.n, n_jobs, rng_job, &work);
+
+    // Report in argument order
+    size_t n_bad = 0;
+    for (size_t f = 0; f < list.n; f++)
+    {
+        struct rng_file *file = &files[f];
+
+        if (file->error)
+        {
+            printf("%s: could not read file\n", file->path);
+            n_bad++;
+            continue;
+        }
+        if (file->n_bad == 0 && !verbose)
+            continue;
+
+        n_bad += (file->n_bad != 0);
+        printf("%s:%s\n", file->path, (file->n_bad == 0) ? " ok" : "");
+        for (uint32_t l = 0; l < file->n_links; l++)
+        {
+            if (verbose || file->links[l].bad)
+                print_link(l, &file->links[l]);
+        }
+    }
+    printf("%zu macros checked, %zu with implausible seed chains\n", list.n, n_bad);
+
+    return (n_bad == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
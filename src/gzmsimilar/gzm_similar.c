@@ -0,0 +1,339 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../libgzx/files.h"
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_cache.h"
+#include "../libgzx/gzm_journal.h"
+#include "../libgzx/gzm_minhash.h"
+#include "../libgzx/hash.h"
+
+#define DEFAULT_CACHE_NAME ".gzmsimilar-cache"
+#define CACHE_TAG ((GZM_MINHASH_K << 8) | GZM_MINHASH_SHINGLE)  // signatures change with the parameters
+
+// LSH banding: signatures agreeing on all rows of any band become candidate pairs
+#define LSH_BANDS 32
+#define LSH_ROWS (GZM_MINHASH_K / LSH_BANDS)
+
+struct similar_file
+{
+    const char              *path;
+    struct stat              st;
+    struct gzm_signature     sig;
+    bool                     error;
+    bool                     cached;
+};
+
+struct similar_work
+{
+    struct similar_file     *files;
+    struct gzm_cache        *cache;
+};
+
+struct band_key
+{
+    uint64_t                 hash;
+    uint32_t                 file;
+};
+
+struct pair
+{
+    uint32_t                 a;
+    uint32_t                 b;
+    double                   similarity;
+};
+
+static void *
+xrealloc (void *p, size_t size)
+{
+    p = realloc(p, size);
+    if (p == NULL && size != 0)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void
+sign_one (struct similar_file *f, struct gzm_cache *cache)
+{
+    const struct gzm_cache_entry *ent;
+    struct gzm_fingerprint fp;
+    struct gz_macro gzm;
+    uint64_t key;
+    void *data;
+    size_t size;
+    bool stream = (strcmp(f->path, "-") == 0);
+    bool journal;
+
+    if (!stream && stat(f->path, &f->st) != 0)
+    {
+        f->error = true;
+        return;
+    }
+
+    // pipes and stdin have nothing to cache, saves in a journal are not part of the file's size, time or contents
+    stream = stream || !S_ISREG(f->st.st_mode);
+    journal = !stream && gzm_journal_exists(f->path);
+    if (!stream && !journal)
+    {
+        ent = gzm_cache_find(cache, f->path, &f->st);
+        if (ent != NULL && ent->data_size == sizeof(f->sig))
+        {
+            memcpy(&f->sig, ent->data, sizeof(f->sig));
+            f->cached = true;
+            return;
+        }
+    }
+
+    // read failures are reported without exiting, the file may have been removed since it was listed
+    if (files_read_whole_file(f->path, true, &data, &size) != 0)
+    {
+        f->error = true;
+        return;
+    }
+    if (stream || journal)
+    {
+        if (gzm_decode(&gzm, data, size) != 0 || (journal && gzm_journal_replay(&gzm, f->path, data, size) != 0))
+            f->error = true;
+        else
+            gzm_minhash(&f->sig, &gzm);
+        gzm_free(&gzm);
+        free(data);
+        return;
+    }
+
+    // the signature only depends on the inputs, so edits to the events find it too
+    gzm_fingerprint(&fp, data, size);
+    key = gzm_fingerprint_key(&fp, 1u << GZM_SECTION_INPUT);
+    ent = gzm_cache_find_key(cache, key);
+    if (ent != NULL && ent->data_size == sizeof(f->sig))
+    {
+        memcpy(&f->sig, ent->data, sizeof(f->sig));
+        f->cached = true;
+    }
+    else if (gzm_decode(&gzm, data, size) == 0)
+    {
+        gzm_minhash(&f->sig, &gzm);
+        gzm_free(&gzm);
+    }
+    else
+    {
+        // reported every time, not cached
+        f->error = true;
+        gzm_free(&gzm);
+    }
+    free(data);
+
+    if (!f->error)
+        gzm_cache_add(cache, f->path, &f->st, key, &f->sig, sizeof(f->sig));
+}
+
+static void
+sign_job (void *arg, size_t i)
+{
+    struct similar_work *work = arg;
+
+    sign_one(&work->files[i], work->cache);
+}
+
+static int
+cmp_band_key (const void *a, const void *b)
+{
+    const struct band_key *x = a;
+    const struct band_key *y = b;
+
+    if (x->hash != y->hash)
+        return (x->hash > y->hash) - (x->hash < y->hash);
+    return (x->file > y->file) - (x->file < y->file);
+}
+
+static int
+cmp_pair_files (const void *a, const void *b)
+{
+    const struct pair *x = a;
+    const struct pair *y = b;
+
+    if (x->a != y->a)
+        return (x->a > y->a) - (x->a < y->a);
+    return (x->b > y->b) - (x->b < y->b);
+}
+
+static int
+cmp_pair_similarity (const void *a, const void *b)
+{
+    const struct pair *x = a;
+    const struct pair *y = b;
+
+    if (x->similarity != y->similarity)
+        return (x->similarity < y->similarity) - (x->similarity > y->similarity);
+    return cmp_pair_files(a, b);
+}
+
+/* Candidate pairs from LSH banding, scored and filtered by the full signature similarity */
+static struct pair *
+find_pairs (const struct similar_file *files, size_t n_files, double threshold, size_t *n_out)
+{
+    struct band_key *keys = xrealloc(NULL, n_files * sizeof(struct band_key) + 1);
+    struct pair *pairs = NULL;
+    size_t n_pairs = 0;
+    size_t cap = 0;
+
+    for (int band = 0; band < LSH_BANDS; band++)
+    {
+        size_t n_keys = 0;
+
+        for (size_t i = 0; i < n_files; i++)
+        {
+            if (files[i].error)
+                continue;
+            keys[n_keys].hash = hash64(&files[i].sig.min[band * LSH_ROWS], LSH_ROWS * sizeof(uint32_t), band);
+            keys[n_keys].file = i;
+            n_keys++;
+        }
+        qsort(keys, n_keys, sizeof(struct band_key), cmp_band_key);
+
+        for (size_t i = 0; i < n_keys; )
+        {
+            size_t j = i + 1;
+
+            while (j < n_keys && keys[j].hash == keys[i].hash)
+                j++;
+            for (size_t a = i; a < j; a++)
+            {
+                for (size_t b = a + 1; b < j; b++)
+                {
+                    if (n_pairs == cap)
+                    {
+                        cap = (cap != 0) ? cap * 2 : 1024;
+                        pairs = xrealloc(pairs, cap * sizeof(struct pair));
+                    }
+                    pairs[n_pairs].a = keys[a].file;
+                    pairs[n_pairs].b = keys[b].file;
+                    n_pairs++;
+                }
+            }
+            i = j;
+        }
+
+        // drop pairs found by earlier bands as we go, so the list stays close to the number of distinct pairs
+        if (band == LSH_BANDS - 1 || n_pairs > 4 * n_files)
+        {
+            size_t n = 0;
+
+            qsort(pairs, n_pairs, sizeof(struct pair), cmp_pair_files);
+            for (size_t i = 0; i < n_pairs; i++)
+            {
+                if (n == 0 || pairs[i].a != pairs[n - 1].a || pairs[i].b != pairs[n - 1].b)
+                    pairs[n++] = pairs[i];
+            }
+            n_pairs = n;
+        }
+    }
+    free(keys);
+
+    size_t n = 0;
+    for (size_t i = 0; i < n_pairs; i++)
+    {
+        pairs[i].similarity = gzm_minhash_similarity(&files[pairs[i].a].sig, &files[pairs[i].b].sig);
+        if (pairs[i].similarity >= threshold)
+            pairs[n++] = pairs[i];
+    }
+    qsort(pairs, n, sizeof(struct pair), cmp_pair_similarity);
+    *n_out = n;
+    return pairs;
+}
+
+static void
+usage (const char *prog)
+{
+    printf("%s: Find macros with near-identical inputs.\n", prog);
+    printf("Usage: %s [-j <jobs>] [-c <cache> | -n] [-t <threshold>] <input|dir> [<input|dir> ...]\n", prog);
+    printf("  -j <jobs>       number of files to read at once (default: number of cpus)\n");
+    printf("  -c <cache>      signature cache file (default: " DEFAULT_CACHE_NAME ")\n");
+    printf("  -n              do not use a signature cache\n");
+    printf("  -t <threshold>  lowest similarity to report, from 0 to 1 (default: 0.8)\n");
+}
+
+int
+main (int argc, const char *argv[])
+{
+    struct files_list list = { 0 };
+    struct similar_file *files;
+    struct gzm_cache cache;
+    const char *cache_name = DEFAULT_CACHE_NAME;
+    double threshold = 0.8;
+    long n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            n_jobs = atol(argv[++i]);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            cache_name = argv[++i];
+        else if (strcmp(argv[i], "-n") == 0)
+            cache_name = NULL;
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (i == argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (n_jobs < 1)
+        n_jobs = 1;
+
+    for (; i < argc; i++)
+    {
+        if (files_list_add_arg(&list, argv[i]) != 0)
+        {
+            fprintf(stderr, "error: out of memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+    files = xrealloc(NULL, (list.n + 1) * sizeof(struct similar_file));
+    memset(files, 0, (list.n + 1) * sizeof(struct similar_file));
+    for (size_t f = 0; f < list.n; f++)
+        files[f].path = list.paths[f];
+
+    gzm_cache_open(&cache, cache_name, CACHE_TAG);
+
+    // Compute signatures in parallel
+    struct similar_work work = { .files = files, .cache = &cache };
+    files_run_jobs(list.n, n_jobs, sign_job, &work);
+
+    size_t n_cached = 0;
+    for (size_t f = 0; f < list.n; f++)
+    {
+        n_cached += files[f].cached;
+        if (files[f].error)
+            printf("%s: could not read file\n", files[f].path);
+    }
+
+    size_t n_pairs;
+    struct pair *pairs = find_pairs(files, list.n, threshold, &n_pairs);
+    for (size_t p = 0; p < n_pairs; p++)
+        printf("%.3f %s %s\n", pairs[p].similarity, files[pairs[p].a].path, files[pairs[p].b].path);
+    printf("%zu macros compared, %zu similar pairs (%zu signatures from cache)\n", list.n, n_pairs, n_cached);
+    free(pairs);
+
+    if (gzm_cache_save(&cache) != 0)
+        fprintf(stderr, "warning: could not write cache '%s': %s\n", cache_name, strerror(errno));
+    gzm_cache_close(&cache);
+
+    return EXIT_SUCCESS;
+}
@@ -19,7 +19,12 @@ main (int argc, const char *argv[])
 		printf("Usage: %s <input> <output> <start_frame> <end-frame>\n", argv[0]);
 		return EXIT_FAILURE;
 	}
-	gzm_read(&input_gzm, argv[1]);
+	if (gzm_read(&input_gzm, argv[1]) != 0)
+	{
+		printf("Could not read %s\n", argv[1]);
+		gzm_free(&input_gzm);
+		return EXIT_FAILURE;
+	}
 	start_frame = atoi(argv[3]);
 	end_frame = atoi(argv[4]);
 	if (gzm_slice(&output_gzm, &input_gzm, start_frame, end_frame) != 0)
@@ -36,8 +41,15 @@ main (int argc, const char *argv[])
 	}
 	else
 	{
-		gzm_write(&output_gzm, argv[2]);
-		exc = EXIT_SUCCESS;
+		if (gzm_write(&output_gzm, argv[2]) != 0)
+		{
+			printf("Could not write %s\n", argv[2]);
+			exc = EXIT_FAILURE;
+		}
+		else
+		{
+			exc = EXIT_SUCCESS;
+		}
 	}
 	gzm_free(&input_gzm);
 	gzm_free(&output_gzm);
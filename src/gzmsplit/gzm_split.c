@@ -0,0 +1,182 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libgzx/files.h"
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_split.h"
+
+struct split_work
+{
+    struct gz_macro         *out;
+    char                   **names;
+    bool                    *failed;
+    size_t                   n;
+};
+
+static void
+write_job (void *arg, size_t i)
+{
+    struct split_work *work = arg;
+
+    work->failed[i] = (gzm_write(&work->out[i], work->names[i]) != 0);
+}
+
+/* Parse a comma separated list of frames, returns the number of frames or -1, *frames must be freed either way */
+static long
+parse_frames (uint32_t **frames, const char *str)
+{
+    size_t n = 0;
+    char *end;
+
+    *frames = malloc((strlen(str) / 2 + 1) * sizeof(uint32_t));
+    if (*frames == NULL)
+        return -1;
+    while (true)
+    {
+        unsigned long v = strtoul(str, &end, 0);
+
+        if (end == str || v > UINT32_MAX)
+            return -1;
+        (*frames)[n++] = v;
+        if (*end == '\0')
+            return n;
+        if (*end != ',')
+            return -1;
+        str = end + 1;
+    }
+}
+
+static void
+usage (const char *prog)
+{
+    printf("%s: Split a macro into segments in one pass.\n", prog);
+    printf("Usage: %s [-j <jobs>] -r|-s|-f <frame,...> <input> <output_prefix>\n", prog);
+    printf("  -j <jobs>        number of segments to write at once (default: number of cpus)\n");
+    printf("  -r               cut on every room load\n");
+    printf("  -s               cut on every rng seed\n");
+    printf("  -f <frame,...>   cut on the given frames\n");
+    printf("Segments are written to <output_prefix>000.gzm, <output_prefix>001.gzm and so on.\n");
+}
+
+int
+main (int argc, const char *argv[])
+{
+    struct gz_macro gzm;
+    struct gz_macro *out;
+    uint32_t *cuts = NULL;
+    size_t n_cuts = 0;
+    int at = -1;
+    const char *frames = NULL;
+    long n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            n_jobs = atol(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0)
+            at = GZM_SPLIT_ROOM_LOAD;
+        else if (strcmp(argv[i], "-s") == 0)
+            at = GZM_SPLIT_SEED;
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            frames = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - i != 2 || (at < 0) == (frames == NULL))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (n_jobs < 1)
+        n_jobs = 1;
+
+    if (gzm_read(&gzm, argv[i]) != 0)
+    {
+        printf("Could not read %s\n", argv[i]);
+        gzm_free(&gzm);
+        return EXIT_FAILURE;
+    }
+
+    if (frames != NULL)
+    {
+        long n = parse_frames(&cuts, frames);
+
+        if (n < 0)
+        {
+            printf("Could not parse frame list %s\n", frames);
+            free(cuts);
+            gzm_free(&gzm);
+            return EXIT_FAILURE;
+        }
+        n_cuts = gzm_split_normalize(cuts, n, gzm.n_input);
+    }
+    else if (gzm_split_cuts(&cuts, &n_cuts, &gzm, at) != 0)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        gzm_free(&gzm);
+        return EXIT_FAILURE;
+    }
+
+    out = malloc((n_cuts + 1) * sizeof(struct gz_macro));
+    if (out == NULL || gzm_split(out, &gzm, cuts, n_cuts) != 0)
+    {
+        printf("Could not split %s\n", argv[i]);
+        free(out);
+        free(cuts);
+        gzm_free(&gzm);
+        return EXIT_FAILURE;
+    }
+
+    // Write all segments in parallel
+    const char *prefix = argv[i + 1];
+    struct split_work work = { .out = out, .n = n_cuts + 1 };
+
+    work.names = calloc(work.n, sizeof(char *));
+    work.failed = calloc(work.n, sizeof(bool));
+    for (size_t k = 0; work.names != NULL && k < work.n; k++)
+    {
+        work.names[k] = malloc(strlen(prefix) + 32);
+        if (work.names[k] == NULL)
+            break;
+        sprintf(work.names[k], "%s%03zu.gzm", prefix, k);
+    }
+    if (work.names == NULL || work.names[work.n - 1] == NULL || work.failed == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    files_run_jobs(work.n, n_jobs, write_job, &work);
+
+    int exc = EXIT_SUCCESS;
+    uint32_t start = 0;
+    for (size_t k = 0; k < work.n; k++)
+    {
+        if (work.failed[k])
+        {
+            printf("Could not write %s\n", work.names[k]);
+            exc = EXIT_FAILURE;
+        }
+        else
+        {
+            printf("%s: frames %u-%u\n", work.names[k], start, start + out[k].n_input);
+        }
+        start += out[k].n_input;
+        gzm_free(&out[k]);
+        free(work.names[k]);
+    }
+    free(work.names);
+    free(work.failed);
+    free(out);
+    free(cuts);
+    gzm_free(&gzm);
+    return exc;
+}
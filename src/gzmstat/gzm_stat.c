@@ -1,29 +1,552 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../libgzx/gzm.h"
+#include "../libgzx/gzm_cache.h"
+#include "../libgzx/gzm_journal.h"
+#include "../libgzx/gzm_stream.h"
+
+#define CACHE_TAG 0x53540001                    // "ST", version 1 of the stat record
+#define CACHE_SECTIONS ((1u << GZM_SECTION_SCALARS) | (1u << GZM_SECTION_SEED))
+
+// A macro being followed in watch mode, along with its last decoded state
+struct watch_file
+{
+    char                    *path;
+    const char              *name;              // file name part of path
+    int                      wd;                // watch of the containing directory
+    struct gz_macro          gzm;
+    bool                     loaded;
+    off_t                    size;
+    struct timespec          mtime;
+};
+
+// A directory being watched, either for all macros in it or only for the files named on the command line
+struct watch_dir
+{
+    char                    *path;
+    int                      wd;
+    bool                     all;
+};
+
+struct watch
+{
+    int                      fd;
+    struct watch_file       *files;
+    size_t                   n_files;
+    struct watch_dir        *dirs;
+    size_t                   n_dirs;
+};
+
+// Everything that is printed for a macro, cached as this followed by the seeds
+struct stat_record
+{
+    uint32_t                 n_input;
+    uint32_t                 n_seed;
+    uint32_t                 n_oca_input;
+    uint32_t                 n_oca_sync;
+    uint32_t                 n_room_load;
+    uint32_t                 rerecords;
+    uint32_t                 last_recorded_frame;
+};
+
+static const struct
+{
+    const char  *name;
+    size_t       offset;
+} stat_fields[] =
+{
+    { "n_input",             offsetof(struct gz_macro, n_input)             },
+    { "n_seed",              offsetof(struct gz_macro, n_seed)              },
+    { "n_oca_input",         offsetof(struct gz_macro, n_oca_input)         },
+    { "n_oca_sync",          offsetof(struct gz_macro, n_oca_sync)          },
+    { "n_room_load",         offsetof(struct gz_macro, n_room_load)         },
+    { "rerecords",           offsetof(struct gz_macro, rerecords)           },
+    { "last_recorded_frame", offsetof(struct gz_macro, last_recorded_frame) },
+};
+
+static uint32_t
+stat_field (const struct gz_macro *gzm, int i)
+{
+    uint32_t v;
+    memcpy(&v, (const uint8_t *)gzm + stat_fields[i].offset, sizeof(v));
+    return v;
+}
+
+static void
+print_seed (int i, const struct movie_seed *seed)
+{
+    printf("  seed %d: frame: %u, old: %08x, new: %08x\n", i, seed->frame_idx, seed->old_seed, seed->new_seed);
+}
+
+// Inputs are not printed, so a macro coming through stdin does not need to be kept in memory
+static void
+discard_inputs (void *arg, uint32_t frame, const struct movie_input *input, size_t n)
+{
+}
+
+static void *
+stat_record (const struct gz_macro *gzm, size_t *size)
+{
+    struct stat_record rec =
+    {
+        gzm->n_input, gzm->n_seed, gzm->n_oca_input, gzm->n_oca_sync, gzm->n_room_load,
+        gzm->rerecords, gzm->last_recorded_frame,
+    };
+    uint8_t *data;
+
+    *size = sizeof(rec) + gzm->n_seed * sizeof(struct movie_seed);
+    data = malloc(*size);
+    memcpy(data, &rec, sizeof(rec));
+    if (gzm->n_seed != 0)
+        memcpy(data + sizeof(rec), gzm->seed, gzm->n_seed * sizeof(struct movie_seed));
+    return data;
+}
+
+/* Fill in what is printed from a cached record, the inputs and other events are left empty */
+static bool
+stat_from_record (struct gz_macro *gzm, const struct gzm_cache_entry *ent)
+{
+    const uint8_t *data = ent->data;
+    struct stat_record rec;
+
+    if (ent->data_size < sizeof(rec))
+        return false;
+    memcpy(&rec, data, sizeof(rec));
+    if (ent->data_size != sizeof(rec) + (uint64_t)rec.n_seed * sizeof(struct movie_seed))
+        return false;
+
+    memset(gzm, 0, sizeof(struct gz_macro));
+    gzm->n_input = rec.n_input;
+    gzm->n_seed = rec.n_seed;
+    gzm->n_oca_input = rec.n_oca_input;
+    gzm->n_oca_sync = rec.n_oca_sync;
+    gzm->n_room_load = rec.n_room_load;
+    gzm->rerecords = rec.rerecords;
+    gzm->last_recorded_frame = rec.last_recorded_frame;
+    if (rec.n_seed != 0)
+    {
+        gzm->seed = malloc(rec.n_seed * sizeof(struct movie_seed));
+        memcpy(gzm->seed, data + sizeof(rec), rec.n_seed * sizeof(struct movie_seed));
+    }
+    return true;
+}
+
+/* Read a whole file without exiting if it cannot be read, it may have been removed since it was listed */
+static void *
+read_data (const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    struct stat st;
+    uint8_t *data = NULL;
+
+    if (file == NULL)
+        return NULL;
+    if (fstat(fileno(file), &st) == 0 && (data = malloc(st.st_size + 1)) != NULL)
+    {
+        *size = st.st_size;
+        if (fread(data, 1, *size, file) != *size)
+        {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+/*
+ * Read what is printed for a macro, from the cache when the file has not changed or when another file had
+ * the same counts and seeds. Only plain files without a journal are cached.
+ */
+static int
+stat_read (struct gz_macro *gzm, const char *path, struct gzm_cache *cache)
+{
+    const struct gzm_cache_entry *ent;
+    struct gzm_fingerprint fp;
+    struct stat st;
+    uint64_t key;
+    uint8_t *data;
+    void *rec;
+    size_t size;
+    bool journal;
+    int ret;
+
+    gzm_new(gzm);
+    if (stat(path, &st) != 0)
+        return -1;
+    if (!S_ISREG(st.st_mode))
+        return gzm_read(gzm, path);
+    journal = gzm_journal_exists(path);
+    if (!journal)
+    {
+        ent = gzm_cache_find(cache, path, &st);
+        if (ent != NULL && stat_from_record(gzm, ent))
+            return 0;
+    }
+
+    data = read_data(path, &size);
+    if (data == NULL)
+        return -1;
+    if (journal)
+    {
+        ret = gzm_decode(gzm, data, size);
+        if (ret == 0)
+            ret = gzm_journal_replay(gzm, path, data, size);
+        free(data);
+        return ret;
+    }
+
+    gzm_fingerprint(&fp, data, size);
+    key = gzm_fingerprint_key(&fp, CACHE_SECTIONS);
+    ent = gzm_cache_find_key(cache, key);
+    if (ent != NULL && stat_from_record(gzm, ent))
+    {
+        ret = 0;
+        gzm_cache_add(cache, path, &st, key, ent->data, ent->data_size);
+    }
+    else
+    {
+        // a macro that does not decode is reported every time, not cached
+        ret = gzm_decode(gzm, data, size);
+        if (ret == 0)
+        {
+            rec = stat_record(gzm, &size);
+            gzm_cache_add(cache, path, &st, key, rec, size);
+            free(rec);
+        }
+    }
+    free(data);
+    return ret;
+}
+
+static struct watch_file *
+watch_find_file (struct watch *w, int wd, const char *name)
+{
+    for (size_t i = 0; i < w->n_files; i++)
+    {
+        if (w->files[i].wd == wd && strcmp(w->files[i].name, name) == 0)
+            return &w->files[i];
+    }
+    return NULL;
+}
+
+static struct watch_file *
+watch_add_file (struct watch *w, int wd, const char *path)
+{
+    const char *name = strrchr(path, '/');
+    struct watch_file *f;
+
+    name = (name != NULL) ? name + 1 : path;
+    f = watch_find_file(w, wd, name);
+    if (f != NULL)
+        return f;
+
+    w->files = realloc(w->files, (w->n_files + 1) * sizeof(struct watch_file));
+    f = &w->files[w->n_files++];
+    memset(f, 0, sizeof(struct watch_file));
+    f->path = strdup(path);
+    f->name = f->path + (name - path);
+    f->wd = wd;
+    return f;
+}
+
+static bool
+is_gzm_name (const char *name)
+{
+    size_t len = strlen(name);
+    return len > 4 && strcmp(&name[len - 4], ".gzm") == 0;
+}
+
+/* Watch a directory, returns the watch descriptor or -1 */
+static int
+watch_add_dir (struct watch *w, const char *path, bool all)
+{
+    int wd = inotify_add_watch(w->fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+
+    if (wd < 0)
+    {
+        fprintf(stderr, "error: could not watch '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    size_t i;
+    for (i = 0; i < w->n_dirs && w->dirs[i].wd != wd; i++)
+        ;
+    if (i == w->n_dirs)
+    {
+        w->dirs = realloc(w->dirs, (w->n_dirs + 1) * sizeof(struct watch_dir));
+        w->dirs[i].path = strdup(path);
+        w->dirs[i].wd = wd;
+        w->dirs[i].all = false;
+        w->n_dirs++;
+    }
+
+    // Pick up the macros already in the directory
+    if (all && !w->dirs[i].all)
+    {
+        DIR *dir = opendir(path);
+        struct dirent *ent;
+
+        while (dir != NULL && (ent = readdir(dir)) != NULL)
+        {
+            if (is_gzm_name(ent->d_name))
+            {
+                char file_path[PATH_MAX];
+                snprintf(file_path, sizeof(file_path), "%s/%s", path, ent->d_name);
+                watch_add_file(w, wd, file_path);
+            }
+        }
+        if (dir != NULL)
+            closedir(dir);
+        w->dirs[i].all = true;
+    }
+    return wd;
+}
+
+/* Re-read a watched macro if it changed on disk and print what changed */
+static void
+watch_refresh (struct watch_file *f)
+{
+    struct stat st;
+    struct gz_macro old;
+    struct movie_seed *old_seeds = NULL;
+
+    if (stat(f->path, &st) != 0)
+    {
+        if (f->loaded)
+        {
+            printf("%s: removed\n", f->path);
+            gzm_free(&f->gzm);
+            f->loaded = false;
+        }
+        return;
+    }
+    if (f->loaded && st.st_size == f->size &&
+        st.st_mtim.tv_sec == f->mtime.tv_sec && st.st_mtim.tv_nsec == f->mtime.tv_nsec)
+        return;
+
+    f->size = st.st_size;
+    f->mtime = st.st_mtim;
+
+    // A macro that cannot be read, such as one caught half written, is skipped until it is saved again
+    if (!f->loaded)
+    {
+        gzm_new(&f->gzm);
+        if (gzm_read_update(&f->gzm, f->path) != 0)
+        {
+            gzm_free(&f->gzm);
+            return;
+        }
+        f->loaded = true;
+
+        printf("%s:\n", f->path);
+        gzm_print_stats(&f->gzm);
+        gzm_print_seeds(&f->gzm);
+        return;
+    }
+
+    // Keep what is needed to compare against, the inputs themselves are never printed
+    old = f->gzm;
+    if (old.n_seed != 0)
+    {
+        old_seeds = malloc(old.n_seed * sizeof(struct movie_seed));
+        memcpy(old_seeds, old.seed, old.n_seed * sizeof(struct movie_seed));
+    }
+
+    if (gzm_read_update(&f->gzm, f->path) != 0)
+    {
+        // read again in full on the next save
+        gzm_free(&f->gzm);
+        f->loaded = false;
+        free(old_seeds);
+        return;
+    }
+
+    bool header = false;
+    for (int i = 0; i < (int)(sizeof(stat_fields) / sizeof(stat_fields[0])); i++)
+    {
+        uint32_t a = stat_field(&old, i);
+        uint32_t b = stat_field(&f->gzm, i);
+
+        if (a == b)
+            continue;
+        if (!header)
+            printf("%s:\n", f->path);
+        header = true;
+        printf("  %s: %u -> %u\n", stat_fields[i].name, a, b);
+    }
+    for (uint32_t i = 0; i < f->gzm.n_seed; i++)
+    {
+        if (i < old.n_seed && memcmp(&old_seeds[i], &f->gzm.seed[i], sizeof(struct movie_seed)) == 0)
+            continue;
+        if (!header)
+            printf("%s:\n", f->path);
+        header = true;
+        print_seed(i, &f->gzm.seed[i]);
+    }
+    free(old_seeds);
+}
+
+static int
+watch_run (int argc, const char *argv[])
+{
+    struct watch w = { 0 };
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    w.fd = inotify_init1(IN_CLOEXEC);
+    if (w.fd < 0)
+    {
+        fprintf(stderr, "error: inotify: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // Files are followed through their directory so that saves which replace the file are seen too
+    for (int i = 0; i < argc; i++)
+    {
+        struct stat st;
+
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            if (watch_add_dir(&w, argv[i], true) < 0)
+                return EXIT_FAILURE;
+        }
+        else
+        {
+            char *dir = strdup(argv[i]);
+            char *slash = strrchr(dir, '/');
+            int wd;
+
+            if (slash == NULL)
+                strcpy(dir, ".");
+            else if (slash == dir)
+                slash[1] = '\0';
+            else
+                *slash = '\0';
+            wd = watch_add_dir(&w, dir, false);
+            free(dir);
+            if (wd < 0)
+                return EXIT_FAILURE;
+            watch_add_file(&w, wd, argv[i]);
+        }
+    }
+
+    // Initial state
+    for (size_t i = 0; i < w.n_files; i++)
+        watch_refresh(&w.files[i]);
+    fflush(stdout);
+
+    while (true)
+    {
+        ssize_t len = read(w.fd, buf, sizeof(buf));
+
+        if (len <= 0)
+        {
+            if (len < 0 && errno == EINTR)
+                continue;
+            fprintf(stderr, "error: inotify: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        for (char *p = buf; p < buf + len; )
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                // events were lost, check everything
+                for (size_t i = 0; i < w.n_files; i++)
+                    watch_refresh(&w.files[i]);
+                continue;
+            }
+            if (ev->len == 0)
+                continue;
+
+            struct watch_file *f = watch_find_file(&w, ev->wd, ev->name);
+
+            // new macros in a directory being watched as a whole
+            for (size_t d = 0; d < w.n_dirs && f == NULL; d++)
+            {
+                if (w.dirs[d].wd == ev->wd && w.dirs[d].all && is_gzm_name(ev->name))
+                {
+                    char path[PATH_MAX];
+                    snprintf(path, sizeof(path), "%s/%s", w.dirs[d].path, ev->name);
+                    f = watch_add_file(&w, ev->wd, path);
+                }
+            }
+            if (f != NULL)
+                watch_refresh(f);
+        }
+        fflush(stdout);
+    }
+}
 
 int
 main (int argc, const char *argv[])
 {
     struct gz_macro gzm;
+    struct gzm_cache cache;
+    const char *cache_name = NULL;
+    int exc = EXIT_SUCCESS;
+    int i;
 
-    if (argc != 2)
+    if (argc >= 3 && strcmp(argv[1], "--watch") == 0)
+        return watch_run(argc - 2, &argv[2]);
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            cache_name = argv[++i];
+        else
+            break;
+    }
+    if (i == argc)
     {
         printf("%s: Print information about a macro.\n", argv[0]);
-        printf("Usage: %s <input>\n", argv[0]);
+        printf("Usage: %s [-c <cache>] <input> [<input> ...]\n", argv[0]);
+        printf("       %s --watch <input|dir> [<input|dir> ...]\n", argv[0]);
+        printf("  -c <cache>  cache stats in this file, to skip unchanged macros on the next run\n");
         return EXIT_FAILURE;
     }
 
-    gzm_read(&gzm, argv[1]);
+    gzm_cache_open(&cache, cache_name, CACHE_TAG);
+    for (; i < argc; i++)
+    {
+        int ret;
+
+        if (strcmp(argv[i], "-") == 0)
+            ret = gzm_stream_read(&gzm, stdin, discard_inputs, NULL);
+        else
+            ret = stat_read(&gzm, argv[i], &cache);
+        if (ret != 0)
+        {
+            printf("Could not read %s\n", argv[i]);
+            exc = EXIT_FAILURE;
+            gzm_free(&gzm);
+            continue;
+        }
 
-    printf("%s:\n", argv[1]);
-    gzm_print_stats(&gzm);
-    gzm_print_seeds(&gzm);
-    //gzm_print_inputs(&gzm);
+        printf("%s:\n", argv[i]);
+        gzm_print_stats(&gzm);
+        gzm_print_seeds(&gzm);
+        //gzm_print_inputs(&gzm);
 
-    gzm_free(&gzm);
+        gzm_free(&gzm);
+    }
 
-    return EXIT_SUCCESS;
+    if (gzm_cache_save(&cache) != 0)
+        fprintf(stderr, "warning: could not write cache '%s': %s\n", cache_name, strerror(errno));
+    gzm_cache_close(&cache);
+    return exc;
 }
@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_text.h"
+
+static void
+usage (const char *prog)
+{
+    printf("%s: Convert a macro to or from text.\n", prog);
+    printf("Usage: %s export [-f text|csv|jsonl] <input> [<output>]\n", prog);
+    printf("       %s import <input> <output>\n", prog);
+    printf("Text may be read from stdin or written to stdout by passing -.\n");
+}
+
+int
+main (int argc, const char *argv[])
+{
+    struct gz_macro gzm;
+    int exc = EXIT_SUCCESS;
+
+    if (argc >= 3 && strcmp(argv[1], "export") == 0)
+    {
+        int format = GZM_TEXT_CSV;
+        int i = 2;
+        FILE *out = stdout;
+
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+        {
+            format = gzm_text_format_from_name(argv[i + 1]);
+            i += 2;
+        }
+        if (format < 0 || i >= argc || argc - i > 2)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (gzm_read(&gzm, argv[i]) != 0)
+        {
+            printf("Could not read %s\n", argv[i]);
+            gzm_free(&gzm);
+            return EXIT_FAILURE;
+        }
+        if (i + 1 < argc && strcmp(argv[i + 1], "-") != 0)
+        {
+            out = fopen(argv[i + 1], "w");
+            if (out == NULL)
+            {
+                printf("Could not open %s for writing\n", argv[i + 1]);
+                gzm_free(&gzm);
+                return EXIT_FAILURE;
+            }
+        }
+        if (gzm_text_write(&gzm, out, format) != 0)
+        {
+            printf("Could not write text for %s\n", argv[i]);
+            exc = EXIT_FAILURE;
+        }
+        if (out != stdout)
+            fclose(out);
+        gzm_free(&gzm);
+    }
+    else if (argc == 4 && strcmp(argv[1], "import") == 0)
+    {
+        FILE *in = stdin;
+
+        if (strcmp(argv[2], "-") != 0)
+        {
+            in = fopen(argv[2], "r");
+            if (in == NULL)
+            {
+                printf("Could not open %s for reading\n", argv[2]);
+                return EXIT_FAILURE;
+            }
+        }
+        if (gzm_text_read(&gzm, in) != 0)
+        {
+            printf("Could not parse %s\n", argv[2]);
+            exc = EXIT_FAILURE;
+        }
+        else if (gzm_write(&gzm, argv[3]) != 0)
+        {
+            printf("Could not write %s\n", argv[3]);
+            exc = EXIT_FAILURE;
+        }
+        if (in != stdin)
+            fclose(in);
+        gzm_free(&gzm);
+    }
+    else
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    return exc;
+}
@@ -0,0 +1,246 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_variant.h"
+
+#define BATCH 256                               // candidates taken by a worker at once
+
+struct variant_work
+{
+    const struct gzm_variant *v;
+    const char              *prefix;            // loose files, or
+    int                      archive_fd;        // an archive
+    int                      digits;
+    uint64_t                 next;
+    uint64_t                 n_failed;
+    pthread_mutex_t          lock;
+};
+
+// The buffers of one worker, reused for all of its candidates
+struct variant_thread
+{
+    pthread_t                thread;
+    struct variant_work     *work;
+    uint8_t                 *windows;
+    struct movie_input      *input;
+    char                    *name;
+};
+
+static void *
+variant_worker (void *arg)
+{
+    struct variant_thread *t = arg;
+    struct variant_work *work = t->work;
+    const struct gzm_variant *v = work->v;
+    uint8_t *windows = t->windows;
+    char *name = t->name;
+    uint64_t n_failed = 0;
+
+    while (true)
+    {
+        uint64_t k0;
+        uint64_t n;
+
+        pthread_mutex_lock(&work->lock);
+        k0 = work->next;
+        n = (v->n_candidates - k0 < BATCH) ? v->n_candidates - k0 : BATCH;
+        work->next += n;
+        pthread_mutex_unlock(&work->lock);
+
+        if (n == 0)
+            break;
+        for (uint64_t i = 0; i < n; i++)
+            gzm_variant_encode(v, k0 + i, &windows[i * v->window_size], t->input);
+
+        if (work->archive_fd >= 0)
+        {
+            // the windows of consecutive candidates are contiguous in the archive
+            size_t size = n * v->window_size;
+
+            if (pwrite(work->archive_fd, windows, size, gzm_variant_archive_offset(v, k0)) != (ssize_t)size)
+                n_failed += n;
+            continue;
+        }
+        for (uint64_t i = 0; i < n; i++)
+        {
+            sprintf(name, "%s%0*llu.gzm", work->prefix, work->digits, (unsigned long long)(k0 + i));
+            if (gzm_variant_write(v, &windows[i * v->window_size], name) != 0)
+            {
+                printf("Could not write %s\n", name);
+                n_failed++;
+            }
+        }
+    }
+
+    __atomic_fetch_add(&work->n_failed, n_failed, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void
+usage (const char *prog)
+{
+    printf("%s: Write every combination of input values in a few frames of a macro.\n", prog);
+    printf("Usage: %s [-j <jobs>] <input> <output_prefix> <frame>:<field>=<values> ...\n", prog);
+    printf("       %s [-j <jobs>] -a <archive> <input> <frame>:<field>=<values> ...\n", prog);
+    printf("       %s -x <archive> <index> <output>\n", prog);
+    printf("  -j <jobs>      number of threads (default: number of cpus)\n");
+    printf("  -a <archive>   write all candidates to one packed archive instead of a file each\n");
+    printf("  -x <archive>   extract candidate <index> of an archive\n");
+    printf("<field> is pad, x or y, <values> a comma separated list of <v> or <from>..<to>[/<step>].\n");
+    printf("Candidates are numbered with the last axis varying fastest and written to <output_prefix>000.gzm and so on.\n");
+}
+
+int
+main (int argc, const char *argv[])
+{
+    struct gz_macro gzm;
+    struct gzm_variant v;
+    struct gzm_variant_axis *axes;
+    const char *archive = NULL;
+    const char *extract = NULL;
+    const char *prefix = "";
+    long n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n_axes;
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            n_jobs = atol(argv[++i]);
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            archive = argv[++i];
+        else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+            extract = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (n_jobs < 1)
+        n_jobs = 1;
+
+    if (extract != NULL)
+    {
+        if (argc - i != 2 || archive != NULL)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (gzm_variant_archive_extract(extract, strtoull(argv[i], NULL, 0), argv[i + 1]) != 0)
+        {
+            printf("Could not extract candidate %s of %s\n", argv[i], extract);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (argc - i < ((archive != NULL) ? 2 : 3))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *input = argv[i++];
+    if (archive == NULL)
+        prefix = argv[i++];
+
+    n_axes = argc - i;
+    axes = malloc(n_axes * sizeof(struct gzm_variant_axis));
+    if (axes == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t a = 0; a < n_axes; a++)
+    {
+        if (gzm_variant_parse_axis(&axes[a], argv[i + a]) != 0)
+        {
+            printf("Could not parse %s, expected <frame>:<field>=<values>\n", argv[i + a]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (gzm_read(&gzm, input) != 0)
+    {
+        printf("Could not read %s\n", input);
+        gzm_free(&gzm);
+        return EXIT_FAILURE;
+    }
+    if (gzm_variant_init(&v, &gzm, axes, n_axes) != 0)
+    {
+        printf("Could not vary %s, the frames must be within its %u inputs\n", input, gzm.n_input);
+        return EXIT_FAILURE;
+    }
+
+    struct variant_work work = { .v = &v, .prefix = prefix, .archive_fd = -1, .digits = 3 };
+    FILE *archive_file = NULL;
+
+    for (uint64_t n = v.n_candidates - 1; n >= 1000; n /= 10)
+        work.digits++;
+    if (archive != NULL)
+    {
+        archive_file = fopen(archive, "wb");
+        if (archive_file == NULL || gzm_variant_archive_begin(&v, archive_file) != 0)
+        {
+            printf("Could not write %s\n", archive);
+            return EXIT_FAILURE;
+        }
+        work.archive_fd = fileno(archive_file);
+    }
+
+    // Encode and write all candidates in parallel
+    struct variant_thread *threads = calloc(n_jobs, sizeof(struct variant_thread));
+    bool oom = (threads == NULL);
+
+    for (long t = 0; !oom && t < n_jobs; t++)
+    {
+        threads[t].work = &work;
+        threads[t].windows = malloc(BATCH * v.window_size);
+        threads[t].input = malloc((v.frame_end - v.frame_start) * sizeof(struct movie_input));
+        threads[t].name = malloc(strlen(prefix) + 32);
+        oom = (threads[t].windows == NULL || threads[t].input == NULL || threads[t].name == NULL);
+    }
+    if (oom)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_init(&work.lock, NULL);
+    for (long t = 0; t < n_jobs; t++)
+        pthread_create(&threads[t].thread, NULL, variant_worker, &threads[t]);
+    for (long t = 0; t < n_jobs; t++)
+    {
+        pthread_join(threads[t].thread, NULL);
+        free(threads[t].windows);
+        free(threads[t].input);
+        free(threads[t].name);
+    }
+    pthread_mutex_destroy(&work.lock);
+    free(threads);
+
+    int exc = EXIT_SUCCESS;
+    if (archive_file != NULL && (fclose(archive_file) != 0 || work.n_failed != 0))
+    {
+        printf("Could not write %s\n", archive);
+        exc = EXIT_FAILURE;
+    }
+    else if (work.n_failed != 0)
+    {
+        exc = EXIT_FAILURE;
+    }
+    printf("%llu candidates re-encoding frames %u-%u, %llu written\n", (unsigned long long)v.n_candidates,
+           v.frame_start, v.frame_end, (unsigned long long)(v.n_candidates - work.n_failed));
+
+    gzm_variant_free(&v);
+    for (size_t a = 0; a < n_axes; a++)
+        gzm_variant_free_axis(&axes[a]);
+    free(axes);
+    gzm_free(&gzm);
+    return exc;
+}
@@ -0,0 +1,481 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../libgzx/gzm.h"
+#include "../libgzx/gzm_buffer.h"
+#include "../libgzx/gzm_check.h"
+#include "../libgzx/gzm_edit.h"
+
+/*
+ * gzx runs a pipeline of operations on one macro kept in memory, e.g.
+ *   gzx read a.gzm '|' slice 0 2000 '|' cat b.gzm '|' stat '|' write out.gzm
+ * Files the pipeline reads are read in parallel as soon as it starts and each stage only waits for its own
+ * file, except files an earlier write stage writes to, which are only read when their stage runs.
+ * Consecutive insert and delete stages edit the macro in a gap buffer, which is only closed by the next
+ * stage of another kind, so a run of them only moves the frames between one edit and the next.
+ */
+
+struct stage;
+struct pipeline;
+
+struct stage_op
+{
+    const char  *name;
+    int          min_args;
+    int          max_args;
+    bool         reads;         // argv[0] is a macro to read ahead of time
+    bool         buffered;      // works on the gap buffer rather than the macro
+    int        (*run)(struct pipeline *p, struct stage *s);
+};
+
+struct stage
+{
+    const struct stage_op   *op;
+    int                      argc;
+    const char             **argv;
+    // macro read by the stage, valid after the reader thread is joined
+    pthread_t                thread;
+    bool                     started;
+    struct gz_macro          gzm;
+    int                      read_ret;
+};
+
+struct pipeline
+{
+    struct stage            *stages;
+    int                      n_stages;
+    struct gz_macro          gzm;
+    struct gzm_buffer        buf;       // holds gzm while buffered stages run
+    bool                     buffered;
+    const char              *source;    // name of the macro last read, for printing
+};
+
+static void *
+stage_read_thread (void *arg)
+{
+    struct stage *s = arg;
+    s->read_ret = gzm_read(&s->gzm, s->argv[0]);
+    return NULL;
+}
+
+/* Wait for the macro read by a stage, returns 0 if it was read successfully */
+static int
+stage_join (struct stage *s)
+{
+    if (s->started)
+    {
+        pthread_join(s->thread, NULL);
+        s->started = false;
+    }
+    else
+    {
+        s->read_ret = gzm_read(&s->gzm, s->argv[0]);
+    }
+    if (s->read_ret != 0)
+        printf("Could not read %s\n", s->argv[0]);
+    return s->read_ret;
+}
+
+static int
+run_read (struct pipeline *p, struct stage *s)
+{
+    if (stage_join(s) != 0)
+        return -1;
+    gzm_free(&p->gzm);
+    p->gzm = s->gzm;
+    gzm_new(&s->gzm);
+    p->source = s->argv[0];
+    return 0;
+}
+
+static int
+run_write (struct pipeline *p, struct stage *s)
+{
+    if (gzm_write(&p->gzm, s->argv[0]) != 0)
+    {
+        printf("Could not write %s\n", s->argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+run_cat (struct pipeline *p, struct stage *s)
+{
+    struct gz_macro out;
+    int ret;
+
+    if (stage_join(s) != 0)
+        return -1;
+    if (strcmp(s->op->name, "cat") == 0)
+        ret = gzm_cat_r(&out, &p->gzm, &s->gzm);
+    else
+        ret = gzm_cat(&out, &p->gzm, &s->gzm);
+
+    if (ret != 0)
+    {
+        printf("Could not concat %s with %s\n", p->source, s->argv[0]);
+        if (p->gzm.n_seed == 0)
+            printf("%s does not have any saved rng seeds\n", p->source);
+        if (s->gzm.n_seed == 0)
+            printf("%s does not have any saved rng seeds\n", s->argv[0]);
+        return -1;
+    }
+    gzm_free(&p->gzm);
+    p->gzm = out;
+    return 0;
+}
+
+static int
+run_slice (struct pipeline *p, struct stage *s)
+{
+    struct gz_macro out;
+    int start_frame = atoi(s->argv[0]);
+    int end_frame = atoi(s->argv[1]);
+
+    if (start_frame < 0 || end_frame < 0 || gzm_slice(&out, &p->gzm, start_frame, end_frame) != 0)
+    {
+        printf("Could not slice %s with %s start frame and %s end frame\n", p->source, s->argv[0], s->argv[1]);
+        if (start_frame > (int64_t)p->gzm.n_input)
+            printf("Start frame %s is larger than macro size\n", s->argv[0]);
+        if (end_frame > (int64_t)p->gzm.n_input)
+            printf("End frame %s is larger than macro size\n", s->argv[1]);
+        if (start_frame >= end_frame)
+            printf("Start frame %s is greater than or equal to end frame %s\n", s->argv[0], s->argv[1]);
+        return -1;
+    }
+    gzm_free(&p->gzm);
+    p->gzm = out;
+    return 0;
+}
+
+static int
+run_trim (struct pipeline *p, struct stage *s)
+{
+    int end_frame = atoi(s->argv[0]);
+
+    if (end_frame < 0 || gzm_trim(&p->gzm, end_frame) != 0)
+    {
+        printf("Could not trim %s to %s frames\n", p->source, s->argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+run_insert (struct pipeline *p, struct stage *s)
+{
+    int frame = atoi(s->argv[0]);
+    int n = atoi(s->argv[1]);
+
+    if (frame < 0 || n < 0 || gzm_insert_frames(&p->buf, frame, NULL, n) != 0)
+    {
+        printf("Could not insert %s frames at frame %s of %s\n", s->argv[1], s->argv[0], p->source);
+        if (frame > (int64_t)p->buf.gzm.n_input)
+            printf("%s has only %u frames\n", p->source, p->buf.gzm.n_input);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+run_delete (struct pipeline *p, struct stage *s)
+{
+    int frame = atoi(s->argv[0]);
+    int n = atoi(s->argv[1]);
+
+    if (frame < 0 || n < 0 || gzm_delete_frames(&p->buf, frame, n) != 0)
+    {
+        printf("Could not delete %s frames at frame %s of %s\n", s->argv[1], s->argv[0], p->source);
+        if ((int64_t)frame + n > (int64_t)p->buf.gzm.n_input)
+            printf("%s has only %u frames\n", p->source, p->buf.gzm.n_input);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+run_edit (struct pipeline *p, struct stage *s)
+{
+    struct gzm_edit_op *ops = malloc(s->argc * sizeof(struct gzm_edit_op));
+    int ret = 0;
+
+    for (int i = 0; i < s->argc && ret == 0; i++)
+    {
+        if (gzm_edit_parse(&ops[i], s->argv[i]) != 0)
+        {
+            printf("Invalid op %s\n", s->argv[i]);
+            ret = -1;
+        }
+    }
+    if (ret == 0 && gzm_edit(&p->gzm, ops, s->argc) != 0)
+    {
+        printf("Could not edit %s\n", p->source);
+        ret = -1;
+    }
+    free(ops);
+    return ret;
+}
+
+static int
+run_stat (struct pipeline *p, struct stage *s)
+{
+    printf("%s:\n", p->source);
+    gzm_print_stats(&p->gzm);
+    gzm_print_seeds(&p->gzm);
+    return 0;
+}
+
+static int
+run_inputs (struct pipeline *p, struct stage *s)
+{
+    gzm_print_inputs(&p->gzm);
+    return 0;
+}
+
+static int
+run_check (struct pipeline *p, struct stage *s)
+{
+    uint32_t flags = gzm_check(&p->gzm);
+
+    printf("%s: %s\n", p->source, (flags == 0) ? "ok" : "problems found");
+    for (int i = 0; i < GZM_CHECK_NUM_FLAGS; i++)
+    {
+        if (flags & (1 << i))
+            printf("  %s\n", gzm_check_str(1 << i));
+    }
+    return 0;
+}
+
+static const struct stage_op stage_ops[] =
+{
+    { "read",   1,       1, true,  false, run_read   },
+    { "write",  1,       1, false, false, run_write  },
+    { "cat",    1,       1, true,  false, run_cat    },
+    { "append", 1,       1, true,  false, run_cat    },
+    { "slice",  2,       2, false, false, run_slice  },
+    { "trim",   1,       1, false, false, run_trim   },
+    { "insert", 2,       2, false, true,  run_insert },
+    { "delete", 2,       2, false, true,  run_delete },
+    { "edit",   1, INT_MAX, false, false, run_edit   },
+    { "stat",   0,       0, false, false, run_stat   },
+    { "inputs", 0,       0, false, false, run_inputs },
+    { "check",  0,       0, false, false, run_check  },
+};
+
+/* Split argv into stages at "|" arguments */
+static int
+pipeline_parse (struct pipeline *p, int argc, const char **argv)
+{
+    int i = 0;
+
+    while (i < argc)
+    {
+        struct stage *s;
+        size_t k;
+        int n;
+
+        for (n = 0; i + n < argc && strcmp(argv[i + n], "|") != 0; n++)
+            ;
+        if (n == 0)
+        {
+            printf("Empty pipeline stage\n");
+            return -1;
+        }
+        for (k = 0; k < sizeof(stage_ops) / sizeof(stage_ops[0]) && strcmp(stage_ops[k].name, argv[i]) != 0; k++)
+            ;
+        if (k == sizeof(stage_ops) / sizeof(stage_ops[0]))
+        {
+            printf("Unknown operation %s\n", argv[i]);
+            return -1;
+        }
+        if (n - 1 < stage_ops[k].min_args || n - 1 > stage_ops[k].max_args)
+        {
+            printf("Wrong number of arguments for %s\n", argv[i]);
+            return -1;
+        }
+
+        p->stages = realloc(p->stages, (p->n_stages + 1) * sizeof(struct stage));
+        s = &p->stages[p->n_stages++];
+        memset(s, 0, sizeof(struct stage));
+        s->op = &stage_ops[k];
+        s->argc = n - 1;
+        s->argv = &argv[i + 1];
+        gzm_new(&s->gzm);
+
+        i += n;
+        if (i < argc)
+        {
+            i++;
+            if (i == argc)
+            {
+                printf("Empty pipeline stage\n");
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Whether a stage before stage `i` writes the file stage `i` reads */
+static bool
+written_before (const struct pipeline *p, int i)
+{
+    const char *path = p->stages[i].argv[0];
+    struct stat st;
+    bool exists = (stat(path, &st) == 0);
+
+    for (int j = 0; j < i; j++)
+    {
+        const struct stage *w = &p->stages[j];
+        struct stat w_st;
+
+        if (w->op->run != run_write)
+            continue;
+        if (strcmp(w->argv[0], path) == 0)
+            return true;
+        if (exists && stat(w->argv[0], &w_st) == 0 && w_st.st_dev == st.st_dev && w_st.st_ino == st.st_ino)
+            return true;
+    }
+    return false;
+}
+
+static int
+pipeline_run (struct pipeline *p)
+{
+    int ret = 0;
+
+    // Read the inputs up front, in parallel, unless the pipeline writes them first
+    for (int i = 0; i < p->n_stages; i++)
+    {
+        struct stage *s = &p->stages[i];
+        if (s->op->reads && !written_before(p, i))
+            s->started = (pthread_create(&s->thread, NULL, stage_read_thread, s) == 0);
+    }
+
+    gzm_new(&p->gzm);
+    p->source = "-";
+    for (int i = 0; i < p->n_stages && ret == 0; i++)
+    {
+        struct stage *s = &p->stages[i];
+
+        if (s->op->buffered != p->buffered)
+        {
+            if (s->op->buffered)
+                gzm_buffer_open(&p->buf, &p->gzm);
+            else
+                gzm_buffer_close(&p->buf, &p->gzm);
+            p->buffered = s->op->buffered;
+        }
+        ret = s->op->run(p, s);
+    }
+    if (p->buffered)
+        gzm_buffer_close(&p->buf, &p->gzm);
+
+    for (int i = 0; i < p->n_stages; i++)
+    {
+        if (p->stages[i].started)
+            pthread_join(p->stages[i].thread, NULL);
+        gzm_free(&p->stages[i].gzm);
+    }
+    gzm_free(&p->gzm);
+    free(p->stages);
+    return ret;
+}
+
+/* Pipelines equivalent to the standalone tools, for when gzx is invoked under their names */
+static int
+alias_args (const char *name, int argc, const char **argv, const char ***args_out)
+{
+    const char **args = malloc((3 * argc + 8) * sizeof(const char *));
+    int n = 0;
+
+    if (strcmp(name, "gzmcat") == 0 && argc == 3)
+    {
+        const char *v[] = { "read", argv[0], "|", "cat", argv[1], "|", "write", argv[2] };
+        memcpy(args, v, sizeof(v));
+        n = sizeof(v) / sizeof(v[0]);
+    }
+    else if (strcmp(name, "gzmslice") == 0 && argc == 4)
+    {
+        const char *v[] = { "read", argv[0], "|", "slice", argv[2], argv[3], "|", "write", argv[1] };
+        memcpy(args, v, sizeof(v));
+        n = sizeof(v) / sizeof(v[0]);
+    }
+    else if (strcmp(name, "gzmstat") == 0 && argc >= 1)
+    {
+        for (int i = 0; i < argc; i++)
+        {
+            if (i != 0)
+                args[n++] = "|";
+            args[n++] = "read";
+            args[n++] = argv[i];
+            args[n++] = "|";
+            args[n++] = "stat";
+        }
+    }
+    *args_out = args;
+    return n;
+}
+
+int
+main (int argc, const char *argv[])
+{
+    struct pipeline p = { 0 };
+    const char *name = strrchr(argv[0], '/');
+    const char **args = NULL;
+    int n_args;
+    int ret;
+
+    name = (name != NULL) ? name + 1 : argv[0];
+    if (strcmp(name, "gzx") != 0)
+    {
+        n_args = alias_args(name, argc - 1, &argv[1], &args);
+        if (n_args == 0)
+        {
+            printf("%s: gzx invoked as %s, usage is that of %s\n", argv[0], name, name);
+            free(args);
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        if (argc < 2)
+        {
+            printf("%s: Run a pipeline of operations on a macro without intermediate files.\n", argv[0]);
+            printf("Usage: %s <op> [<args>] ['|' <op> [<args>] ...]\n", argv[0]);
+            printf("Ops:\n");
+            printf("  read <input>          replace the macro with <input>\n");
+            printf("  write <output>        write the macro to <output>\n");
+            printf("  cat <input>           concatenate <input> at the last/first frame that saved an rng seed\n");
+            printf("  append <input>        append <input> as is\n");
+            printf("  slice <start> <end>   keep frames <start> up to but not including <end>\n");
+            printf("  trim <end>            keep the first <end> frames\n");
+            printf("  insert <frame> <n>    insert <n> empty frames before <frame>, later events move with them\n");
+            printf("  delete <frame> <n>    delete <n> frames from <frame> on, with the events on them\n");
+            printf("  edit <op> ...         apply edits as gzmedit\n");
+            printf("  stat                  print information about the macro\n");
+            printf("  inputs                print the inputs of the macro\n");
+            printf("  check                 check the macro for structural problems\n");
+            printf("When invoked as gzmcat, gzmslice or gzmstat, gzx behaves as that program.\n");
+            return EXIT_FAILURE;
+        }
+        n_args = argc - 1;
+    }
+
+    if (pipeline_parse(&p, n_args, (args != NULL) ? args : &argv[1]) != 0)
+    {
+        free(p.stages);
+        free(args);
+        return EXIT_FAILURE;
+    }
+    ret = pipeline_run(&p);
+    free(args);
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
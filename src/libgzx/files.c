@@ -1,9 +1,13 @@
+#include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "files.h"
 
@@ -23,19 +27,80 @@ files_fatal_error (const char *msgfmt, ...)
     exit(EXIT_FAILURE);
 }
 
-void *
-files_read_whole_file (const char *file_name, bool bin, size_t *size_out)
+/* Read a stream that cannot be sized up front, such as a pipe */
+static int
+files_read_stream (FILE *file, uint8_t **buffer_out, size_t *size_out)
 {
-    FILE *file = fopen(file_name, (bin) ? "rb" : "r");
     uint8_t *buffer = NULL;
-    size_t size;
+    size_t cap = 0;
+    size_t size = 0;
+
+    while (true)
+    {
+        if (size + 1 >= cap)
+        {
+            uint8_t *mem;
+
+            cap = (cap == 0) ? 64 * 1024 : cap * 2;
+            mem = realloc(buffer, cap);
+            if (mem == NULL)
+            {
+                free(buffer);
+                return -1;
+            }
+            buffer = mem;
+        }
+
+        size_t n = fread(&buffer[size], 1, cap - size - 1, file);
+        size += n;
+        if (n == 0)
+            break;
+    }
+    if (ferror(file))
+    {
+        free(buffer);
+        return -1;
+    }
+
+    if (size == 0)
+    {
+        free(buffer);
+        buffer = NULL;
+    }
+    else
+    {
+        // null-terminate the buffer (in case of text files)
+        buffer[size] = '\0';
+    }
+    *buffer_out = buffer;
+    *size_out = size;
+    return 0;
+}
+
+/*
+ * Read a whole file into memory, "-" reads stdin. An empty file gives a NULL buffer and 0 size, -1 is
+ * returned when the file cannot be opened or read, with nothing allocated.
+ */
+int
+files_read_whole_file (const char *file_name, bool bin, void **data_out, size_t *size_out)
+{
+    bool std = (strcmp(file_name, "-") == 0);
+    FILE *file = std ? stdin : fopen(file_name, (bin) ? "rb" : "r");
+    uint8_t *buffer = NULL;
+    size_t size = 0;
+    long end;
+    int ret = 0;
 
     if (file == NULL)
-        files_fatal_error("failed to open file '%s' for reading: %s", file_name, strerror(errno));
+        return -1;
 
-    // get size
-    fseek(file, 0, SEEK_END);
-    size = ftell(file);
+    // get size, streams that cannot seek are read until they end instead
+    if (fseek(file, 0, SEEK_END) != 0 || (end = ftell(file)) < 0)
+    {
+        ret = files_read_stream(file, &buffer, &size);
+        goto end;
+    }
+    size = end;
 
     // if the file is empty, return NULL buffer and 0 size
     if (size == 0)
@@ -44,22 +109,32 @@ files_read_whole_file (const char *file_name, bool bin, size_t *size_out)
     // allocate buffer
     buffer = malloc(size + 1);
     if (buffer == NULL)
-        files_fatal_error("could not allocate buffer for file '%s'", file_name);
+    {
+        ret = -1;
+        goto end;
+    }
 
     // read file
-    fseek(file, 0, SEEK_SET);
-    if (fread(buffer, size, 1, file) != 1)
-        files_fatal_error("error reading from file '%s': %s", file_name, strerror(errno));
+    if (fseek(file, 0, SEEK_SET) != 0 || fread(buffer, size, 1, file) != 1)
+    {
+        free(buffer);
+        buffer = NULL;
+        ret = -1;
+        goto end;
+    }
 
     // null-terminate the buffer (in case of text files)
     buffer[size] = '\0';
 
-    fclose(file);
-
 end:
+    if (!std)
+        fclose(file);
+    if (ret != 0)
+        size = 0;
+    *data_out = buffer;
     if (size_out != NULL)
         *size_out = size;
-    return buffer;
+    return ret;
 }
 
 void
@@ -75,3 +150,151 @@ files_write_whole_file (const char *file_name, bool bin, void *data, size_t size
     
     fclose(file);
 }
+
+bool
+files_is_gzm_name (const char *name)
+{
+    size_t len = strlen(name);
+    return len > 4 && strcmp(&name[len - 4], ".gzm") == 0;
+}
+
+int
+files_list_add (struct files_list *list, const char *path)
+{
+    char *copy;
+
+    if (list->n == list->cap)
+    {
+        size_t cap = (list->cap != 0) ? list->cap * 2 : 64;
+        char **paths = realloc(list->paths, cap * sizeof(char *));
+
+        if (paths == NULL)
+            return -1;
+        list->paths = paths;
+        list->cap = cap;
+    }
+    copy = strdup(path);
+    if (copy == NULL)
+        return -1;
+    list->paths[list->n++] = copy;
+    return 0;
+}
+
+/* Add the macros under a directory, recursively. A directory that cannot be opened is reported and skipped. */
+int
+files_list_add_dir (struct files_list *list, const char *dir_name)
+{
+    DIR *dir = opendir(dir_name);
+    struct dirent *ent;
+    int ret = 0;
+
+    if (dir == NULL)
+    {
+        fprintf(stderr, "error: could not open directory '%s': %s\n", dir_name, strerror(errno));
+        return 0;
+    }
+    while (ret == 0 && (ent = readdir(dir)) != NULL)
+    {
+        struct stat st;
+        char *path;
+
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        path = malloc(strlen(dir_name) + strlen(ent->d_name) + 2);
+        if (path == NULL)
+        {
+            ret = -1;
+            break;
+        }
+        sprintf(path, "%s/%s", dir_name, ent->d_name);
+        if (stat(path, &st) == 0)
+        {
+            if (S_ISDIR(st.st_mode))
+                ret = files_list_add_dir(list, path);
+            else if (files_is_gzm_name(ent->d_name))
+                ret = files_list_add(list, path);
+        }
+        free(path);
+    }
+    closedir(dir);
+    return ret;
+}
+
+/* Add a command line argument, a directory adds the macros under it, anything else is added as named */
+int
+files_list_add_arg (struct files_list *list, const char *arg)
+{
+    struct stat st;
+
+    if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode))
+        return files_list_add_dir(list, arg);
+    return files_list_add(list, arg);
+}
+
+void
+files_list_free (struct files_list *list)
+{
+    for (size_t i = 0; i < list->n; i++)
+        free(list->paths[i]);
+    free(list->paths);
+    memset(list, 0, sizeof(struct files_list));
+}
+
+struct files_jobs
+{
+    files_job_t              job;
+    void                    *arg;
+    size_t                   n;
+    size_t                   next;
+    pthread_mutex_t          lock;
+};
+
+static void *
+files_jobs_worker (void *arg)
+{
+    struct files_jobs *jobs = arg;
+
+    while (true)
+    {
+        size_t i;
+
+        pthread_mutex_lock(&jobs->lock);
+        i = jobs->next++;
+        pthread_mutex_unlock(&jobs->lock);
+
+        if (i >= jobs->n)
+            break;
+        jobs->job(jobs->arg, i);
+    }
+    return NULL;
+}
+
+/*
+ * Run `job` for every index in [0, n) on up to `n_jobs` threads, each taking the next index as it finishes
+ * one. The calling thread is one of them, so every index is run even if no thread can be started.
+ */
+void
+files_run_jobs (size_t n, long n_jobs, files_job_t job, void *arg)
+{
+    struct files_jobs jobs = { .job = job, .arg = arg, .n = n, .next = 0 };
+    pthread_t *threads = NULL;
+    long n_threads = 0;
+
+    if (n_jobs > 1 && (size_t)n_jobs > n)
+        n_jobs = (n > 1) ? n : 1;
+    if (n_jobs > 1)
+        threads = malloc((n_jobs - 1) * sizeof(pthread_t));
+
+    pthread_mutex_init(&jobs.lock, NULL);
+    for (long t = 0; threads != NULL && t < n_jobs - 1; t++)
+    {
+        if (pthread_create(&threads[n_threads], NULL, files_jobs_worker, &jobs) == 0)
+            n_threads++;
+    }
+    files_jobs_worker(&jobs);
+    for (long t = 0; t < n_threads; t++)
+        pthread_join(threads[t], NULL);
+    pthread_mutex_destroy(&jobs.lock);
+    free(threads);
+}
@@ -2,12 +2,42 @@
 #define FILES_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-void *
-files_read_whole_file (const char *file_name, bool bin, size_t *size_out);
+// Paths gathered from the command line by the batch tools, directories expanded to the macros in them
+struct files_list
+{
+    char                   **paths;
+    size_t                   n;
+    size_t                   cap;
+};
+
+// Called once for every index in [0, n) by files_run_jobs, from any of its threads
+typedef void (*files_job_t)(void *arg, size_t i);
+
+int
+files_read_whole_file (const char *file_name, bool bin, void **data_out, size_t *size_out);
 
 void
 files_write_whole_file (const char *file_name, bool bin, void *data, size_t size);
 
+bool
+files_is_gzm_name (const char *name);
+
+int
+files_list_add (struct files_list *list, const char *path);
+
+int
+files_list_add_dir (struct files_list *list, const char *dir_name);
+
+int
+files_list_add_arg (struct files_list *list, const char *arg);
+
+void
+files_list_free (struct files_list *list);
+
+void
+files_run_jobs (size_t n, long n_jobs, files_job_t job, void *arg);
+
 #endif
@@ -1,67 +1,21 @@
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "gzm.h"
+#include "gzm_schema.h"
+#include "gzm_journal.h"
+#include "gzm_stream.h"
+#include "gzm_text.h"
 #include "files.h"
 
-static void
-bswap (void *dst, const void *data, size_t size)
-{
-    switch (size)
-    {
-        case sizeof(uint32_t):
-            *(uint32_t*)(dst) = __builtin_bswap32(*(uint32_t*)(data));
-            break;
-        case sizeof(uint16_t):
-            *(uint16_t*)(dst) = __builtin_bswap16(*(uint16_t*)(data));
-            break;
-        case sizeof(uint8_t):
-            *(uint8_t*)(dst) = *(uint8_t*)(data);
-            break;
-        default:
-            fprintf(stderr, "Bad size: %lu\n", size);
-            exit(EXIT_FAILURE);
-    }
-}
-
-static int
-serial_read (void *dst, size_t size, uint8_t **p, const uint8_t *end)
-{
-    if (*p + size <= end)
-    {
-        bswap(dst, *p, size);
-        *p += size;
-        return (*p == end) ? -1 : 0;
-    }
-    return -1;
-}
-
-static int
-serial_write (const void *src, size_t size, uint8_t **p, const uint8_t *end)
-{
-    if (*p + size <= end)
-    {
-        bswap(*p, src, size);
-        *p += size;
-        return 0;
-    }
-    return -1;
-}
-
-#define gzm_serial_read(field)                                  \
-    do {                                                        \
-        if (serial_read(&(field), sizeof(field), &p, end) != 0) \
-            goto eof;                                           \
-    } while (0)
-
-#define gzm_serial_write(field)                                  \
-    do {                                                         \
-        if (serial_write(&(field), sizeof(field), &p, end) != 0) \
-            goto eof;                                            \
-    } while (0)
+GZM_SCHEMA(GZM_SCHEMA_IGNORE, GZM_ARRAY_CODEC, GZM_SCHEMA_IGNORE)
 
 static int
 mem_dup (void **buf, size_t size)
@@ -77,159 +31,336 @@ mem_dup (void **buf, size_t size)
     return 0;
 }
 
-int
-gzm_read (struct gz_macro *gzm, const char *file_name)
+size_t
+gzm_serial_size (const struct gz_macro *gzm, int version)
 {
-    size_t i;
-    size_t size;
-    uint8_t *data = files_read_whole_file(file_name, true, &size);
-    uint8_t *p = &data[0];
-    uint8_t *end = &data[size];
+    size_t size = 0;
 
-    memset(gzm, 0, sizeof(struct gz_macro));
+#define SIZE_SCALAR(field) \
+    size += sizeof(gzm->field);
+#define SIZE_ARRAY(name, count, type, FIELDS) \
+    size += (size_t)gzm->count * GZM_RECORD_SERIAL_SIZE(type, FIELDS);
+#define SIZE_VERSION(v) \
+    if (version < (v)) return size;
 
-    gzm_serial_read(gzm->n_input);
-    gzm_serial_read(gzm->n_seed);
+    GZM_SCHEMA(SIZE_SCALAR, SIZE_ARRAY, SIZE_VERSION)
 
-    gzm_serial_read(gzm->input_start.pad);
-    gzm_serial_read(gzm->input_start.x);
-    gzm_serial_read(gzm->input_start.y);
+#undef SIZE_SCALAR
+#undef SIZE_ARRAY
+#undef SIZE_VERSION
 
-    gzm->input = malloc(gzm->n_input * sizeof(struct movie_input));
-    for (i = 0; i < gzm->n_input; ++i)
-    {
-        struct movie_input *input = &gzm->input[i];
+    return size;
+}
 
-        gzm_serial_read(input->raw.pad);
-        gzm_serial_read(input->raw.x);
-        gzm_serial_read(input->raw.y);
-        gzm_serial_read(input->pad_delta);
+/* Determine which version of the format `data` is by walking the section counts, without decoding any records */
+int
+gzm_detect_version (const void *data, size_t size, int *complete_out)
+{
+    struct gz_macro hdr;
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+    int version = GZM_VERSION_BASE;
+
+    memset(&hdr, 0, sizeof(struct gz_macro));
+
+#define DETECT_SCALAR(field)                                                        \
+    if ((size_t)(end - p) < sizeof(hdr.field))                                      \
+        goto truncated;                                                             \
+    p = serial_load(&hdr.field, sizeof(hdr.field), p);
+#define DETECT_ARRAY(name, count, type, FIELDS)                                     \
+    if ((uint64_t)hdr.count * GZM_RECORD_SERIAL_SIZE(type, FIELDS) > (size_t)(end - p)) \
+        goto truncated;                                                             \
+    p += (size_t)hdr.count * GZM_RECORD_SERIAL_SIZE(type, FIELDS);
+#define DETECT_VERSION(v)                                                           \
+    if (p == end)                                                                   \
+        goto done;                                                                  \
+    version = (v);
+
+    GZM_SCHEMA(DETECT_SCALAR, DETECT_ARRAY, DETECT_VERSION)
+
+#undef DETECT_SCALAR
+#undef DETECT_ARRAY
+#undef DETECT_VERSION
+
+    if (p != end)
+    {
+        // trailing data that no known version accounts for
+        if (complete_out != NULL)
+            *complete_out = version;
+        return -1;
     }
+done:
+    if (complete_out != NULL)
+        *complete_out = version;
+    return version;
+truncated:
+    // ended partway through the fields introduced by `version`
+    if (complete_out != NULL)
+        *complete_out = version - 1;
+    return -1;
+}
 
-    gzm->seed = malloc(gzm->n_seed * sizeof(struct movie_seed));
-    for (i = 0; i < gzm->n_seed; ++i)
-    {
-        struct movie_seed *seed = &gzm->seed[i];
-
-        gzm_serial_read(seed->frame_idx);
-        gzm_serial_read(seed->old_seed);
-        gzm_serial_read(seed->new_seed);
-    }
+/* Decode a serialized macro. On malformed data, the longest complete version prefix is still decoded and -1 is returned */
+int
+gzm_decode (struct gz_macro *gzm, const void *data, size_t size)
+{
+    int complete;
+    int version = gzm_detect_version(data, size, &complete);
+    const uint8_t *p = data;
 
-    gzm_serial_read(gzm->n_oca_input);
-    gzm_serial_read(gzm->n_oca_sync);
-    gzm_serial_read(gzm->n_room_load);
+    memset(gzm, 0, sizeof(struct gz_macro));
 
-    gzm->oca_input = malloc(gzm->n_oca_input * sizeof(struct movie_oca_input));
-    for (i = 0; i < gzm->n_oca_input; ++i)
-    {
-        struct movie_oca_input *oca_input = &gzm->oca_input[i];
+    if (complete < GZM_VERSION_BASE)
+        return -1;
 
-        gzm_serial_read(oca_input->frame_idx);
-        gzm_serial_read(oca_input->pad);
-        gzm_serial_read(oca_input->adjusted_x);
-        gzm_serial_read(oca_input->adjusted_y);
-    }
+#define DECODE_SCALAR(field)                                                        \
+    p = serial_load(&gzm->field, sizeof(gzm->field), p);
+#define DECODE_ARRAY(name, count, type, FIELDS)                                     \
+    if (gzm->count != 0)                                                            \
+    {                                                                               \
+        gzm->name = malloc(gzm->count * sizeof(type));                              \
+        if (gzm->name == NULL)                                                      \
+        {                                                                           \
+            gzm_free(gzm);                                                          \
+            return -1;                                                              \
+        }                                                                           \
+        p = decode_##name(gzm->name, gzm->count, p);                                \
+    }
+#define DECODE_VERSION(v)                                                           \
+    if (complete < (v))                                                             \
+        goto done;
+
+    GZM_SCHEMA(DECODE_SCALAR, DECODE_ARRAY, DECODE_VERSION)
+
+#undef DECODE_SCALAR
+#undef DECODE_ARRAY
+#undef DECODE_VERSION
+
+done:
+    return (version < 0) ? -1 : 0;
+}
 
-    gzm->oca_sync = malloc(gzm->n_oca_sync * sizeof(struct movie_oca_sync));
-    for (i = 0; i < gzm->n_oca_sync; ++i)
-    {
-        struct movie_oca_sync *oca_sync = &gzm->oca_sync[i];
+/* Encode `gzm` as the given version of the format into `data`, which must hold at least gzm_serial_size(gzm, version) bytes */
+int
+gzm_encode (const struct gz_macro *gzm, int version, void *data, size_t size)
+{
+    uint8_t *p = data;
 
-        gzm_serial_read(oca_sync->frame_idx);
-        gzm_serial_read(oca_sync->audio_frames);
-    }
+    if (version < GZM_VERSION_BASE || version > GZM_VERSION_LATEST || size < gzm_serial_size(gzm, version))
+        return -1;
 
-    gzm->room_load = malloc(gzm->n_room_load * sizeof(struct movie_room_load));
-    for (i = 0; i < gzm->n_room_load; ++i)
-    {
-        struct movie_room_load *room_load = &gzm->room_load[i];
+#define ENCODE_SCALAR(field)                                                        \
+    p = serial_store(p, &gzm->field, sizeof(gzm->field));
+#define ENCODE_ARRAY(name, count, type, FIELDS)                                     \
+    p = encode_##name(p, gzm->name, gzm->count);
+#define ENCODE_VERSION(v)                                                           \
+    if (version < (v))                                                              \
+        return 0;
 
-        gzm_serial_read(room_load->frame_idx);
-    }
+    GZM_SCHEMA(ENCODE_SCALAR, ENCODE_ARRAY, ENCODE_VERSION)
 
-    gzm_serial_read(gzm->rerecords);
-    gzm_serial_read(gzm->last_recorded_frame);
+#undef ENCODE_SCALAR
+#undef ENCODE_ARRAY
+#undef ENCODE_VERSION
 
-eof:
-    free(data);
     return 0;
 }
 
-int
-gzm_write (const struct gz_macro *gzm, const char *file_name)
+/* Decode `n` serialized inputs, the bulk path for anything that handles input ranges directly */
+void
+gzm_decode_inputs (struct movie_input *input, const void *data, size_t n)
 {
-    size_t i;
-    size_t size = GZM_SERIAL_SIZE(gzm);
-    uint8_t *data = malloc(size);
-    uint8_t *p = &data[0];
-    uint8_t *end = &data[size];
+    decode_input(input, n, data);
+}
 
-    gzm_serial_write(gzm->n_input);
-    gzm_serial_write(gzm->n_seed);
+void
+gzm_encode_inputs (void *data, const struct movie_input *input, size_t n)
+{
+    encode_input(data, input, n);
+}
 
-    gzm_serial_write(gzm->input_start.pad);
-    gzm_serial_write(gzm->input_start.x);
-    gzm_serial_write(gzm->input_start.y);
+int
+gzm_read (struct gz_macro *gzm, const char *file_name)
+{
+    struct stat st;
+    size_t size;
+    uint8_t *data;
+    int ret;
 
-    for (i = 0; i < gzm->n_input; ++i)
+    // Pipes and the like are decoded as they are read, "-" is stdin
+    if (strcmp(file_name, "-") == 0)
+        return gzm_stream_read(gzm, stdin, NULL, NULL);
+    if (stat(file_name, &st) == 0 && !S_ISREG(st.st_mode))
     {
-        struct movie_input *input = &gzm->input[i];
+        FILE *file = fopen(file_name, "rb");
 
-        gzm_serial_write(input->raw.pad);
-        gzm_serial_write(input->raw.x);
-        gzm_serial_write(input->raw.y);
-        gzm_serial_write(input->pad_delta);
+        if (file == NULL)
+        {
+            gzm_new(gzm);
+            return -1;
+        }
+        ret = gzm_stream_read(gzm, file, NULL, NULL);
+        fclose(file);
+        return ret;
     }
 
-    for (i = 0; i < gzm->n_seed; ++i)
+    if (files_read_whole_file(file_name, true, (void **)&data, &size) != 0)
     {
-        struct movie_seed *seed = &gzm->seed[i];
-
-        gzm_serial_write(seed->frame_idx);
-        gzm_serial_write(seed->old_seed);
-        gzm_serial_write(seed->new_seed);
+        gzm_new(gzm);
+        return -1;
     }
+    ret = gzm_decode(gzm, data, size);
 
-    gzm_serial_write(gzm->n_oca_input);
-    gzm_serial_write(gzm->n_oca_sync);
-    gzm_serial_write(gzm->n_room_load);
+    // Apply any incremental saves made since the file was last written in full
+    if (ret == 0 && gzm_journal_exists(file_name))
+        ret = gzm_journal_replay(gzm, file_name, data, size);
 
-    for (i = 0; i < gzm->n_oca_input; ++i)
-    {
-        struct movie_oca_input *oca_input = &gzm->oca_input[i];
+    free(data);
+    return ret;
+}
 
-        gzm_serial_write(oca_input->frame_idx);
-        gzm_serial_write(oca_input->pad);
-        gzm_serial_write(oca_input->adjusted_x);
-        gzm_serial_write(oca_input->adjusted_y);
-    }
+static int
+pread_full (int fd, void *buf, size_t size, off_t offset)
+{
+    uint8_t *p = buf;
 
-    for (i = 0; i < gzm->n_oca_sync; ++i)
+    while (size != 0)
     {
-        struct movie_oca_sync *oca_sync = &gzm->oca_sync[i];
-
-        gzm_serial_write(oca_sync->frame_idx);
-        gzm_serial_write(oca_sync->audio_frames);
+        ssize_t n = pread(fd, p, size, offset);
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+        offset += n;
     }
+    return 0;
+}
 
-    for (i = 0; i < gzm->n_room_load; ++i)
-    {
-        struct movie_room_load *room_load = &gzm->room_load[i];
+/* Read all of an open macro file, the journal is looked up by `file_name` */
+static int
+read_fd (struct gz_macro *gzm, int fd, const char *file_name)
+{
+    struct stat st;
+    uint8_t *data;
+    int ret = -1;
 
-        gzm_serial_write(room_load->frame_idx);
+    gzm_new(gzm);
+    if (fstat(fd, &st) != 0 || (data = malloc(st.st_size + 1)) == NULL)
+        return -1;
+    if (pread_full(fd, data, st.st_size, 0) == 0)
+    {
+        ret = gzm_decode(gzm, data, st.st_size);
+        if (ret == 0 && gzm_journal_exists(file_name))
+            ret = gzm_journal_replay(gzm, file_name, data, st.st_size);
     }
+    free(data);
+    return ret;
+}
 
-    gzm_serial_write(gzm->rerecords);
-    gzm_serial_write(gzm->last_recorded_frame);
+/*
+ * Refresh `gzm`, previously read from `file_name`, after the file was saved again. Inputs already in
+ * `gzm` are assumed unchanged, so only the new inputs and everything after the input section are read.
+ * Falls back to a full read when the macro got shorter or has a journal. Unlike gzm_read this does not
+ * exit when the file cannot be read, it returns -1 and `gzm` must be freed and read again in full.
+ */
+int
+gzm_read_update (struct gz_macro *gzm, const char *file_name)
+{
+    uint8_t hdr[GZM_HEADER_SERIAL_SIZE];
+    uint8_t *tail = NULL;
+    struct stat st;
+    uint32_t n_input;
+    int ret = -1;
+    int fd;
+
+    fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || pread_full(fd, hdr, sizeof(hdr), 0) != 0)
+        goto full;
+
+    serial_load(&n_input, sizeof(n_input), hdr);
+    if (n_input < gzm->n_input || gzm_journal_exists(file_name))
+        goto full;
+
+    off_t tail_start = GZM_HEADER_SERIAL_SIZE + (off_t)n_input * GZM_INPUT_SERIAL_SIZE;
+    if (tail_start > st.st_size)
+        goto full;
+
+    // New inputs
+    if (n_input > gzm->n_input)
+    {
+        size_t n_new = n_input - gzm->n_input;
+        struct movie_input *input = realloc(gzm->input, n_input * sizeof(struct movie_input));
+        uint8_t *data = malloc(n_new * GZM_INPUT_SERIAL_SIZE);
+
+        if (input == NULL || data == NULL)
+        {
+            free(data);
+            if (input != NULL)
+                gzm->input = input;
+            goto end;
+        }
+        gzm->input = input;
+        if (pread_full(fd, data, n_new * GZM_INPUT_SERIAL_SIZE,
+                       GZM_HEADER_SERIAL_SIZE + (off_t)gzm->n_input * GZM_INPUT_SERIAL_SIZE) != 0)
+        {
+            free(data);
+            goto full;
+        }
+        decode_input(&gzm->input[gzm->n_input], n_new, data);
+        gzm->n_input = n_input;
+        free(data);
+    }
+
+    // Everything after the inputs is decoded as a macro without inputs, with the same header
+    size_t tail_size = GZM_HEADER_SERIAL_SIZE + (st.st_size - tail_start);
+    struct gz_macro ev;
+
+    tail = malloc(tail_size);
+    if (tail == NULL)
+        goto end;
+    memcpy(tail, hdr, GZM_HEADER_SERIAL_SIZE);
+    memset(tail, 0, sizeof(uint32_t));
+    if (pread_full(fd, &tail[GZM_HEADER_SERIAL_SIZE], tail_size - GZM_HEADER_SERIAL_SIZE, tail_start) != 0)
+        goto full;
+
+    ret = gzm_decode(&ev, tail, tail_size);
+    gzm_take_events(gzm, &ev);
+    goto end;
+
+full:
+    free(tail);
+    gzm_free(gzm);
+    ret = read_fd(gzm, fd, file_name);
+    close(fd);
+    return ret;
+end:
+    close(fd);
+    free(tail);
+    return ret;
+}
 
-    files_write_whole_file(file_name, true, data, size);
-    free(data);
-    return 0;
-eof:
-    // no more room
-    free(data);
-    return -1;
+int
+gzm_write (const struct gz_macro *gzm, const char *file_name)
+{
+    bool std = (strcmp(file_name, "-") == 0);
+    FILE *file = std ? stdout : fopen(file_name, "wb");
+    int ret;
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "error: failed to open file '%s' for writing: %s\n", file_name, strerror(errno));
+        return -1;
+    }
+    ret = gzm_stream_write(gzm, GZM_VERSION_LATEST, file);
+    if (std)
+        return ret;
+    if (fclose(file) != 0 || ret != 0)
+        return -1;
+
+    // The file now holds everything, drop any journal of saves made on top of the old contents
+    return gzm_journal_discard(file_name);
 }
 
 int
@@ -251,6 +382,31 @@ gzm_free (struct gz_macro *gzm)
     return 0;
 }
 
+/* Replace the event sections and scalar fields of `gzm` with those of `ev`, taking ownership of its buffers */
+void
+gzm_take_events (struct gz_macro *gzm, struct gz_macro *ev)
+{
+    free(gzm->seed);
+    free(gzm->oca_input);
+    free(gzm->oca_sync);
+    free(gzm->room_load);
+
+    gzm->input_start = ev->input_start;
+    gzm->n_seed = ev->n_seed;
+    gzm->seed = ev->seed;
+    gzm->n_oca_input = ev->n_oca_input;
+    gzm->oca_input = ev->oca_input;
+    gzm->n_oca_sync = ev->n_oca_sync;
+    gzm->oca_sync = ev->oca_sync;
+    gzm->n_room_load = ev->n_room_load;
+    gzm->room_load = ev->room_load;
+    gzm->rerecords = ev->rerecords;
+    gzm->last_recorded_frame = ev->last_recorded_frame;
+
+    free(ev->input);
+    memset(ev, 0, sizeof(struct gz_macro));
+}
+
 /* Copy gzm_in to gzm_out */
 int
 gzm_dup (struct gz_macro *gzm_out, const struct gz_macro *gzm_in)
@@ -280,11 +436,19 @@ gzm_trim (struct gz_macro *gzm, uint32_t end)
     gzm->n_input = end;
     gzm->input = realloc(gzm->input, gzm->n_input * sizeof(struct movie_input));
 
+    gzm_trim_events(gzm, end);
+    return 0;
+}
+
+/* The part of gzm_trim that does not touch the inputs, drops events at or after `end` */
+void
+gzm_trim_events (struct gz_macro *gzm, uint32_t end)
+{
     // Trim seed
     size_t n_seed = 0;
     for (struct movie_seed *seed = &gzm->seed[0]; seed < &gzm->seed[gzm->n_seed]; seed++)
     {
-        if (seed->frame_idx < gzm->n_input)
+        if (seed->frame_idx < end)
             n_seed++;
     }
     gzm->n_seed = n_seed;
@@ -294,7 +458,7 @@ gzm_trim (struct gz_macro *gzm, uint32_t end)
     size_t n_oca_input = 0;
     for (struct movie_oca_input *oca_input = &gzm->oca_input[0]; oca_input < &gzm->oca_input[gzm->n_oca_input]; oca_input++)
     {
-        if (oca_input->frame_idx < gzm->n_input)
+        if (oca_input->frame_idx < end)
             n_oca_input++;
     }
     gzm->n_oca_input = n_oca_input;
@@ -304,7 +468,7 @@ gzm_trim (struct gz_macro *gzm, uint32_t end)
     size_t n_oca_sync = 0;
     for (struct movie_oca_sync *oca_sync = &gzm->oca_sync[0]; oca_sync < &gzm->oca_sync[gzm->n_oca_sync]; oca_sync++)
     {
-        if (oca_sync->frame_idx < gzm->n_input)
+        if (oca_sync->frame_idx < end)
             n_oca_sync++;
     }
     gzm->n_oca_sync = n_oca_sync;
@@ -314,15 +478,14 @@ gzm_trim (struct gz_macro *gzm, uint32_t end)
     size_t n_room_load = 0;
     for (struct movie_room_load *room_load = &gzm->room_load[0]; room_load < &gzm->room_load[gzm->n_room_load]; room_load++)
     {
-        if (room_load->frame_idx < gzm->n_input)
+        if (room_load->frame_idx < end)
             n_room_load++;
     }
     gzm->n_room_load = n_room_load;
     gzm->room_load = realloc(gzm->room_load, gzm->n_room_load * sizeof(struct movie_room_load));
 
     // Adjust last recorded frame
-    gzm->last_recorded_frame = gzm->n_input - 1;
-    return 0;
+    gzm->last_recorded_frame = end - 1;
 }
 
 int
@@ -342,6 +505,14 @@ gzm_cat (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_macr
             memcpy(&gzm->input[gzm1->n_input], gzm2->input, gzm2->n_input * sizeof(struct movie_input));
     }
 
+    gzm_cat_events(gzm, gzm1, gzm2);
+    return 0;
+}
+
+/* The part of gzm_cat that does not touch the inputs, fills in everything but n_input and input */
+void
+gzm_cat_events (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_macro *gzm2)
+{
     // Copy seed
     gzm->n_seed = gzm1->n_seed + gzm2->n_seed;
     if (gzm->n_seed)
@@ -407,7 +578,6 @@ gzm_cat (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_macr
 
     gzm->rerecords = gzm1->rerecords + gzm2->rerecords;
     gzm->last_recorded_frame = 0; // TODO how to merge this if at all
-    return 0;
 }
 
 /* Concat 2 gz macros at the last recorded rng seed frame index, and take old_seed from the first macro and new_seed from the second */
@@ -432,6 +602,17 @@ gzm_cat_r (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_ma
     memcpy(&gzm->input[0],            &gzm1->input[0],             ( last_frame_1 -             0) * sizeof(struct movie_input));
     memcpy(&gzm->input[last_frame_1], &gzm2->input[first_frame_2], (gzm2->n_input - first_frame_2) * sizeof(struct movie_input));
 
+    gzm_cat_r_events(gzm, gzm1, gzm2);
+    return 0;
+}
+
+/* The part of gzm_cat_r that does not touch the inputs, fills in everything but n_input and input */
+void
+gzm_cat_r_events (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_macro *gzm2)
+{
+    int last_frame_1 = gzm1->seed[gzm1->n_seed - 1].frame_idx;
+    int first_frame_2 = gzm2->seed[0].frame_idx;
+
     // Copy input_start of gzm1, TODO what about input_start of gzm2?
     gzm->input_start = gzm1->input_start;
 
@@ -542,7 +723,6 @@ gzm_cat_r (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_ma
 
     gzm->rerecords = gzm1->rerecords + gzm2->rerecords;
     gzm->last_recorded_frame = 0; // TODO how to merge this if at all
-    return 0;
 }
 
 int
@@ -557,8 +737,23 @@ gzm_slice(struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_
     // Copy inputs
     output_gzm->n_input = frame_end - frame_start;
     output_gzm->input = malloc(output_gzm->n_input * sizeof(struct movie_input));
+    if (output_gzm->input == NULL)
+    {
+        output_gzm->n_input = 0;
+        return -1;
+    }
     memcpy(&output_gzm->input[0], &input_gzm->input[frame_start], output_gzm->n_input * sizeof(struct movie_input));
-	
+
+    return gzm_slice_events(output_gzm, input_gzm, frame_start, frame_end);
+}
+
+/*
+ * The part of gzm_slice that does not touch the inputs, fills in everything but n_input and input. On failure
+ * the arrays copied so far are left in `output_gzm` for gzm_free.
+ */
+int
+gzm_slice_events (struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_t frame_start, uint32_t frame_end)
+{
 	int n_seed = 0;
 	int first_seed_idx = 0;
 	bool first_seed_idx_set = false;
@@ -570,7 +765,6 @@ gzm_slice(struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_
 					first_seed_idx = i;
 					first_seed_idx_set = true;
 				}
-				input_gzm->seed[i].frame_idx -= frame_start;
 				n_seed++;
 			}
 			else { 
@@ -580,7 +774,15 @@ gzm_slice(struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_
 	}
 	output_gzm->n_seed = n_seed;
 	output_gzm->seed = malloc(output_gzm->n_seed * sizeof(struct movie_seed));
+	if (n_seed != 0 && output_gzm->seed == NULL)
+	{
+		output_gzm->n_seed = 0;
+		return -1;
+	}
 	memcpy(&output_gzm->seed[0], &input_gzm->seed[first_seed_idx], n_seed * sizeof(struct movie_seed));
+	// Rebase on the copy, the input stays as it is (and so for the arrays below)
+	for (int i = 0; i < n_seed; i++)
+		output_gzm->seed[i].frame_idx -= frame_start;
 
 	if (input_gzm->n_oca_input != 0 && input_gzm->oca_input != NULL) { 
 		// Copy oca input if present
@@ -595,7 +797,6 @@ gzm_slice(struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_
 						first_idx = i;
 						first_idx_set = true;
 					}
-					input_gzm->oca_input[i].frame_idx -= frame_start;
 					n_oca_input++;
 				}
 				else { 
@@ -605,7 +806,14 @@ gzm_slice(struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_
 		}
 		output_gzm->n_oca_input = n_oca_input;
 		output_gzm->oca_input = malloc(output_gzm->n_oca_input * sizeof(struct movie_oca_input));
+		if (n_oca_input != 0 && output_gzm->oca_input == NULL)
+		{
+			output_gzm->n_oca_input = 0;
+			return -1;
+		}
 		memcpy(&output_gzm->oca_input[0], &input_gzm->oca_input[first_idx], n_oca_input * sizeof(struct movie_oca_input));
+		for (int i = 0; i < n_oca_input; i++)
+			output_gzm->oca_input[i].frame_idx -= frame_start;
 	}
 	
 	if (input_gzm->n_oca_sync != 0 && input_gzm->oca_sync != NULL) { 
@@ -621,7 +829,6 @@ gzm_slice(struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_
 						first_idx = i;
 						first_idx_set = true;
 					}
-					input_gzm->oca_sync[i].frame_idx -= frame_start;
 					n_oca_sync++;
 				}
 				else { 
@@ -631,7 +838,14 @@ gzm_slice(struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_
 		}
 		output_gzm->n_oca_sync = n_oca_sync;
 		output_gzm->oca_sync = malloc(output_gzm->n_oca_sync * sizeof(struct movie_oca_sync));
+		if (n_oca_sync != 0 && output_gzm->oca_sync == NULL)
+		{
+			output_gzm->n_oca_sync = 0;
+			return -1;
+		}
 		memcpy(&output_gzm->oca_sync[0], &input_gzm->oca_sync[first_idx], n_oca_sync * sizeof(struct movie_oca_sync));
+		for (int i = 0; i < n_oca_sync; i++)
+			output_gzm->oca_sync[i].frame_idx -= frame_start;
 	}
 		
 	if (input_gzm->n_room_load != 0 && input_gzm->room_load != NULL) { 
@@ -647,7 +861,6 @@ gzm_slice(struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_
 						first_idx = i;
 						first_idx_set = true;
 					}
-					input_gzm->room_load[i].frame_idx -= frame_start;
 					n_room_load++;
 				}
 				else { 
@@ -657,7 +870,14 @@ gzm_slice(struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_
 		}
 		output_gzm->n_room_load = n_room_load;
 		output_gzm->room_load = malloc(output_gzm->n_room_load * sizeof(struct movie_room_load));
+		if (n_room_load != 0 && output_gzm->room_load == NULL)
+		{
+			output_gzm->n_room_load = 0;
+			return -1;
+		}
 		memcpy(&output_gzm->room_load[0], &input_gzm->room_load[first_idx], n_room_load * sizeof(struct movie_room_load));
+		for (int i = 0; i < n_room_load; i++)
+			output_gzm->room_load[i].frame_idx -= frame_start;
 	}
     output_gzm->rerecords = input_gzm->rerecords; // TODO how to get this accurately if at all
     output_gzm->last_recorded_frame = frame_end - frame_start;
@@ -714,10 +934,7 @@ gzm_print_input (const struct gz_macro *gzm, const int i)
 void
 gzm_print_inputs (const struct gz_macro *gzm)
 {
-    printf("gzm has %u inputs:\n", gzm->n_input);
-
-    for (int i = 0; i < gzm->n_input; i++)
-        gzm_print_input(gzm, i);
+    gzm_text_write(gzm, stdout, GZM_TEXT_HUMAN);
 }
 
 void
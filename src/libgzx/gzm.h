@@ -1,6 +1,7 @@
 #ifndef GZM_H_
 #define GZM_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define PAD_A(pad)   (((pad) >> 15) & 1)
@@ -19,6 +20,9 @@
 #define PAD_CL(pad)  (((pad) >>  1) & 1)
 #define PAD_CR(pad)  (((pad) >>  0) & 1)
 
+// pad_delta holds the buttons that changed since the previous frame
+#define PAD_DELTA(prev_pad, pad) ((uint16_t)((prev_pad) ^ (pad)))
+
 typedef struct
 {
   uint16_t          pad;                        /* 0x0000 */
@@ -83,20 +87,36 @@ struct gz_macro
     uint32_t                 last_recorded_frame;
 };
 
-#define GZM_SERIAL_SIZE(gzm)                                \
-   (sizeof((gzm)->n_input) +                                \
-    sizeof((gzm)->n_seed) +                                 \
-    sizeof((gzm)->input_start) +                            \
-    (gzm)->n_input * sizeof(struct movie_input) +           \
-    (gzm)->n_seed * sizeof(struct movie_seed) +             \
-    sizeof((gzm)->n_oca_input) +                            \
-    sizeof((gzm)->n_oca_sync) +                             \
-    sizeof((gzm)->n_room_load) +                            \
-    (gzm)->n_oca_input * sizeof(struct movie_oca_input) +   \
-    (gzm)->n_oca_sync * sizeof(struct movie_oca_sync) +     \
-    (gzm)->n_room_load * sizeof(struct movie_room_load) +   \
-    sizeof((gzm)->rerecords) +                              \
-    sizeof((gzm)->last_recorded_frame))
+// Versions of the serial format, each one appends fields to the previous
+enum gzm_version
+{
+    GZM_VERSION_BASE,           // inputs and seeds
+    GZM_VERSION_OCA,            // oca input, oca sync and room load
+    GZM_VERSION_RERECORDS,      // rerecords and last recorded frame
+    GZM_VERSION_LATEST = GZM_VERSION_RERECORDS
+};
+
+#define GZM_SERIAL_SIZE(gzm) gzm_serial_size((gzm), GZM_VERSION_LATEST)
+
+// Serialization
+
+size_t
+gzm_serial_size (const struct gz_macro *gzm, int version);
+
+int
+gzm_detect_version (const void *data, size_t size, int *complete_out);
+
+int
+gzm_decode (struct gz_macro *gzm, const void *data, size_t size);
+
+int
+gzm_encode (const struct gz_macro *gzm, int version, void *data, size_t size);
+
+void
+gzm_decode_inputs (struct movie_input *input, const void *data, size_t n);
+
+void
+gzm_encode_inputs (void *data, const struct movie_input *input, size_t n);
 
 // File IO
 
@@ -106,6 +126,9 @@ gzm_read (struct gz_macro *gzm, const char *file_name);
 int
 gzm_write (const struct gz_macro *gzm, const char *file_name);
 
+int
+gzm_read_update (struct gz_macro *gzm, const char *file_name);
+
 // New/Free
 
 int
@@ -114,6 +137,9 @@ gzm_new (struct gz_macro *gzm);
 int
 gzm_free (struct gz_macro *gzm);
 
+void
+gzm_take_events (struct gz_macro *gzm, struct gz_macro *ev);
+
 // Transformations
 
 int
@@ -128,6 +154,20 @@ gzm_cat (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_macr
 int
 gzm_cat_r (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_macro *gzm2);
 
+// The transformations without the inputs, for other representations of them (see gzm_compact.h)
+
+void
+gzm_trim_events (struct gz_macro *gzm, uint32_t end);
+
+void
+gzm_cat_events (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_macro *gzm2);
+
+void
+gzm_cat_r_events (struct gz_macro *gzm, const struct gz_macro *gzm1, const struct gz_macro *gzm2);
+
+int
+gzm_slice_events (struct gz_macro *output_gzm, const struct gz_macro *input_gzm, uint32_t frame_start, uint32_t frame_end);
+
 // Printing
 
 void
@@ -0,0 +1,259 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gzm_buffer.h"
+
+// An event array of the macro, every event type starts with an int32_t frame_idx
+struct event_array
+{
+    uint8_t                 *data;
+    uint32_t                *n;
+    size_t                   stride;
+};
+
+static struct event_array
+event_array (struct gz_macro *gzm, int i)
+{
+    switch (i)
+    {
+        case 0:
+            return (struct event_array){ (uint8_t *)gzm->seed, &gzm->n_seed, sizeof(struct movie_seed) };
+        case 1:
+            return (struct event_array){ (uint8_t *)gzm->oca_input, &gzm->n_oca_input, sizeof(struct movie_oca_input) };
+        case 2:
+            return (struct event_array){ (uint8_t *)gzm->oca_sync, &gzm->n_oca_sync, sizeof(struct movie_oca_sync) };
+        default:
+            return (struct event_array){ (uint8_t *)gzm->room_load, &gzm->n_room_load, sizeof(struct movie_room_load) };
+    }
+}
+
+static int32_t
+event_frame (const struct event_array *ev, uint32_t i)
+{
+    int32_t frame_idx;
+    memcpy(&frame_idx, ev->data + i * ev->stride, sizeof(frame_idx));
+    return frame_idx;
+}
+
+static void
+event_set_frame (struct event_array *ev, uint32_t i, int32_t frame_idx)
+{
+    memcpy(ev->data + i * ev->stride, &frame_idx, sizeof(frame_idx));
+}
+
+/* Index of the first event at or after `frame` */
+static uint32_t
+event_lower_bound (const struct event_array *ev, const struct gzm_event_index *idx, int64_t frame)
+{
+    uint32_t lo = 0;
+    uint32_t hi = *ev->n;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int64_t f = event_frame(ev, mid) + ((mid >= idx->split) ? idx->offset : 0);
+
+        if (f < frame)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Move the split of an event index, rebasing only the events it passes over */
+static void
+event_move_split (struct event_array *ev, struct gzm_event_index *idx, uint32_t split)
+{
+    for (uint32_t i = idx->split; i < split; i++)
+        event_set_frame(ev, i, event_frame(ev, i) + idx->offset);
+    for (uint32_t i = split; i < idx->split; i++)
+        event_set_frame(ev, i, event_frame(ev, i) - idx->offset);
+    idx->split = split;
+    if (split == *ev->n)
+        idx->offset = 0;
+}
+
+/* Move the gap so that it starts at `frame` */
+static void
+gap_move (struct gzm_buffer *buf, uint32_t frame)
+{
+    struct movie_input *input = buf->gzm.input;
+
+    if (frame < buf->gap_start)
+    {
+        uint32_t n = buf->gap_start - frame;
+        memmove(&input[buf->gap_end - n], &input[frame], n * sizeof(struct movie_input));
+        buf->gap_start -= n;
+        buf->gap_end -= n;
+    }
+    else if (frame > buf->gap_start)
+    {
+        uint32_t n = frame - buf->gap_start;
+        memmove(&input[buf->gap_start], &input[buf->gap_end], n * sizeof(struct movie_input));
+        buf->gap_start += n;
+        buf->gap_end += n;
+    }
+}
+
+/* Make room in the gap for at least `n` frames */
+static int
+gap_reserve (struct gzm_buffer *buf, uint32_t n)
+{
+    uint32_t gap = buf->gap_end - buf->gap_start;
+    uint32_t tail = buf->cap - buf->gap_end;
+    uint64_t cap;
+    struct movie_input *input;
+
+    if (gap >= n)
+        return 0;
+
+    cap = (uint64_t)buf->cap * 2;
+    if (cap < (uint64_t)buf->gzm.n_input + n + 64)
+        cap = (uint64_t)buf->gzm.n_input + n + 64;
+    if (cap > UINT32_MAX)
+        return -1;
+
+    input = realloc(buf->gzm.input, cap * sizeof(struct movie_input));
+    if (input == NULL)
+        return -1;
+    memmove(&input[cap - tail], &input[buf->gap_end], tail * sizeof(struct movie_input));
+    buf->gzm.input = input;
+    buf->gap_end = cap - tail;
+    buf->cap = cap;
+    return 0;
+}
+
+/* Recompute pad_delta of a frame from the frame before it */
+static void
+fix_pad_delta (struct gzm_buffer *buf, uint32_t frame)
+{
+    uint16_t prev;
+
+    if (frame >= buf->gzm.n_input)
+        return;
+    prev = (frame == 0) ? buf->gzm.input_start.pad : gzm_buffer_input(buf, frame - 1)->raw.pad;
+    gzm_buffer_input(buf, frame)->pad_delta = PAD_DELTA(prev, gzm_buffer_input(buf, frame)->raw.pad);
+}
+
+/* Open `gzm` for editing, the buffer takes ownership of it */
+int
+gzm_buffer_open (struct gzm_buffer *buf, struct gz_macro *gzm)
+{
+    memset(buf, 0, sizeof(struct gzm_buffer));
+    buf->gzm = *gzm;
+    buf->cap = gzm->n_input;
+    buf->gap_start = gzm->n_input;
+    buf->gap_end = gzm->n_input;
+    gzm_new(gzm);
+    return 0;
+}
+
+/* Close the gap and apply pending event offsets, afterwards buf->gzm is a regular macro until the next edit */
+void
+gzm_buffer_flush (struct gzm_buffer *buf)
+{
+    gap_move(buf, buf->gzm.n_input);
+    for (int i = 0; i < GZM_BUFFER_N_EVENTS; i++)
+    {
+        struct event_array ev = event_array(&buf->gzm, i);
+        event_move_split(&ev, &buf->events[i], *ev.n);
+    }
+}
+
+/* Flush the buffer and hand the macro back */
+void
+gzm_buffer_close (struct gzm_buffer *buf, struct gz_macro *gzm)
+{
+    gzm_buffer_flush(buf);
+    *gzm = buf->gzm;
+    memset(buf, 0, sizeof(struct gzm_buffer));
+}
+
+struct movie_input *
+gzm_buffer_input (struct gzm_buffer *buf, uint32_t frame)
+{
+    if (frame >= buf->gap_start)
+        frame += buf->gap_end - buf->gap_start;
+    return &buf->gzm.input[frame];
+}
+
+/*
+ * Insert `n` frames before `frame` (at the end if frame == n_input), events at or after `frame` move with the
+ * frames. With input NULL the new frames hold no buttons and a neutral stick.
+ */
+int
+gzm_insert_frames (struct gzm_buffer *buf, uint32_t frame, const z64_controller_t *input, uint32_t n)
+{
+    struct gz_macro *gzm = &buf->gzm;
+
+    if (frame > gzm->n_input || n > INT32_MAX - gzm->n_input)
+        return -1;
+    if (gap_reserve(buf, n) != 0)
+        return -1;
+
+    gap_move(buf, frame);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        struct movie_input *in = &gzm->input[buf->gap_start + i];
+
+        if (input != NULL)
+            in->raw = input[i];
+        else
+            memset(&in->raw, 0, sizeof(z64_controller_t));
+    }
+    buf->gap_start += n;
+    gzm->n_input += n;
+
+    for (uint32_t i = frame; i <= frame + n; i++)
+        fix_pad_delta(buf, i);
+
+    for (int i = 0; i < GZM_BUFFER_N_EVENTS; i++)
+    {
+        struct event_array ev = event_array(gzm, i);
+        struct gzm_event_index *idx = &buf->events[i];
+
+        event_move_split(&ev, idx, event_lower_bound(&ev, idx, frame));
+        idx->offset += n;
+    }
+    if (gzm->last_recorded_frame >= frame)
+        gzm->last_recorded_frame += n;
+    return 0;
+}
+
+/* Delete frames [frame, frame + n), events on those frames are dropped and later ones move back */
+int
+gzm_delete_frames (struct gzm_buffer *buf, uint32_t frame, uint32_t n)
+{
+    struct gz_macro *gzm = &buf->gzm;
+
+    if (frame > gzm->n_input || n > gzm->n_input - frame)
+        return -1;
+
+    gap_move(buf, frame);
+    buf->gap_end += n;
+    gzm->n_input -= n;
+    fix_pad_delta(buf, frame);
+
+    for (int i = 0; i < GZM_BUFFER_N_EVENTS; i++)
+    {
+        struct event_array ev = event_array(gzm, i);
+        struct gzm_event_index *idx = &buf->events[i];
+        uint32_t first = event_lower_bound(&ev, idx, frame);
+        uint32_t last = event_lower_bound(&ev, idx, (int64_t)frame + n);
+
+        event_move_split(&ev, idx, last);
+        memmove(ev.data + first * ev.stride, ev.data + last * ev.stride, (*ev.n - last) * ev.stride);
+        *ev.n -= last - first;
+        idx->split = first;
+        idx->offset -= n;
+        if (idx->split == *ev.n)
+            idx->offset = 0;
+    }
+    if (gzm->last_recorded_frame >= frame + n)
+        gzm->last_recorded_frame -= n;
+    else if (gzm->last_recorded_frame > frame)
+        gzm->last_recorded_frame = frame;
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef GZM_BUFFER_H_
+#define GZM_BUFFER_H_
+
+#include <stdint.h>
+
+#include "gzm.h"
+
+#define GZM_BUFFER_N_EVENTS 4 // seed, oca_input, oca_sync, room_load
+
+/*
+ * Events from `split` on are stored without the frame insertions and deletions made since they were last
+ * touched, their actual frame_idx is the stored one plus `offset`.
+ */
+struct gzm_event_index
+{
+    uint32_t                 split;
+    int32_t                  offset;
+};
+
+/*
+ * A macro open for structural editing. The inputs are kept in a gap buffer, so inserting or deleting frames
+ * only moves the inputs between the previous edit and this one, and the events are rebased lazily in the
+ * same way. gzm.n_input is the number of frames outside the gap.
+ */
+struct gzm_buffer
+{
+    struct gz_macro          gzm;
+    uint32_t                 cap;
+    uint32_t                 gap_start;
+    uint32_t                 gap_end;
+    struct gzm_event_index   events[GZM_BUFFER_N_EVENTS];
+};
+
+int
+gzm_buffer_open (struct gzm_buffer *buf, struct gz_macro *gzm);
+
+void
+gzm_buffer_flush (struct gzm_buffer *buf);
+
+void
+gzm_buffer_close (struct gzm_buffer *buf, struct gz_macro *gzm);
+
+struct movie_input *
+gzm_buffer_input (struct gzm_buffer *buf, uint32_t frame);
+
+int
+gzm_insert_frames (struct gzm_buffer *buf, uint32_t frame, const z64_controller_t *input, uint32_t n);
+
+int
+gzm_delete_frames (struct gzm_buffer *buf, uint32_t frame, uint32_t n);
+
+#endif
@@ -0,0 +1,373 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "gzm_cache.h"
+#include "gzm_schema.h"
+#include "hash.h"
+
+#define CACHE_MAGIC "GZMC"
+#define CACHE_FORMAT 1
+
+#define SCALAR_SERIAL_SIZE(field) + sizeof(((struct gz_macro *)0)->field)
+
+/* Fingerprint each section of serialized macro data, walking the schema without decoding any records */
+void
+gzm_fingerprint (struct gzm_fingerprint *fp, const void *data, size_t size)
+{
+    struct gz_macro hdr;
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+    uint8_t scalars[0 GZM_SCHEMA(SCALAR_SERIAL_SIZE, GZM_SCHEMA_IGNORE, GZM_SCHEMA_IGNORE)];
+    size_t n_scalars = 0;
+    int section = GZM_SECTION_INPUT;
+
+    memset(&hdr, 0, sizeof(struct gz_macro));
+    for (int i = 0; i < GZM_SECTION_MAX; i++)
+        fp->section[i] = hash64(NULL, 0, i);
+
+#define FINGERPRINT_SCALAR(field)                                                   \
+    if ((size_t)(end - p) < sizeof(hdr.field))                                      \
+        goto rest;                                                                  \
+    memcpy(&scalars[n_scalars], p, sizeof(hdr.field));                              \
+    n_scalars += sizeof(hdr.field);                                                 \
+    p = serial_load(&hdr.field, sizeof(hdr.field), p);
+#define FINGERPRINT_ARRAY(name, count, type, FIELDS)                                \
+    if ((uint64_t)hdr.count * GZM_RECORD_SERIAL_SIZE(type, FIELDS) > (size_t)(end - p)) \
+        goto rest;                                                                  \
+    fp->section[section] = hash64(p, (size_t)hdr.count * GZM_RECORD_SERIAL_SIZE(type, FIELDS), section); \
+    p += (size_t)hdr.count * GZM_RECORD_SERIAL_SIZE(type, FIELDS);                  \
+    section++;
+
+    GZM_SCHEMA(FINGERPRINT_SCALAR, FINGERPRINT_ARRAY, GZM_SCHEMA_IGNORE)
+
+#undef FINGERPRINT_SCALAR
+#undef FINGERPRINT_ARRAY
+
+rest:
+    fp->section[GZM_SECTION_SCALARS] = hash64(scalars, n_scalars, GZM_SECTION_SCALARS);
+    fp->section[GZM_SECTION_REST] = hash64(p, end - p, GZM_SECTION_REST);
+}
+
+/* A single key for a set of sections, as a mask of 1 << enum gzm_section */
+uint64_t
+gzm_fingerprint_key (const struct gzm_fingerprint *fp, uint32_t sections)
+{
+    uint64_t key = hash_mix(sections);
+
+    for (int i = 0; i < GZM_SECTION_MAX; i++)
+    {
+        if (sections & (1u << i))
+            key = hash_mix(key ^ fp->section[i]);
+    }
+    return key;
+}
+
+static uint64_t
+path_hash (const char *path)
+{
+    return hash64(path, strlen(path), 0);
+}
+
+static size_t
+table_slot (const size_t *table, size_t n_slots, uint64_t h)
+{
+    size_t slot = h & (n_slots - 1);
+    while (table[slot] != 0)
+        slot = (slot + 1) & (n_slots - 1);
+    return slot;
+}
+
+static void
+cache_index (struct gzm_cache *cache)
+{
+    cache->n_slots = 64;
+    while (cache->n_slots < cache->n * 2)
+        cache->n_slots *= 2;
+    cache->by_path = calloc(cache->n_slots, sizeof(size_t));
+    cache->by_key = calloc(cache->n_slots, sizeof(size_t));
+
+    for (size_t i = 0; i < cache->n; i++)
+    {
+        const struct gzm_cache_entry *ent = &cache->entries[i];
+
+        size_t slot;
+
+        cache->by_path[table_slot(cache->by_path, cache->n_slots, path_hash(ent->path))] = i + 1;
+
+        // one entry per key is enough, and many files sharing contents would otherwise make a long probe run
+        for (slot = ent->key & (cache->n_slots - 1); cache->by_key[slot] != 0; slot = (slot + 1) & (cache->n_slots - 1))
+        {
+            if (cache->entries[cache->by_key[slot] - 1].key == ent->key)
+                break;
+        }
+        if (cache->by_key[slot] == 0)
+            cache->by_key[slot] = i + 1;
+    }
+}
+
+/* Parse the loaded file in place, an entry that does not fit ends the cache */
+static void
+cache_parse (struct gzm_cache *cache, size_t size)
+{
+    const uint8_t *p = cache->buf;
+    const uint8_t *end = p + size;
+    uint32_t header[2];
+    size_t cap = 0;
+
+    if (size < 4 + sizeof(header) || memcmp(p, CACHE_MAGIC, 4) != 0)
+        return;
+    memcpy(header, p + 4, sizeof(header));
+    if (header[0] != CACHE_FORMAT || header[1] != cache->tag)
+        return;
+    p += 4 + sizeof(header);
+
+    while (true)
+    {
+        struct gzm_cache_entry ent;
+        uint32_t path_len;
+
+        if ((size_t)(end - p) < sizeof(path_len))
+            break;
+        memcpy(&path_len, p, sizeof(path_len));
+        p += sizeof(path_len);
+
+        // the path is stored with its terminator so it can be used where it lies
+        if (path_len == 0 || (size_t)(end - p) < path_len + 4 * sizeof(int64_t) + sizeof(uint32_t) || p[path_len - 1] != '\0')
+            break;
+        ent.path = (const char *)p;
+        p += path_len;
+        memcpy(&ent.size, p, sizeof(int64_t));
+        p += sizeof(int64_t);
+        memcpy(&ent.mtime_sec, p, sizeof(int64_t));
+        p += sizeof(int64_t);
+        memcpy(&ent.mtime_nsec, p, sizeof(int64_t));
+        p += sizeof(int64_t);
+        memcpy(&ent.key, p, sizeof(uint64_t));
+        p += sizeof(uint64_t);
+        memcpy(&ent.data_size, p, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+        if ((size_t)(end - p) < ent.data_size)
+            break;
+        ent.data = p;
+        p += ent.data_size;
+
+        if (cache->n == cap)
+        {
+            cap = (cap != 0) ? cap * 2 : 256;
+            cache->entries = realloc(cache->entries, cap * sizeof(struct gzm_cache_entry));
+            if (cache->entries == NULL)
+            {
+                cache->n = 0;
+                return;
+            }
+        }
+        cache->entries[cache->n++] = ent;
+    }
+}
+
+/* Load a cache, a missing or unreadable file or one written for another tag is an empty cache */
+int
+gzm_cache_open (struct gzm_cache *cache, const char *file_name, uint32_t tag)
+{
+    struct stat st;
+    FILE *file;
+
+    memset(cache, 0, sizeof(struct gzm_cache));
+    cache->tag = tag;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    if (file_name != NULL)
+    {
+        cache->file_name = strdup(file_name);
+        file = fopen(file_name, "rb");
+        if (file != NULL && fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode))
+        {
+            cache->buf = malloc(st.st_size + 1);
+            if (cache->buf != NULL && fread(cache->buf, 1, st.st_size, file) == (size_t)st.st_size)
+                cache_parse(cache, st.st_size);
+        }
+        if (file != NULL)
+            fclose(file);
+    }
+    cache_index(cache);
+    return 0;
+}
+
+static const struct gzm_cache_entry *
+cache_find_path (const struct gzm_cache *cache, const char *path)
+{
+    if (cache->n == 0)
+        return NULL;
+
+    for (size_t slot = path_hash(path) & (cache->n_slots - 1); cache->by_path[slot] != 0;
+         slot = (slot + 1) & (cache->n_slots - 1))
+    {
+        const struct gzm_cache_entry *ent = &cache->entries[cache->by_path[slot] - 1];
+        if (strcmp(ent->path, path) == 0)
+            return ent;
+    }
+    return NULL;
+}
+
+/* The entry for a file that has not changed since it was added */
+const struct gzm_cache_entry *
+gzm_cache_find (const struct gzm_cache *cache, const char *path, const struct stat *st)
+{
+    const struct gzm_cache_entry *ent = cache_find_path(cache, path);
+
+    if (ent != NULL && ent->size == st->st_size &&
+        ent->mtime_sec == st->st_mtim.tv_sec && ent->mtime_nsec == st->st_mtim.tv_nsec)
+        return ent;
+    return NULL;
+}
+
+/* An entry for the same content, from any path */
+const struct gzm_cache_entry *
+gzm_cache_find_key (const struct gzm_cache *cache, uint64_t key)
+{
+    if (cache->n == 0)
+        return NULL;
+
+    for (size_t slot = key & (cache->n_slots - 1); cache->by_key[slot] != 0; slot = (slot + 1) & (cache->n_slots - 1))
+    {
+        const struct gzm_cache_entry *ent = &cache->entries[cache->by_key[slot] - 1];
+        if (ent->key == key)
+            return ent;
+    }
+    return NULL;
+}
+
+/* Record a result for `path` as it is described by `st`, it replaces any loaded entry for the path on save */
+void
+gzm_cache_add (struct gzm_cache *cache, const char *path, const struct stat *st, uint64_t key,
+               const void *data, size_t size)
+{
+    struct gzm_cache_entry ent;
+    void *copy;
+
+    if (cache->file_name == NULL)
+        return;
+
+    copy = malloc(size + 1);
+    if (copy == NULL)
+        return;
+    memcpy(copy, data, size);
+    ent.path = strdup(path);
+    ent.size = st->st_size;
+    ent.mtime_sec = st->st_mtim.tv_sec;
+    ent.mtime_nsec = st->st_mtim.tv_nsec;
+    ent.key = key;
+    ent.data = copy;
+    ent.data_size = size;
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->n_added == cache->cap_added)
+    {
+        size_t cap = (cache->cap_added != 0) ? cache->cap_added * 2 : 256;
+        struct gzm_cache_entry *mem = realloc(cache->added, cap * sizeof(struct gzm_cache_entry));
+
+        if (mem == NULL)
+        {
+            pthread_mutex_unlock(&cache->lock);
+            free((char *)ent.path);
+            free(copy);
+            return;
+        }
+        cache->added = mem;
+        cache->cap_added = cap;
+    }
+    cache->added[cache->n_added++] = ent;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static void
+write_entry (FILE *file, const struct gzm_cache_entry *ent)
+{
+    uint32_t path_len = strlen(ent->path) + 1;
+
+    fwrite(&path_len, sizeof(path_len), 1, file);
+    fwrite(ent->path, path_len, 1, file);
+    fwrite(&ent->size, sizeof(ent->size), 1, file);
+    fwrite(&ent->mtime_sec, sizeof(ent->mtime_sec), 1, file);
+    fwrite(&ent->mtime_nsec, sizeof(ent->mtime_nsec), 1, file);
+    fwrite(&ent->key, sizeof(ent->key), 1, file);
+    fwrite(&ent->data_size, sizeof(ent->data_size), 1, file);
+    fwrite(ent->data, ent->data_size, 1, file);
+}
+
+/*
+ * Write the added entries, then the loaded ones for other paths. Everything is in host byte order, the file
+ * is replaced atomically so concurrent readers see either version.
+ */
+int
+gzm_cache_save (struct gzm_cache *cache)
+{
+    uint32_t header[2] = { CACHE_FORMAT, cache->tag };
+    char *tmp_name;
+    bool *replaced;
+    FILE *file;
+    int ret = 0;
+
+    if (cache->file_name == NULL || cache->n_added == 0)
+        return 0;
+
+    tmp_name = malloc(strlen(cache->file_name) + sizeof(".tmp"));
+    sprintf(tmp_name, "%s.tmp", cache->file_name);
+    file = fopen(tmp_name, "wb");
+    if (file == NULL)
+    {
+        free(tmp_name);
+        return -1;
+    }
+    fwrite(CACHE_MAGIC, 4, 1, file);
+    fwrite(header, sizeof(header), 1, file);
+
+    replaced = calloc(cache->n + 1, sizeof(bool));
+    for (size_t i = 0; i < cache->n_added; i++)
+    {
+        const struct gzm_cache_entry *ent = cache_find_path(cache, cache->added[i].path);
+
+        if (ent != NULL)
+            replaced[ent - cache->entries] = true;
+        write_entry(file, &cache->added[i]);
+    }
+    for (size_t i = 0; i < cache->n; i++)
+    {
+        if (!replaced[i])
+            write_entry(file, &cache->entries[i]);
+    }
+    free(replaced);
+
+    if (ferror(file))
+        ret = -1;
+    if (fclose(file) != 0 || ret != 0 || rename(tmp_name, cache->file_name) != 0)
+    {
+        remove(tmp_name);
+        ret = -1;
+    }
+    free(tmp_name);
+    return ret;
+}
+
+void
+gzm_cache_close (struct gzm_cache *cache)
+{
+    for (size_t i = 0; i < cache->n_added; i++)
+    {
+        free((char *)cache->added[i].path);
+        free((void *)cache->added[i].data);
+    }
+    free(cache->added);
+    free(cache->entries);
+    free(cache->by_path);
+    free(cache->by_key);
+    free(cache->buf);
+    free(cache->file_name);
+    pthread_mutex_destroy(&cache->lock);
+    memset(cache, 0, sizeof(struct gzm_cache));
+}
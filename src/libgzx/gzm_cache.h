@@ -0,0 +1,95 @@
+#ifndef GZM_CACHE_H_
+#define GZM_CACHE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "gzm.h"
+
+/*
+ * Content fingerprints of the sections of a serialized macro, so results derived from some sections can
+ * be reused when only the others change. Every byte of the data belongs to exactly one section.
+ */
+enum gzm_section
+{
+    GZM_SECTION_SCALARS,        // counts, input_start, rerecords and last_recorded_frame
+    GZM_SECTION_INPUT,          // then the arrays, in schema order
+    GZM_SECTION_SEED,
+    GZM_SECTION_OCA_INPUT,
+    GZM_SECTION_OCA_SYNC,
+    GZM_SECTION_ROOM_LOAD,
+    GZM_SECTION_REST,           // anything past the last section or after the data ends early
+    GZM_SECTION_MAX
+};
+
+#define GZM_SECTIONS_ALL ((1u << GZM_SECTION_MAX) - 1)
+
+struct gzm_fingerprint
+{
+    uint64_t                 section[GZM_SECTION_MAX];
+};
+
+void
+gzm_fingerprint (struct gzm_fingerprint *fp, const void *data, size_t size);
+
+uint64_t
+gzm_fingerprint_key (const struct gzm_fingerprint *fp, uint32_t sections);
+
+/*
+ * On-disk cache of results derived from macros, one file per kind of result. Entries are found by path when
+ * the file still has the size and modification time it had when the result was computed, which costs no more
+ * than the stat, or else by a fingerprint key of the sections the result depends on, which survives moves,
+ * touches and changes to other sections.
+ *
+ * Lookups only see what was loaded and may run concurrently with each other and with gzm_cache_add.
+ * Added results are kept aside and written out by gzm_cache_save.
+ */
+struct gzm_cache_entry
+{
+    const char              *path;
+    int64_t                  size;
+    int64_t                  mtime_sec;
+    int64_t                  mtime_nsec;
+    uint64_t                 key;
+    const void              *data;              // not aligned
+    uint32_t                 data_size;
+};
+
+struct gzm_cache
+{
+    char                    *file_name;         // NULL for a cache that is never loaded or saved
+    uint32_t                 tag;               // identifies the kind and format of the results
+    uint8_t                 *buf;               // the loaded file, entries point into it
+    struct gzm_cache_entry  *entries;
+    size_t                   n;
+    size_t                  *by_path;           // open addressing tables of entry index + 1
+    size_t                  *by_key;
+    size_t                   n_slots;
+    struct gzm_cache_entry  *added;             // own their path and data
+    size_t                   n_added;
+    size_t                   cap_added;
+    pthread_mutex_t          lock;
+};
+
+int
+gzm_cache_open (struct gzm_cache *cache, const char *file_name, uint32_t tag);
+
+const struct gzm_cache_entry *
+gzm_cache_find (const struct gzm_cache *cache, const char *path, const struct stat *st);
+
+const struct gzm_cache_entry *
+gzm_cache_find_key (const struct gzm_cache *cache, uint64_t key);
+
+void
+gzm_cache_add (struct gzm_cache *cache, const char *path, const struct stat *st, uint64_t key,
+               const void *data, size_t size);
+
+int
+gzm_cache_save (struct gzm_cache *cache);
+
+void
+gzm_cache_close (struct gzm_cache *cache);
+
+#endif
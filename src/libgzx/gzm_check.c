@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "gzm_check.h"
+
+static const char *gzm_check_strs[GZM_CHECK_NUM_FLAGS] =
+{
+    "truncated section",
+    "trailing data",
+    "inconsistent pad_delta",
+    "unsorted seed frame_idx",
+    "seed frame_idx out of range",
+    "unsorted oca_input frame_idx",
+    "oca_input frame_idx out of range",
+    "unsorted oca_sync frame_idx",
+    "oca_sync frame_idx out of range",
+    "unsorted room_load frame_idx",
+    "room_load frame_idx out of range",
+    "last_recorded_frame past n_input",
+};
+
+const char *
+gzm_check_str (uint32_t flag)
+{
+    for (int i = 0; i < GZM_CHECK_NUM_FLAGS; i++)
+    {
+        if (flag == (1u << i))
+            return gzm_check_strs[i];
+    }
+    return "unknown";
+}
+
+/*
+ * Check the frame_idx of an event array, which is the first field of every event record. Events must
+ * be sorted and refer to frames in [0, n_input]; an event on frame n_input is where a macro continues
+ * into the next one (see gzm_cat_r).
+ */
+static uint32_t
+check_frames (const void *events, size_t stride, uint32_t n, uint32_t n_input, uint32_t order_flag, uint32_t range_flag)
+{
+    const uint8_t *p = events;
+    uint32_t unsorted = 0;
+    uint32_t out_of_range = 0;
+    int32_t prev = 0;
+
+    // no early exits so the loop stays branch-free
+    for (uint32_t i = 0; i < n; i++)
+    {
+        int32_t frame_idx;
+
+        memcpy(&frame_idx, p + i * stride, sizeof(frame_idx));
+        unsorted |= (frame_idx < prev);
+        out_of_range |= ((uint32_t)frame_idx > n_input);
+        prev = frame_idx;
+    }
+    return (unsorted ? order_flag : 0) | (out_of_range ? range_flag : 0);
+}
+
+uint32_t
+gzm_check (const struct gz_macro *gzm)
+{
+    const struct movie_input *input = gzm->input;
+    uint32_t flags = 0;
+
+    // pad_delta of each frame against the previous frame, starting from input_start
+    if (gzm->n_input != 0)
+    {
+        uint16_t bad = input[0].pad_delta ^ PAD_DELTA(gzm->input_start.pad, input[0].raw.pad);
+
+        for (uint32_t i = 1; i < gzm->n_input; i++)
+            bad |= input[i].pad_delta ^ PAD_DELTA(input[i - 1].raw.pad, input[i].raw.pad);
+
+        if (bad != 0)
+            flags |= GZM_CHECK_PAD_DELTA;
+    }
+
+    flags |= check_frames(gzm->seed, sizeof(struct movie_seed), gzm->n_seed, gzm->n_input,
+                          GZM_CHECK_SEED_ORDER, GZM_CHECK_SEED_RANGE);
+    flags |= check_frames(gzm->oca_input, sizeof(struct movie_oca_input), gzm->n_oca_input, gzm->n_input,
+                          GZM_CHECK_OCA_INPUT_ORDER, GZM_CHECK_OCA_INPUT_RANGE);
+    flags |= check_frames(gzm->oca_sync, sizeof(struct movie_oca_sync), gzm->n_oca_sync, gzm->n_input,
+                          GZM_CHECK_OCA_SYNC_ORDER, GZM_CHECK_OCA_SYNC_RANGE);
+    flags |= check_frames(gzm->room_load, sizeof(struct movie_room_load), gzm->n_room_load, gzm->n_input,
+                          GZM_CHECK_ROOM_LOAD_ORDER, GZM_CHECK_ROOM_LOAD_RANGE);
+
+    if (gzm->last_recorded_frame > gzm->n_input)
+        flags |= GZM_CHECK_LAST_RECORDED_FRAME;
+
+    return flags;
+}
+
+/* Check a serialized macro, including the section layout itself */
+uint32_t
+gzm_check_data (const void *data, size_t size)
+{
+    struct gz_macro gzm;
+    uint32_t flags = 0;
+    int complete;
+
+    if (gzm_detect_version(data, size, &complete) < 0)
+    {
+        // only a complete latest version can have something left over, anything else ended early
+        flags |= (complete == GZM_VERSION_LATEST) ? GZM_CHECK_TRAILING_DATA : GZM_CHECK_TRUNCATED;
+    }
+
+    // the longest complete prefix is still checked
+    gzm_decode(&gzm, data, size);
+    flags |= gzm_check(&gzm);
+    gzm_free(&gzm);
+    return flags;
+}
@@ -0,0 +1,36 @@
+#ifndef GZM_CHECK_H_
+#define GZM_CHECK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gzm.h"
+
+// Structural problems found by gzm_check, as a bitmask
+enum gzm_check_flag
+{
+    GZM_CHECK_TRUNCATED           = (1 << 0),   // file ends partway through a section
+    GZM_CHECK_TRAILING_DATA       = (1 << 1),   // data past the end of the last section
+    GZM_CHECK_PAD_DELTA           = (1 << 2),   // pad_delta does not match consecutive raw.pad
+    GZM_CHECK_SEED_ORDER          = (1 << 3),
+    GZM_CHECK_SEED_RANGE          = (1 << 4),
+    GZM_CHECK_OCA_INPUT_ORDER     = (1 << 5),
+    GZM_CHECK_OCA_INPUT_RANGE     = (1 << 6),
+    GZM_CHECK_OCA_SYNC_ORDER      = (1 << 7),
+    GZM_CHECK_OCA_SYNC_RANGE      = (1 << 8),
+    GZM_CHECK_ROOM_LOAD_ORDER     = (1 << 9),
+    GZM_CHECK_ROOM_LOAD_RANGE     = (1 << 10),
+    GZM_CHECK_LAST_RECORDED_FRAME = (1 << 11),  // last_recorded_frame past n_input
+    GZM_CHECK_NUM_FLAGS           = 12
+};
+
+uint32_t
+gzm_check (const struct gz_macro *gzm);
+
+uint32_t
+gzm_check_data (const void *data, size_t size);
+
+const char *
+gzm_check_str (uint32_t flag);
+
+#endif
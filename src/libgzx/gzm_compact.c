@@ -0,0 +1,405 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gzm_compact.h"
+#include "gzm_journal.h"
+#include "gzm_stream.h"
+
+// The event arrays of a macro, frame_idx is the first field of every event record
+static const struct
+{
+    size_t       array;
+    size_t       count;
+    size_t       size;
+} event_arrays[] =
+{
+    { offsetof(struct gz_macro, seed),      offsetof(struct gz_macro, n_seed),      sizeof(struct movie_seed)      },
+    { offsetof(struct gz_macro, oca_input), offsetof(struct gz_macro, n_oca_input), sizeof(struct movie_oca_input) },
+    { offsetof(struct gz_macro, oca_sync),  offsetof(struct gz_macro, n_oca_sync),  sizeof(struct movie_oca_sync)  },
+    { offsetof(struct gz_macro, room_load), offsetof(struct gz_macro, n_room_load), sizeof(struct movie_room_load) },
+};
+
+struct compact_reader
+{
+    struct gzm_compact      *c;
+    uint32_t                 cap;
+    bool                     failed;
+};
+
+// Decoded inputs go straight into the compact frames, the full inputs are never held
+static void
+compact_sink (void *arg, uint32_t frame, const struct movie_input *input, size_t n)
+{
+    struct compact_reader *r = arg;
+
+    if (r->failed)
+        return;
+    if (frame + n > r->cap)
+    {
+        uint64_t cap = (r->cap != 0) ? (uint64_t)r->cap * 2 : 4096;
+        z64_controller_t *mem;
+
+        if (cap < frame + n)
+            cap = frame + n;
+        mem = realloc(r->c->frame, cap * sizeof(z64_controller_t));
+        if (mem == NULL)
+        {
+            r->failed = true;
+            return;
+        }
+        r->c->frame = mem;
+        r->cap = cap;
+    }
+    for (size_t i = 0; i < n; i++)
+        r->c->frame[frame + i] = input[i].raw;
+}
+
+static void
+compact_source (void *arg, uint32_t frame, struct movie_input *input, size_t n)
+{
+    gzm_compact_expand(input, arg, frame, n);
+}
+
+/* Convert a macro, taking ownership of everything but its inputs, which are freed */
+int
+gzm_compact_from (struct gzm_compact *c, struct gz_macro *gzm)
+{
+    c->frame = NULL;
+    if (gzm->n_input != 0)
+    {
+        c->frame = malloc(gzm->n_input * sizeof(z64_controller_t));
+        if (c->frame == NULL)
+            return -1;
+        for (uint32_t i = 0; i < gzm->n_input; i++)
+            c->frame[i] = gzm->input[i].raw;
+    }
+    free(gzm->input);
+    gzm->input = NULL;
+    c->gzm = *gzm;
+    gzm_new(gzm);
+    return 0;
+}
+
+/* Make a regular macro copy of `c` */
+int
+gzm_compact_to (struct gz_macro *gzm, const struct gzm_compact *c)
+{
+    if (gzm_dup(gzm, &c->gzm) != 0)
+        return -1;
+    if (gzm->n_input != 0)
+    {
+        gzm->input = malloc(gzm->n_input * sizeof(struct movie_input));
+        if (gzm->input == NULL)
+        {
+            gzm_free(gzm);
+            return -1;
+        }
+        gzm_compact_expand(gzm->input, c, 0, gzm->n_input);
+    }
+    return 0;
+}
+
+/*
+ * Read a macro straight into compact form. pad_delta is not kept, so a file whose pad_delta does not match
+ * its pads is written back with correct ones.
+ */
+int
+gzm_compact_read (struct gzm_compact *c, const char *file_name)
+{
+    struct compact_reader r = { .c = c };
+    FILE *file;
+    int ret;
+
+    memset(c, 0, sizeof(struct gzm_compact));
+
+    // Saves in a journal apply to the full representation
+    if (strcmp(file_name, "-") != 0 && gzm_journal_exists(file_name))
+    {
+        struct gz_macro gzm;
+
+        ret = gzm_read(&gzm, file_name);
+        if (gzm_compact_from(c, &gzm) != 0)
+        {
+            gzm_free(&gzm);
+            return -1;
+        }
+        return ret;
+    }
+
+    file = (strcmp(file_name, "-") == 0) ? stdin : fopen(file_name, "rb");
+    if (file == NULL)
+        return -1;
+    ret = gzm_stream_read(&c->gzm, file, compact_sink, &r);
+    if (file != stdin)
+        fclose(file);
+
+    if (r.failed || (c->gzm.n_input != 0 && c->frame == NULL))
+    {
+        gzm_compact_free(c);
+        return -1;
+    }
+    return ret;
+}
+
+/* Write a macro, the full inputs are produced a batch at a time as they are encoded */
+int
+gzm_compact_write (const struct gzm_compact *c, const char *file_name)
+{
+    bool std = (strcmp(file_name, "-") == 0);
+    FILE *file = std ? stdout : fopen(file_name, "wb");
+    int ret;
+
+    if (file == NULL)
+        return -1;
+    ret = gzm_stream_write_inputs(&c->gzm, GZM_VERSION_LATEST, file, compact_source, (void *)c);
+    if (std)
+        return ret;
+    if (fclose(file) != 0 || ret != 0)
+        return -1;
+    return gzm_journal_discard(file_name);
+}
+
+void
+gzm_compact_free (struct gzm_compact *c)
+{
+    free(c->frame);
+    gzm_free(&c->gzm);
+    c->frame = NULL;
+}
+
+/* pad_delta of frames [start, start + n), a plain loop over neighbouring pads that vectorizes */
+void
+gzm_compact_pad_delta (uint16_t *delta, const struct gzm_compact *c, uint32_t start, uint32_t n)
+{
+    const z64_controller_t *frame = &c->frame[start];
+
+    if (n == 0)
+        return;
+    delta[0] = PAD_DELTA((start == 0) ? c->gzm.input_start.pad : frame[-1].pad, frame[0].pad);
+    for (uint32_t i = 1; i < n; i++)
+        delta[i] = PAD_DELTA(frame[i - 1].pad, frame[i].pad);
+}
+
+/* Full inputs for frames [start, start + n) */
+void
+gzm_compact_expand (struct movie_input *input, const struct gzm_compact *c, uint32_t start, uint32_t n)
+{
+    const z64_controller_t *frame = &c->frame[start];
+
+    if (n == 0)
+        return;
+    input[0].raw = frame[0];
+    input[0].pad_delta = PAD_DELTA((start == 0) ? c->gzm.input_start.pad : frame[-1].pad, frame[0].pad);
+    for (uint32_t i = 1; i < n; i++)
+    {
+        input[i].raw = frame[i];
+        input[i].pad_delta = PAD_DELTA(frame[i - 1].pad, frame[i].pad);
+    }
+}
+
+static z64_controller_t *
+frames_dup (const z64_controller_t *frame, uint32_t n)
+{
+    z64_controller_t *out;
+
+    if (n == 0)
+        return NULL;
+    out = malloc(n * sizeof(z64_controller_t));
+    if (out != NULL)
+        memcpy(out, frame, n * sizeof(z64_controller_t));
+    return out;
+}
+
+int
+gzm_compact_dup (struct gzm_compact *out, const struct gzm_compact *c)
+{
+    if (gzm_dup(&out->gzm, &c->gzm) != 0)
+        return -1;
+    out->frame = frames_dup(c->frame, c->gzm.n_input);
+    if (c->gzm.n_input != 0 && out->frame == NULL)
+    {
+        gzm_free(&out->gzm);
+        return -1;
+    }
+    return 0;
+}
+
+int
+gzm_compact_trim (struct gzm_compact *c, uint32_t end)
+{
+    if (end > c->gzm.n_input)
+        return -1;
+
+    c->gzm.n_input = end;
+    if (end == 0)
+    {
+        free(c->frame);
+        c->frame = NULL;
+    }
+    else
+    {
+        // shrinking, the old block is still good if it cannot be moved
+        z64_controller_t *frame = realloc(c->frame, end * sizeof(z64_controller_t));
+
+        if (frame != NULL)
+            c->frame = frame;
+    }
+
+    gzm_trim_events(&c->gzm, end);
+    return 0;
+}
+
+int
+gzm_compact_slice (struct gzm_compact *out, const struct gzm_compact *c, uint32_t frame_start, uint32_t frame_end)
+{
+    if (frame_start > c->gzm.n_input || frame_end > c->gzm.n_input || frame_end <= frame_start)
+        return -1;
+
+    memset(out, 0, sizeof(struct gzm_compact));
+    out->gzm.n_input = frame_end - frame_start;
+    out->frame = frames_dup(&c->frame[frame_start], out->gzm.n_input);
+    if (out->frame == NULL)
+    {
+        out->gzm.n_input = 0;
+        return -1;
+    }
+
+    if (gzm_slice_events(&out->gzm, &c->gzm, frame_start, frame_end) != 0)
+    {
+        gzm_compact_free(out);
+        return -1;
+    }
+    return 0;
+}
+
+int
+gzm_compact_cat (struct gzm_compact *out, const struct gzm_compact *c1, const struct gzm_compact *c2)
+{
+    memset(out, 0, sizeof(struct gzm_compact));
+    out->gzm.n_input = c1->gzm.n_input + c2->gzm.n_input;
+    if (out->gzm.n_input != 0)
+    {
+        out->frame = malloc(out->gzm.n_input * sizeof(z64_controller_t));
+        if (out->frame == NULL)
+        {
+            out->gzm.n_input = 0;
+            return -1;
+        }
+        if (c1->frame != NULL)
+            memcpy(&out->frame[0],               c1->frame, c1->gzm.n_input * sizeof(z64_controller_t));
+        if (c2->frame != NULL)
+            memcpy(&out->frame[c1->gzm.n_input], c2->frame, c2->gzm.n_input * sizeof(z64_controller_t));
+    }
+
+    gzm_cat_events(&out->gzm, &c1->gzm, &c2->gzm);
+    return 0;
+}
+
+/* Concat at the last recorded rng seed frame index, as gzm_cat_r */
+int
+gzm_compact_cat_r (struct gzm_compact *out, const struct gzm_compact *c1, const struct gzm_compact *c2)
+{
+    if (c1->gzm.n_seed == 0 || c2->gzm.n_seed == 0)
+        return -1;
+
+    int last_frame_1 = c1->gzm.seed[c1->gzm.n_seed - 1].frame_idx;
+    int first_frame_2 = c2->gzm.seed[0].frame_idx;
+
+    memset(out, 0, sizeof(struct gzm_compact));
+    out->gzm.n_input = last_frame_1 + (c2->gzm.n_input - first_frame_2);
+    out->frame = malloc(out->gzm.n_input * sizeof(z64_controller_t) + 1);
+    if (out->frame == NULL)
+    {
+        out->gzm.n_input = 0;
+        return -1;
+    }
+    memcpy(&out->frame[0],            &c1->frame[0],             last_frame_1 * sizeof(z64_controller_t));
+    memcpy(&out->frame[last_frame_1], &c2->frame[first_frame_2], (c2->gzm.n_input - first_frame_2) * sizeof(z64_controller_t));
+
+    gzm_cat_r_events(&out->gzm, &c1->gzm, &c2->gzm);
+    return 0;
+}
+
+/* Drop the events on frames [frame, frame + n_drop) and move those after them by `delta` frames */
+static void
+move_events (struct gz_macro *gzm, uint32_t frame, uint32_t n_drop, int64_t delta)
+{
+    for (size_t a = 0; a < sizeof(event_arrays) / sizeof(event_arrays[0]); a++)
+    {
+        const size_t size = event_arrays[a].size;
+        uint8_t *events;
+        uint32_t n;
+        uint32_t n_out = 0;
+
+        memcpy(&events, (uint8_t *)gzm + event_arrays[a].array, sizeof(events));
+        memcpy(&n, (uint8_t *)gzm + event_arrays[a].count, sizeof(n));
+        for (uint32_t i = 0; i < n; i++)
+        {
+            int32_t frame_idx;
+
+            memcpy(&frame_idx, events + i * size, sizeof(frame_idx));
+            if (frame_idx >= (int64_t)frame && frame_idx < (int64_t)frame + n_drop)
+                continue;
+            if (frame_idx >= (int64_t)frame + n_drop)
+                frame_idx += delta;
+            memmove(events + n_out * size, events + i * size, size);
+            memcpy(events + n_out * size, &frame_idx, sizeof(frame_idx));
+            n_out++;
+        }
+        memcpy((uint8_t *)gzm + event_arrays[a].count, &n_out, sizeof(n_out));
+    }
+}
+
+/*
+ * Insert `n` frames before `frame`, as gzm_insert_frames. A compact macro has no pad_delta to fix around the
+ * edit, so the frames are moved in place rather than kept in a gap buffer.
+ */
+int
+gzm_compact_insert_frames (struct gzm_compact *c, uint32_t frame, const z64_controller_t *input, uint32_t n)
+{
+    struct gz_macro *gzm = &c->gzm;
+    z64_controller_t *mem;
+
+    if (frame > gzm->n_input || n > INT32_MAX - gzm->n_input)
+        return -1;
+    mem = realloc(c->frame, ((size_t)gzm->n_input + n) * sizeof(z64_controller_t) + 1);
+    if (mem == NULL)
+        return -1;
+    c->frame = mem;
+
+    memmove(&c->frame[frame + n], &c->frame[frame], (gzm->n_input - frame) * sizeof(z64_controller_t));
+    if (input != NULL)
+        memcpy(&c->frame[frame], input, n * sizeof(z64_controller_t));
+    else
+        memset(&c->frame[frame], 0, n * sizeof(z64_controller_t));
+    gzm->n_input += n;
+
+    move_events(gzm, frame, 0, n);
+    if (gzm->last_recorded_frame >= frame)
+        gzm->last_recorded_frame += n;
+    return 0;
+}
+
+/* Delete frames [frame, frame + n), as gzm_delete_frames */
+int
+gzm_compact_delete_frames (struct gzm_compact *c, uint32_t frame, uint32_t n)
+{
+    struct gz_macro *gzm = &c->gzm;
+
+    if (frame > gzm->n_input || n > gzm->n_input - frame)
+        return -1;
+
+    memmove(&c->frame[frame], &c->frame[frame + n], (gzm->n_input - frame - n) * sizeof(z64_controller_t));
+    gzm->n_input -= n;
+
+    move_events(gzm, frame, n, -(int64_t)n);
+    if (gzm->last_recorded_frame >= frame + n)
+        gzm->last_recorded_frame -= n;
+    else if (gzm->last_recorded_frame > frame)
+        gzm->last_recorded_frame = frame;
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef GZM_COMPACT_H_
+#define GZM_COMPACT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gzm.h"
+#include "gzm_edit.h"
+
+/*
+ * A macro with its inputs stored as bare controller states, 4 bytes per frame instead of 6. pad_delta is
+ * not stored, it follows from consecutive pads and is computed when needed and when the macro is written.
+ * gzm holds everything else, gzm.input is always NULL and gzm.n_input counts the frames.
+ *
+ * Every transformation of libgzx has a compact counterpart here except gzm_check, which checks the stored
+ * pad_delta that a compact macro does not have. gzm_compact_edit and gzm_compact_split are implemented next
+ * to gzm_edit and gzm_split, and share their code.
+ */
+struct gzm_compact
+{
+    struct gz_macro          gzm;
+    z64_controller_t        *frame;             // length gzm.n_input
+};
+
+// Conversion and file IO
+
+int
+gzm_compact_from (struct gzm_compact *c, struct gz_macro *gzm);
+
+int
+gzm_compact_to (struct gz_macro *gzm, const struct gzm_compact *c);
+
+int
+gzm_compact_read (struct gzm_compact *c, const char *file_name);
+
+int
+gzm_compact_write (const struct gzm_compact *c, const char *file_name);
+
+void
+gzm_compact_free (struct gzm_compact *c);
+
+// Inputs
+
+void
+gzm_compact_pad_delta (uint16_t *delta, const struct gzm_compact *c, uint32_t start, uint32_t n);
+
+void
+gzm_compact_expand (struct movie_input *input, const struct gzm_compact *c, uint32_t start, uint32_t n);
+
+// Transformations, as the gz_macro ones
+
+int
+gzm_compact_dup (struct gzm_compact *out, const struct gzm_compact *c);
+
+int
+gzm_compact_trim (struct gzm_compact *c, uint32_t end);
+
+int
+gzm_compact_slice (struct gzm_compact *out, const struct gzm_compact *c, uint32_t frame_start, uint32_t frame_end);
+
+int
+gzm_compact_cat (struct gzm_compact *out, const struct gzm_compact *c1, const struct gzm_compact *c2);
+
+int
+gzm_compact_cat_r (struct gzm_compact *out, const struct gzm_compact *c1, const struct gzm_compact *c2);
+
+int
+gzm_compact_edit (struct gzm_compact *c, const struct gzm_edit_op *ops, size_t n_ops);
+
+int
+gzm_compact_split (struct gzm_compact *out, const struct gzm_compact *c, const uint32_t *cuts, size_t n_cuts);
+
+int
+gzm_compact_insert_frames (struct gzm_compact *c, uint32_t frame, const z64_controller_t *input, uint32_t n);
+
+int
+gzm_compact_delete_frames (struct gzm_compact *c, uint32_t frame, uint32_t n);
+
+#endif
@@ -0,0 +1,493 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gzm_compact.h"
+#include "gzm_edit.h"
+
+/*
+ * Edits are fused: the op ranges split the inputs into segments in which the same set of ops applies,
+ * the ops of each segment are composed into one button and/or mask and one lookup table per stick axis,
+ * and every input is then visited once. Event arrays are visited once each for all shifts together.
+ */
+
+struct edit_xform
+{
+    uint16_t                 and_mask;
+    uint16_t                 or_mask;
+    int8_t                   lut_x[256];
+    int8_t                   lut_y[256];
+};
+
+static const struct
+{
+    const char  *name;
+    uint16_t     mask;
+} pad_names[] =
+{
+    { "A",   1 << 15 }, { "B",   1 << 14 }, { "Z",   1 << 13 }, { "S",   1 << 12 },
+    { "DU",  1 << 11 }, { "DD",  1 << 10 }, { "DL",  1 <<  9 }, { "DR",  1 <<  8 },
+    { "RST", 1 <<  7 }, { "L",   1 <<  5 }, { "R",   1 <<  4 }, { "CU",  1 <<  3 },
+    { "CD",  1 <<  2 }, { "CL",  1 <<  1 }, { "CR",  1 <<  0 },
+};
+
+static int
+cmp_u32 (const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bool
+is_input_op (const struct gzm_edit_op *op)
+{
+    return op->kind == GZM_EDIT_PAD_CLEAR || op->kind == GZM_EDIT_PAD_SET || op->kind == GZM_EDIT_STICK;
+}
+
+static int8_t
+stick_apply (const struct gzm_edit_op *op, int v)
+{
+    v = v * op->mul / op->div + op->add;
+    if (v < op->lo)
+        v = op->lo;
+    if (v > op->hi)
+        v = op->hi;
+    return v;
+}
+
+/* Compose the ops covering frame `frame` into `xf`, returns false if none do */
+static bool
+edit_xform_build (struct edit_xform *xf, const struct gzm_edit_op *ops, size_t n_ops, uint32_t frame)
+{
+    bool active = false;
+
+    xf->and_mask = 0xFFFF;
+    xf->or_mask = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        xf->lut_x[v] = (int8_t)v;
+        xf->lut_y[v] = (int8_t)v;
+    }
+
+    for (size_t i = 0; i < n_ops; i++)
+    {
+        const struct gzm_edit_op *op = &ops[i];
+
+        if (!is_input_op(op) || frame < op->start || frame >= op->end)
+            continue;
+        active = true;
+
+        switch (op->kind)
+        {
+            case GZM_EDIT_PAD_CLEAR:
+                xf->and_mask &= ~op->mask;
+                xf->or_mask &= ~op->mask;
+                break;
+            case GZM_EDIT_PAD_SET:
+                xf->or_mask |= op->mask;
+                break;
+            case GZM_EDIT_STICK:
+                for (int v = 0; v < 256; v++)
+                {
+                    if (op->axes & GZM_EDIT_AXIS_X)
+                        xf->lut_x[v] = stick_apply(op, xf->lut_x[v]);
+                    if (op->axes & GZM_EDIT_AXIS_Y)
+                        xf->lut_y[v] = stick_apply(op, xf->lut_y[v]);
+                }
+                break;
+        }
+    }
+    return active;
+}
+
+/*
+ * Shift the frame_idx (the first field) of every event in an array by all shift ops at once, drop events
+ * that end up outside [0, n_input] and restore the ordering.
+ */
+static uint32_t
+edit_shift_events (void *events, size_t stride, uint32_t n, uint32_t n_input, const struct gzm_edit_op *ops, size_t n_ops)
+{
+    uint8_t *base = events;
+    uint8_t tmp[16];
+    uint32_t n_out = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        int32_t frame_idx;
+        int64_t f;
+
+        memcpy(&frame_idx, base + i * stride, sizeof(frame_idx));
+        f = frame_idx;
+        for (size_t k = 0; k < n_ops; k++)
+        {
+            if (ops[k].kind == GZM_EDIT_SHIFT && f >= ops[k].start && f < ops[k].end)
+                f += ops[k].delta;
+        }
+        if (f < 0 || f > n_input)
+            continue;
+
+        // insertion sort, events only move as far as shifted ranges overlap others
+        frame_idx = f;
+        memcpy(tmp, base + i * stride, stride);
+        memcpy(tmp, &frame_idx, sizeof(frame_idx));
+
+        uint32_t j = n_out;
+        while (j > 0)
+        {
+            int32_t prev;
+            memcpy(&prev, base + (j - 1) * stride, sizeof(prev));
+            if (prev <= frame_idx)
+                break;
+            j--;
+        }
+        memmove(base + (j + 1) * stride, base + j * stride, (n_out - j) * stride);
+        memcpy(base + j * stride, tmp, stride);
+        n_out++;
+    }
+    return n_out;
+}
+
+/*
+ * Everything but the slices, on a macro whose frames are either `input` or, for a compact macro, the bare
+ * controller states `frame`, which have no pad_delta to keep up.
+ */
+static int
+edit_frames (struct gz_macro *gzm, struct movie_input *input, z64_controller_t *frame, uint32_t n_input,
+             const struct gzm_edit_op *ops, size_t n_ops)
+{
+    bool fix_next = false;
+    bool has_shift = false;
+    struct edit_xform *xf;
+    uint32_t *bounds;
+    size_t n_bounds = 0;
+
+    for (size_t i = 0; i < n_ops; i++)
+    {
+        if (ops[i].kind == GZM_EDIT_STICK && ops[i].div == 0)
+            return -1;
+        if (ops[i].kind == GZM_EDIT_INPUT_START)
+        {
+            gzm->input_start = ops[i].input_start;
+            fix_next = true;
+        }
+        has_shift |= (ops[i].kind == GZM_EDIT_SHIFT);
+    }
+
+    // Segment boundaries
+    bounds = malloc((2 * n_ops + 2) * sizeof(uint32_t));
+    xf = malloc(sizeof(struct edit_xform));
+    if (bounds == NULL || xf == NULL)
+    {
+        free(bounds);
+        free(xf);
+        return -1;
+    }
+    bounds[n_bounds++] = 0;
+    bounds[n_bounds++] = n_input;
+    for (size_t i = 0; i < n_ops; i++)
+    {
+        if (!is_input_op(&ops[i]))
+            continue;
+        bounds[n_bounds++] = (ops[i].start < n_input) ? ops[i].start : n_input;
+        bounds[n_bounds++] = (ops[i].end < n_input) ? ops[i].end : n_input;
+    }
+    qsort(bounds, n_bounds, sizeof(uint32_t), cmp_u32);
+
+    // Inputs, one pass. pad_delta follows the new pads, including on the first frame after each edited segment
+    for (size_t s = 0; s + 1 < n_bounds; s++)
+    {
+        uint32_t a = bounds[s];
+        uint32_t b = bounds[s + 1];
+
+        if (a == b)
+            continue;
+
+        if (!edit_xform_build(xf, ops, n_ops, a))
+        {
+            if (fix_next && input != NULL)
+                input[a].pad_delta = PAD_DELTA((a == 0) ? gzm->input_start.pad : input[a - 1].raw.pad, input[a].raw.pad);
+            fix_next = false;
+            continue;
+        }
+
+        if (input != NULL)
+        {
+            uint16_t prev = (a == 0) ? gzm->input_start.pad : input[a - 1].raw.pad;
+            for (uint32_t i = a; i < b; i++)
+            {
+                uint16_t pad = (input[i].raw.pad & xf->and_mask) | xf->or_mask;
+
+                input[i].raw.pad = pad;
+                input[i].raw.x = xf->lut_x[(uint8_t)input[i].raw.x];
+                input[i].raw.y = xf->lut_y[(uint8_t)input[i].raw.y];
+                input[i].pad_delta = PAD_DELTA(prev, pad);
+                prev = pad;
+            }
+        }
+        else
+        {
+            for (uint32_t i = a; i < b; i++)
+            {
+                frame[i].pad = (frame[i].pad & xf->and_mask) | xf->or_mask;
+                frame[i].x = xf->lut_x[(uint8_t)frame[i].x];
+                frame[i].y = xf->lut_y[(uint8_t)frame[i].y];
+            }
+        }
+        fix_next = true;
+    }
+    free(bounds);
+    free(xf);
+
+    // Events, one pass per array
+    if (has_shift)
+    {
+        gzm->n_seed = edit_shift_events(gzm->seed, sizeof(struct movie_seed), gzm->n_seed, n_input, ops, n_ops);
+        gzm->n_oca_input = edit_shift_events(gzm->oca_input, sizeof(struct movie_oca_input), gzm->n_oca_input, n_input, ops, n_ops);
+        gzm->n_oca_sync = edit_shift_events(gzm->oca_sync, sizeof(struct movie_oca_sync), gzm->n_oca_sync, n_input, ops, n_ops);
+        gzm->n_room_load = edit_shift_events(gzm->room_load, sizeof(struct movie_room_load), gzm->n_room_load, n_input, ops, n_ops);
+    }
+    return 0;
+}
+
+int
+gzm_edit (struct gz_macro *gzm, const struct gzm_edit_op *ops, size_t n_ops)
+{
+    if (edit_frames(gzm, gzm->input, NULL, gzm->n_input, ops, n_ops) != 0)
+        return -1;
+
+    // Slices last, each one relative to the result of the previous
+    for (size_t i = 0; i < n_ops; i++)
+    {
+        struct gz_macro out;
+
+        if (ops[i].kind != GZM_EDIT_SLICE)
+            continue;
+        if (gzm_slice(&out, gzm, ops[i].start, (ops[i].end < gzm->n_input) ? ops[i].end : gzm->n_input) != 0)
+            return -1;
+        gzm_free(gzm);
+        *gzm = out;
+    }
+    return 0;
+}
+
+/* gzm_edit on a compact macro, the stick and button edits are the same and there is no pad_delta to fix */
+int
+gzm_compact_edit (struct gzm_compact *c, const struct gzm_edit_op *ops, size_t n_ops)
+{
+    if (edit_frames(&c->gzm, NULL, c->frame, c->gzm.n_input, ops, n_ops) != 0)
+        return -1;
+
+    for (size_t i = 0; i < n_ops; i++)
+    {
+        struct gzm_compact out;
+
+        if (ops[i].kind != GZM_EDIT_SLICE)
+            continue;
+        if (gzm_compact_slice(&out, c, ops[i].start, (ops[i].end < c->gzm.n_input) ? ops[i].end : c->gzm.n_input) != 0)
+            return -1;
+        gzm_compact_free(c);
+        *c = out;
+    }
+    return 0;
+}
+
+/* Parse buttons as names joined by '+' (e.g. "A+B+Z"), or a number */
+int
+gzm_pad_from_names (uint16_t *pad, const char *names)
+{
+    char *end;
+    unsigned long v = strtoul(names, &end, 0);
+
+    if (end != names && *end == '\0')
+    {
+        if (v > 0xFFFF)
+            return -1;
+        *pad = v;
+        return 0;
+    }
+
+    *pad = 0;
+    while (*names != '\0')
+    {
+        size_t len = strcspn(names, "+");
+        size_t i;
+
+        for (i = 0; i < sizeof(pad_names) / sizeof(pad_names[0]); i++)
+        {
+            if (strlen(pad_names[i].name) == len && strncmp(pad_names[i].name, names, len) == 0)
+                break;
+        }
+        if (i == sizeof(pad_names) / sizeof(pad_names[0]))
+            return -1;
+        *pad |= pad_names[i].mask;
+
+        names += len;
+        if (*names == '+')
+            names++;
+    }
+    return 0;
+}
+
+static int
+parse_axes (const char *str, int *axes)
+{
+    if (strcmp(str, "x") == 0)
+        *axes = GZM_EDIT_AXIS_X;
+    else if (strcmp(str, "y") == 0)
+        *axes = GZM_EDIT_AXIS_Y;
+    else if (strcmp(str, "xy") == 0)
+        *axes = GZM_EDIT_AXIS_X | GZM_EDIT_AXIS_Y;
+    else
+        return -1;
+    return 0;
+}
+
+static int
+parse_int (const char *str, int *v)
+{
+    char *end;
+    long l = strtol(str, &end, 0);
+
+    if (end == str || *end != '\0')
+        return -1;
+    *v = l;
+    return 0;
+}
+
+/*
+ * Parse an op written as name[:arg...][@start[-[end]]], ranges default to the whole macro:
+ *   clear:<buttons>          release buttons
+ *   press:<buttons>          press buttons
+ *   noreset                  release the reset signal
+ *   clamp:<axes>:<lo>:<hi>   clamp stick axes (x, y or xy)
+ *   scale:<axes>:<mul>/<div> scale stick axes
+ *   offset:<axes>:<add>      offset stick axes
+ *   stick:<axes>:<value>     set stick axes
+ *   shift:<delta>            move events in range by delta frames
+ *   start:<buttons>:<x>:<y>  set input_start
+ *   slice                    keep only the range
+ */
+int
+gzm_edit_parse (struct gzm_edit_op *op, const char *str)
+{
+    char buf[256];
+    char *args[4] = { NULL };
+    int n_args = 0;
+    char *range;
+    int ret = -1;
+
+    if (strlen(str) >= sizeof(buf))
+        return -1;
+    strcpy(buf, str);
+
+    memset(op, 0, sizeof(struct gzm_edit_op));
+    op->start = 0;
+    op->end = GZM_EDIT_END;
+    op->mul = 1;
+    op->div = 1;
+    op->lo = INT8_MIN;
+    op->hi = INT8_MAX;
+
+    // Range
+    range = strchr(buf, '@');
+    if (range != NULL)
+    {
+        char *end;
+
+        *range++ = '\0';
+        op->start = strtoul(range, &end, 0);
+        if (end == range)
+            return -1;
+        if (*end == '\0')
+            op->end = op->start + 1;
+        else if (*end == '-' && end[1] != '\0')
+        {
+            char *p = end + 1;
+            op->end = strtoul(p, &end, 0);
+            if (end == p || *end != '\0' || op->end <= op->start)
+                return -1;
+        }
+        else if (*end != '-' || end[1] != '\0')
+            return -1;
+    }
+
+    // Name and arguments
+    for (char *p = strchr(buf, ':'); p != NULL && n_args < 4; p = strchr(p, ':'))
+    {
+        *p++ = '\0';
+        args[n_args++] = p;
+    }
+
+    if (strcmp(buf, "clear") == 0 && n_args == 1)
+    {
+        op->kind = GZM_EDIT_PAD_CLEAR;
+        ret = gzm_pad_from_names(&op->mask, args[0]);
+    }
+    else if (strcmp(buf, "press") == 0 && n_args == 1)
+    {
+        op->kind = GZM_EDIT_PAD_SET;
+        ret = gzm_pad_from_names(&op->mask, args[0]);
+    }
+    else if (strcmp(buf, "noreset") == 0 && n_args == 0)
+    {
+        op->kind = GZM_EDIT_PAD_CLEAR;
+        op->mask = 1 << 7;
+        ret = 0;
+    }
+    else if (strcmp(buf, "clamp") == 0 && n_args == 3)
+    {
+        op->kind = GZM_EDIT_STICK;
+        ret = (parse_axes(args[0], &op->axes) || parse_int(args[1], &op->lo) || parse_int(args[2], &op->hi)) ? -1 : 0;
+        if (op->lo < INT8_MIN || op->hi > INT8_MAX || op->lo > op->hi)
+            ret = -1;
+    }
+    else if (strcmp(buf, "scale") == 0 && n_args == 2)
+    {
+        char *slash = strchr(args[1], '/');
+
+        op->kind = GZM_EDIT_STICK;
+        if (slash != NULL)
+            *slash++ = '\0';
+        ret = (parse_axes(args[0], &op->axes) || parse_int(args[1], &op->mul) ||
+               (slash != NULL && parse_int(slash, &op->div)) || op->div == 0) ? -1 : 0;
+    }
+    else if (strcmp(buf, "offset") == 0 && n_args == 2)
+    {
+        op->kind = GZM_EDIT_STICK;
+        ret = (parse_axes(args[0], &op->axes) || parse_int(args[1], &op->add)) ? -1 : 0;
+    }
+    else if (strcmp(buf, "stick") == 0 && n_args == 2)
+    {
+        op->kind = GZM_EDIT_STICK;
+        op->mul = 0;
+        ret = (parse_axes(args[0], &op->axes) || parse_int(args[1], &op->add)) ? -1 : 0;
+    }
+    else if (strcmp(buf, "shift") == 0 && n_args == 1)
+    {
+        int delta = 0;
+
+        op->kind = GZM_EDIT_SHIFT;
+        ret = parse_int(args[0], &delta);
+        op->delta = delta;
+    }
+    else if (strcmp(buf, "start") == 0 && n_args == 3)
+    {
+        int x = 0;
+        int y = 0;
+
+        op->kind = GZM_EDIT_INPUT_START;
+        ret = (gzm_pad_from_names(&op->input_start.pad, args[0]) || parse_int(args[1], &x) || parse_int(args[2], &y) ||
+               x < INT8_MIN || x > INT8_MAX || y < INT8_MIN || y > INT8_MAX) ? -1 : 0;
+        op->input_start.x = x;
+        op->input_start.y = y;
+    }
+    else if (strcmp(buf, "slice") == 0 && n_args == 0)
+    {
+        op->kind = GZM_EDIT_SLICE;
+        ret = 0;
+    }
+    return ret;
+}
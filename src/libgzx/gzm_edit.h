@@ -0,0 +1,50 @@
+#ifndef GZM_EDIT_H_
+#define GZM_EDIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gzm.h"
+
+#define GZM_EDIT_END UINT32_MAX // range end meaning "to the end of the macro"
+
+enum gzm_edit_kind
+{
+    GZM_EDIT_PAD_CLEAR,     // release the buttons in mask
+    GZM_EDIT_PAD_SET,       // press the buttons in mask
+    GZM_EDIT_STICK,         // v = clamp(v * mul / div + add, lo, hi) on the axes in axes
+    GZM_EDIT_SHIFT,         // add delta to the frame_idx of events in range, dropping any that leave the macro
+    GZM_EDIT_INPUT_START,   // replace input_start, range is ignored
+    GZM_EDIT_SLICE,         // keep only range, as gzm_slice, applied after everything else
+};
+
+#define GZM_EDIT_AXIS_X (1 << 0)
+#define GZM_EDIT_AXIS_Y (1 << 1)
+
+// One range-scoped operation, ranges are [start, end) frames as for gzm_slice
+struct gzm_edit_op
+{
+    int                      kind;
+    uint32_t                 start;
+    uint32_t                 end;
+    uint16_t                 mask;
+    int                      axes;
+    int                      mul;
+    int                      div;
+    int                      add;
+    int                      lo;
+    int                      hi;
+    int32_t                  delta;
+    z64_controller_t         input_start;
+};
+
+int
+gzm_edit (struct gz_macro *gzm, const struct gzm_edit_op *ops, size_t n_ops);
+
+int
+gzm_edit_parse (struct gzm_edit_op *op, const char *str);
+
+int
+gzm_pad_from_names (uint16_t *pad, const char *names);
+
+#endif
@@ -0,0 +1,537 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gzm_journal.h"
+#include "gzm_schema.h"
+#include "files.h"
+#include "hash.h"
+
+#define JOURNAL_MAGIC       "GZMJ"
+#define JOURNAL_VERSION     1
+#define JOURNAL_HEADER_SIZE (4 + 4 + 8 + 8)
+
+// Granularity of the input comparison, changed ranges are rounded out to this many frames
+#define JOURNAL_BLOCK       64
+
+enum journal_entry
+{
+    JOURNAL_RESIZE = 'R',   // u32 n_input
+    JOURNAL_INPUT  = 'I',   // u32 start, u32 count, count serialized inputs
+    JOURNAL_EVENTS = 'E',   // u32 size, serialized macro with no inputs
+    JOURNAL_COMMIT = 'C',   // u32 size of the entries since the previous commit
+};
+
+struct journal_buf
+{
+    uint8_t                 *data;
+    size_t                   size;
+    size_t                   cap;
+};
+
+static uint8_t *
+buf_reserve (struct journal_buf *buf, size_t size)
+{
+    if (buf->size + size > buf->cap)
+    {
+        size_t cap = (buf->cap != 0) ? buf->cap : 256;
+        while (cap < buf->size + size)
+            cap *= 2;
+        uint8_t *data = realloc(buf->data, cap);
+        if (data == NULL)
+            return NULL;
+        buf->data = data;
+        buf->cap = cap;
+    }
+    uint8_t *p = &buf->data[buf->size];
+    buf->size += size;
+    return p;
+}
+
+static void
+put32 (uint8_t *p, uint32_t v)
+{
+    v = __builtin_bswap32(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void
+put64 (uint8_t *p, uint64_t v)
+{
+    v = __builtin_bswap64(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint32_t
+get32 (const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap32(v);
+}
+
+static char *
+journal_path (const char *file_name)
+{
+    char *path = malloc(strlen(file_name) + sizeof(GZM_JOURNAL_EXT));
+    if (path != NULL)
+        sprintf(path, "%s" GZM_JOURNAL_EXT, file_name);
+    return path;
+}
+
+static void
+journal_header (uint8_t *p, const void *base, size_t base_size)
+{
+    memcpy(p, JOURNAL_MAGIC, 4);
+    put32(p + 4, JOURNAL_VERSION);
+    put64(p + 8, base_size);
+    put64(p + 16, hash64(base, base_size, 0));
+}
+
+bool
+gzm_journal_exists (const char *file_name)
+{
+    char *path = journal_path(file_name);
+    bool exists = (path != NULL && access(path, F_OK) == 0);
+
+    free(path);
+    return exists;
+}
+
+/* Remove the journal of `file_name`, if any. Used once the macro has been written out in full */
+int
+gzm_journal_discard (const char *file_name)
+{
+    char *path = journal_path(file_name);
+    int ret = 0;
+
+    if (path == NULL)
+        return -1;
+    if (unlink(path) != 0 && errno != ENOENT)
+        ret = -1;
+    free(path);
+    return ret;
+}
+
+/* Returns the end of the entry starting at `p`, or NULL if it is incomplete or unknown */
+static const uint8_t *
+journal_entry_end (const uint8_t *p, const uint8_t *end)
+{
+    size_t avail = end - p;
+
+    if (avail < 1 + sizeof(uint32_t))
+        return NULL;
+
+    switch (p[0])
+    {
+        case JOURNAL_RESIZE:
+        case JOURNAL_COMMIT:
+            return p + 1 + sizeof(uint32_t);
+        case JOURNAL_INPUT:
+        {
+            if (avail < 1 + 2 * sizeof(uint32_t))
+                return NULL;
+            uint64_t size = 1 + 2 * sizeof(uint32_t) + (uint64_t)get32(p + 5) * GZM_INPUT_SERIAL_SIZE;
+            return (size <= avail) ? p + size : NULL;
+        }
+        case JOURNAL_EVENTS:
+        {
+            uint64_t size = 1 + sizeof(uint32_t) + (uint64_t)get32(p + 1);
+            return (size <= avail) ? p + size : NULL;
+        }
+        default:
+            return NULL;
+    }
+}
+
+static int
+journal_resize (struct gz_macro *gzm, uint32_t n_input)
+{
+    struct movie_input *input = realloc(gzm->input, n_input * sizeof(struct movie_input));
+
+    if (input == NULL && n_input != 0)
+        return -1;
+    if (n_input > gzm->n_input)
+        memset(&input[gzm->n_input], 0, (n_input - gzm->n_input) * sizeof(struct movie_input));
+    gzm->input = input;
+    gzm->n_input = n_input;
+    return 0;
+}
+
+static int
+journal_apply (struct gz_macro *gzm, const uint8_t *p, const uint8_t *end)
+{
+    while (p < end)
+    {
+        const uint8_t *next = journal_entry_end(p, end);
+
+        switch (p[0])
+        {
+            case JOURNAL_RESIZE:
+                if (journal_resize(gzm, get32(p + 1)) != 0)
+                    return -1;
+                break;
+            case JOURNAL_INPUT:
+            {
+                uint32_t start = get32(p + 1);
+                uint32_t count = get32(p + 5);
+
+                if ((uint64_t)start + count > gzm->n_input)
+                    return -1;
+                gzm_decode_inputs(&gzm->input[start], p + 9, count);
+                break;
+            }
+            case JOURNAL_EVENTS:
+            {
+                struct gz_macro ev;
+
+                if (gzm_decode(&ev, p + 5, get32(p + 1)) != 0)
+                    return -1;
+                gzm_take_events(gzm, &ev);
+                break;
+            }
+        }
+        p = next;
+    }
+    return 0;
+}
+
+/* The end of the last complete save in the entries [p, end), torn or unknown entries after it are ignored */
+static const uint8_t *
+journal_committed_end (const uint8_t *p, const uint8_t *end)
+{
+    const uint8_t *txn = p;
+    const uint8_t *committed = p;
+
+    while (p < end)
+    {
+        const uint8_t *next = journal_entry_end(p, end);
+
+        if (next == NULL)
+            break;
+        if (p[0] == JOURNAL_COMMIT)
+        {
+            if (get32(p + 1) != p - txn)
+                break;
+            committed = next;
+            txn = next;
+        }
+        p = next;
+    }
+    return committed;
+}
+
+/* Apply the committed saves in the journal of `file_name` to `gzm`, which was decoded from `base` */
+int
+gzm_journal_replay (struct gz_macro *gzm, const char *file_name, const void *base, size_t base_size)
+{
+    char *path = journal_path(file_name);
+    size_t size;
+    uint8_t *data;
+    int ret = 0;
+
+    if (path == NULL)
+        return -1;
+    if (files_read_whole_file(path, true, (void **)&data, &size) != 0)
+    {
+        fprintf(stderr, "error: could not read journal '%s'\n", path);
+        free(path);
+        return -1;
+    }
+
+    uint8_t header[JOURNAL_HEADER_SIZE];
+    journal_header(header, base, base_size);
+
+    if (size < JOURNAL_HEADER_SIZE || memcmp(data, header, 8) != 0)
+    {
+        fprintf(stderr, "error: '%s' is not a gzm journal\n", path);
+        ret = -1;
+        goto end;
+    }
+    if (memcmp(data, header, JOURNAL_HEADER_SIZE) != 0)
+    {
+        // the base file was rewritten without the journal, it no longer applies
+        fprintf(stderr, "warning: ignoring stale journal '%s'\n", path);
+        goto end;
+    }
+
+    const uint8_t *committed = journal_committed_end(&data[JOURNAL_HEADER_SIZE], &data[size]);
+
+    if (journal_apply(gzm, &data[JOURNAL_HEADER_SIZE], committed) != 0)
+    {
+        fprintf(stderr, "error: journal '%s' does not match its macro\n", path);
+        ret = -1;
+    }
+end:
+    free(data);
+    free(path);
+    return ret;
+}
+
+/*
+ * Start journaling saves of `gzm` to `file_name`. `gzm` must be the macro as read from `file_name` by
+ * gzm_read; if the file does not exist yet it is written in full first.
+ */
+int
+gzm_journal_begin (struct gzm_journal *journal, const struct gz_macro *gzm, const char *file_name)
+{
+    uint8_t header[JOURNAL_HEADER_SIZE];
+    uint8_t current[JOURNAL_HEADER_SIZE];
+    size_t base_size;
+    uint8_t *base;
+    FILE *file;
+
+    memset(journal, 0, sizeof(struct gzm_journal));
+
+    if (access(file_name, F_OK) != 0 && gzm_write(gzm, file_name) != 0)
+        return -1;
+
+    journal->file_name = journal_path(file_name);
+    if (journal->file_name == NULL)
+        return -1;
+
+    if (files_read_whole_file(file_name, true, (void **)&base, &base_size) != 0)
+        goto fail;
+    journal_header(header, base, base_size);
+    free(base);
+
+    // Keep appending to the existing journal only if it belongs to the current base file
+    file = fopen(journal->file_name, "rb");
+    bool append = (file != NULL && fread(current, sizeof(current), 1, file) == 1 &&
+                   memcmp(current, header, sizeof(header)) == 0);
+    if (file != NULL)
+        fclose(file);
+
+    journal->file = fopen(journal->file_name, append ? "ab" : "wb");
+    if (journal->file == NULL)
+        goto fail;
+    if (!append && (fwrite(header, sizeof(header), 1, journal->file) != 1 || fflush(journal->file) != 0 ||
+                    fsync(fileno(journal->file)) != 0))
+        goto fail;
+
+    // A save torn by a crash would hide every save appended after it from replay
+    if (append)
+    {
+        size_t size;
+        uint8_t *data;
+
+        if (files_read_whole_file(journal->file_name, true, (void **)&data, &size) != 0)
+            goto fail;
+        off_t committed = journal_committed_end(&data[JOURNAL_HEADER_SIZE], &data[size]) - data;
+
+        free(data);
+        if (committed != size && ftruncate(fileno(journal->file), committed) != 0)
+            goto fail;
+    }
+
+    if (gzm_dup(&journal->saved, gzm) != 0)
+        goto fail;
+    return 0;
+fail:
+    gzm_journal_end(journal);
+    return -1;
+}
+
+static bool
+journal_events_equal (const struct gz_macro *a, const struct gz_macro *b)
+{
+    return a->input_start.pad == b->input_start.pad &&
+           a->input_start.x == b->input_start.x &&
+           a->input_start.y == b->input_start.y &&
+           a->rerecords == b->rerecords &&
+           a->last_recorded_frame == b->last_recorded_frame &&
+           a->n_seed == b->n_seed &&
+           a->n_oca_input == b->n_oca_input &&
+           a->n_oca_sync == b->n_oca_sync &&
+           a->n_room_load == b->n_room_load &&
+           (a->n_seed == 0 || memcmp(a->seed, b->seed, a->n_seed * sizeof(struct movie_seed)) == 0) &&
+           (a->n_oca_input == 0 || memcmp(a->oca_input, b->oca_input, a->n_oca_input * sizeof(struct movie_oca_input)) == 0) &&
+           (a->n_oca_sync == 0 || memcmp(a->oca_sync, b->oca_sync, a->n_oca_sync * sizeof(struct movie_oca_sync)) == 0) &&
+           (a->n_room_load == 0 || memcmp(a->room_load, b->room_load, a->n_room_load * sizeof(struct movie_room_load)) == 0);
+}
+
+static int
+journal_put_inputs (struct journal_buf *txn, const struct gz_macro *gzm, uint32_t start, uint32_t count)
+{
+    uint8_t *p = buf_reserve(txn, 1 + 2 * sizeof(uint32_t) + (size_t)count * GZM_INPUT_SERIAL_SIZE);
+
+    if (p == NULL)
+        return -1;
+    p[0] = JOURNAL_INPUT;
+    put32(p + 1, start);
+    put32(p + 5, count);
+    gzm_encode_inputs(p + 9, &gzm->input[start], count);
+    return 0;
+}
+
+static int
+write_full (int fd, const uint8_t *p, size_t size)
+{
+    while (size != 0)
+    {
+        ssize_t n = write(fd, p, size);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/*
+ * Append the differences between `gzm` and the last save as one committed save. The save is on disk when
+ * this returns 0; otherwise the journal is cut back to the previous save, which is still what the next save
+ * is compared to.
+ */
+int
+gzm_journal_save (struct gzm_journal *journal, const struct gz_macro *gzm)
+{
+    struct gz_macro *saved = &journal->saved;
+    struct journal_buf txn = { 0 };
+    uint32_t n_common = (gzm->n_input < saved->n_input) ? gzm->n_input : saved->n_input;
+    struct stat st;
+    uint8_t *p;
+    int ret = -1;
+
+    // a save that could be neither written nor cut back leaves the journal unusable
+    if (journal->file == NULL)
+        return -1;
+
+    // Input count
+    if (gzm->n_input != saved->n_input)
+    {
+        if ((p = buf_reserve(&txn, 1 + sizeof(uint32_t))) == NULL)
+            goto end;
+        p[0] = JOURNAL_RESIZE;
+        put32(p + 1, gzm->n_input);
+    }
+
+    // Changed runs of inputs
+    uint32_t i = 0;
+    while (i < n_common)
+    {
+        uint32_t start = i;
+
+        while (i < n_common)
+        {
+            uint32_t block = (n_common - i < JOURNAL_BLOCK) ? n_common - i : JOURNAL_BLOCK;
+
+            if (memcmp(&gzm->input[i], &saved->input[i], block * sizeof(struct movie_input)) == 0)
+                break;
+            i += block;
+        }
+        if (i != start && journal_put_inputs(&txn, gzm, start, i - start) != 0)
+            goto end;
+        if (i == start)
+            i += (n_common - i < JOURNAL_BLOCK) ? n_common - i : JOURNAL_BLOCK;
+    }
+
+    // Appended inputs
+    if (gzm->n_input > n_common && journal_put_inputs(&txn, gzm, n_common, gzm->n_input - n_common) != 0)
+        goto end;
+
+    // Events, stored whole as a macro without inputs since they are small
+    if (!journal_events_equal(gzm, saved))
+    {
+        struct gz_macro ev = *gzm;
+
+        ev.n_input = 0;
+        ev.input = NULL;
+
+        size_t size = GZM_SERIAL_SIZE(&ev);
+        if ((p = buf_reserve(&txn, 1 + sizeof(uint32_t) + size)) == NULL)
+            goto end;
+        p[0] = JOURNAL_EVENTS;
+        put32(p + 1, size);
+        gzm_encode(&ev, GZM_VERSION_LATEST, p + 5, size);
+    }
+
+    if (txn.size == 0)
+    {
+        ret = 0;
+        goto end;
+    }
+
+    size_t txn_size = txn.size;
+    if ((p = buf_reserve(&txn, 1 + sizeof(uint32_t))) == NULL)
+        goto end;
+    p[0] = JOURNAL_COMMIT;
+    put32(p + 1, txn_size);
+
+    // Written around stdio, whose buffer would keep the bytes of a failed write to retry them later
+    int fd = fileno(journal->file);
+    if (fstat(fd, &st) != 0)
+        goto end;
+    if (write_full(fd, txn.data, txn.size) != 0 || fsync(fd) != 0)
+    {
+        // a journal started anew is not opened for appending, so the offset goes back with the size
+        if (ftruncate(fd, st.st_size) != 0 || lseek(fd, st.st_size, SEEK_SET) < 0)
+        {
+            fclose(journal->file);
+            journal->file = NULL;
+        }
+        goto end;
+    }
+
+    // Only now does the last save include these changes, replayed as they will be from the journal
+    ret = 0;
+    if (journal_apply(saved, txn.data, &txn.data[txn_size]) != 0)
+    {
+        gzm_free(saved);
+        if (gzm_dup(saved, gzm) != 0)
+        {
+            fclose(journal->file);
+            journal->file = NULL;
+            ret = -1;
+        }
+    }
+end:
+    free(txn.data);
+    return ret;
+}
+
+int
+gzm_journal_end (struct gzm_journal *journal)
+{
+    int ret = 0;
+
+    if (journal->file != NULL && fclose(journal->file) != 0)
+        ret = -1;
+    free(journal->file_name);
+    gzm_free(&journal->saved);
+    memset(journal, 0, sizeof(struct gzm_journal));
+    return ret;
+}
+
+/* Fold the journal of `file_name` back into a plain .gzm */
+int
+gzm_journal_compact (const char *file_name)
+{
+    struct gz_macro gzm;
+    char *tmp_name;
+    int ret = -1;
+
+    if (gzm_read(&gzm, file_name) != 0)
+        goto end;
+
+    tmp_name = malloc(strlen(file_name) + sizeof(".tmp"));
+    if (tmp_name == NULL)
+        goto end;
+    sprintf(tmp_name, "%s.tmp", file_name);
+
+    if (gzm_write(&gzm, tmp_name) == 0 && rename(tmp_name, file_name) == 0)
+        ret = gzm_journal_discard(file_name);
+    else
+        remove(tmp_name);
+    free(tmp_name);
+end:
+    gzm_free(&gzm);
+    return ret;
+}
@@ -0,0 +1,49 @@
+#ifndef GZM_JOURNAL_H_
+#define GZM_JOURNAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gzm.h"
+
+/*
+ * Append-only journal sidecar (<file>.gzj) for incremental saves.
+ *
+ * Each save appends only the changed input ranges, the new input count if it changed and the
+ * event sections if they changed, followed by a commit marker. gzm_read replays committed saves
+ * on top of the base file; a torn final save is ignored. The journal records the size and hash
+ * of the base file it applies to, so it is never replayed over a file that was rewritten since.
+ */
+
+#define GZM_JOURNAL_EXT ".gzj"
+
+struct gzm_journal
+{
+    char                    *file_name;         // journal sidecar path
+    FILE                    *file;
+    struct gz_macro          saved;             // state as of the last save
+};
+
+bool
+gzm_journal_exists (const char *file_name);
+
+int
+gzm_journal_discard (const char *file_name);
+
+int
+gzm_journal_replay (struct gz_macro *gzm, const char *file_name, const void *base, size_t base_size);
+
+int
+gzm_journal_begin (struct gzm_journal *journal, const struct gz_macro *gzm, const char *file_name);
+
+int
+gzm_journal_save (struct gzm_journal *journal, const struct gz_macro *gzm);
+
+int
+gzm_journal_end (struct gzm_journal *journal);
+
+int
+gzm_journal_compact (const char *file_name);
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gzm_m64.h"
+#include "gzm_stream.h"
+
+#define M64_BATCH 8192 // samples converted at a time
+
+// Header fields, little-endian
+#define M64_OFF_VERSION         0x004
+#define M64_OFF_VI_COUNT        0x00C
+#define M64_OFF_RERECORDS       0x010
+#define M64_OFF_VI_PER_SECOND   0x014
+#define M64_OFF_N_CONTROLLERS   0x015
+#define M64_OFF_N_SAMPLES       0x018
+#define M64_OFF_START_TYPE      0x01C
+#define M64_OFF_CONTROLLERS     0x020
+
+#define M64_START_POWER_ON      2
+
+static void
+put_le32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t
+get_le32 (const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void
+m64_header (uint8_t *hdr, uint32_t n_samples, uint32_t rerecords)
+{
+    memset(hdr, 0, GZM_M64_HEADER_SIZE);
+    memcpy(hdr, "M64\x1A", 4);
+    put_le32(&hdr[M64_OFF_VERSION], GZM_M64_VERSION);
+    put_le32(&hdr[M64_OFF_VI_COUNT], n_samples);
+    put_le32(&hdr[M64_OFF_RERECORDS], rerecords);
+    hdr[M64_OFF_VI_PER_SECOND] = 60;
+    hdr[M64_OFF_N_CONTROLLERS] = 1;
+    put_le32(&hdr[M64_OFF_N_SAMPLES], n_samples);
+    hdr[M64_OFF_START_TYPE] = M64_START_POWER_ON;
+    put_le32(&hdr[M64_OFF_CONTROLLERS], 1);
+}
+
+struct m64_export
+{
+    struct gz_macro         *gzm;
+    FILE                    *file;
+    bool                     header;
+    bool                     error;
+    uint8_t                  buf[M64_BATCH * GZM_M64_SAMPLE_SIZE];
+};
+
+static void
+export_header (struct m64_export *ex)
+{
+    uint8_t hdr[GZM_M64_HEADER_SIZE];
+
+    m64_header(hdr, ex->gzm->n_input, 0);
+    if (fwrite(hdr, sizeof(hdr), 1, ex->file) != 1)
+        ex->error = true;
+    ex->header = true;
+}
+
+// Inputs are converted as the decoder produces them and never kept
+static void
+export_sink (void *arg, uint32_t frame, const struct movie_input *input, size_t n)
+{
+    struct m64_export *ex = arg;
+
+    if (!ex->header)
+        export_header(ex);
+    if (ex->error)
+        return;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        uint8_t *s = &ex->buf[i * GZM_M64_SAMPLE_SIZE];
+
+        s[0] = input[i].raw.pad >> 8;
+        s[1] = input[i].raw.pad & 0xFF;
+        s[2] = input[i].raw.x;
+        s[3] = input[i].raw.y;
+    }
+    if (fwrite(ex->buf, GZM_M64_SAMPLE_SIZE, n, ex->file) != n)
+        ex->error = true;
+}
+
+/*
+ * Convert a serialized macro to an .m64 movie. Memory use is constant, inputs are converted as they are read.
+ * The rerecord count is only known at the end of the macro, it is filled in if the output can seek.
+ */
+int
+gzm_m64_export (FILE *gzm_file, FILE *m64_file)
+{
+    struct gz_macro gzm;
+    struct m64_export *ex = malloc(sizeof(struct m64_export));
+    int ret;
+
+    if (ex == NULL)
+        return -1;
+    ex->gzm = &gzm;
+    ex->file = m64_file;
+    ex->header = false;
+    ex->error = false;
+
+    ret = gzm_stream_read(&gzm, gzm_file, export_sink, ex);
+    if (!ex->header)
+        export_header(ex);
+    if (ex->error)
+        ret = -1;
+
+    if (ret == 0 && gzm.rerecords != 0 && fseek(m64_file, M64_OFF_RERECORDS, SEEK_SET) == 0)
+    {
+        uint8_t v[4];
+
+        put_le32(v, gzm.rerecords);
+        if (fwrite(v, sizeof(v), 1, m64_file) != 1 || fseek(m64_file, 0, SEEK_END) != 0)
+            ret = -1;
+    }
+    if (fflush(m64_file) != 0)
+        ret = -1;
+
+    gzm_free(&gzm);
+    free(ex);
+    return ret;
+}
+
+struct m64_import
+{
+    FILE                    *file;
+    uint32_t                 n_controllers;
+    uint16_t                 prev;
+    bool                     error;
+    uint8_t                 *buf;
+};
+
+// Samples are read as the encoder asks for inputs
+static void
+import_source (void *arg, uint32_t frame, struct movie_input *input, size_t n)
+{
+    struct m64_import *im = arg;
+    size_t stride = GZM_M64_SAMPLE_SIZE * im->n_controllers;
+
+    if (im->error || fread(im->buf, stride, n, im->file) != n)
+    {
+        im->error = true;
+        memset(im->buf, 0, stride * n);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        const uint8_t *s = &im->buf[i * stride];
+        uint16_t pad = (s[0] << 8) | s[1];
+
+        input[i].raw.pad = pad;
+        input[i].raw.x = s[2];
+        input[i].raw.y = s[3];
+        input[i].pad_delta = PAD_DELTA(im->prev, pad);
+        im->prev = pad;
+    }
+}
+
+/*
+ * Convert an .m64 movie to a serialized macro, recomputing pad_delta. Memory use is constant. The movie has
+ * no seeds or other events, and starts from no input.
+ */
+int
+gzm_m64_import (FILE *m64_file, FILE *gzm_file)
+{
+    uint8_t hdr[GZM_M64_HEADER_SIZE];
+    struct m64_import im = { .file = m64_file };
+    struct gz_macro gzm;
+    int ret;
+
+    if (fread(hdr, sizeof(hdr), 1, m64_file) != 1 || memcmp(hdr, "M64\x1A", 4) != 0)
+        return -1;
+    im.n_controllers = hdr[M64_OFF_N_CONTROLLERS];
+    if (im.n_controllers == 0)
+        im.n_controllers = 1;
+    im.buf = malloc(M64_BATCH * GZM_M64_SAMPLE_SIZE * im.n_controllers);
+    if (im.buf == NULL)
+        return -1;
+
+    gzm_new(&gzm);
+    gzm.n_input = get_le32(&hdr[M64_OFF_N_SAMPLES]);
+    gzm.rerecords = get_le32(&hdr[M64_OFF_RERECORDS]);
+
+    ret = gzm_stream_write_inputs(&gzm, GZM_VERSION_LATEST, gzm_file, import_source, &im);
+    if (im.error)
+        ret = -1;
+    free(im.buf);
+    return ret;
+}
@@ -0,0 +1,23 @@
+#ifndef GZM_M64_H_
+#define GZM_M64_H_
+
+#include <stdio.h>
+
+#include "gzm.h"
+
+#define GZM_M64_HEADER_SIZE 0x400
+#define GZM_M64_VERSION     3
+
+/*
+ * Each controller sample of an .m64 is 4 bytes: the buttons, with the same bit order as the high and low
+ * bytes of a pad, then the stick x and y. Only the first controller is used.
+ */
+#define GZM_M64_SAMPLE_SIZE 4
+
+int
+gzm_m64_export (FILE *gzm_file, FILE *m64_file);
+
+int
+gzm_m64_import (FILE *m64_file, FILE *gzm_file);
+
+#endif
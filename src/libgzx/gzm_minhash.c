@@ -0,0 +1,97 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gzm_minhash.h"
+#include "hash.h"
+
+#define SHINGLE_MUL 0x100000001B3ull
+
+/*
+ * The K hash functions are h * a[k] + b[k] over 32-bit shingle hashes, with odd a[k] so that each is a
+ * permutation. Derived from fixed seeds, so signatures stay comparable between runs.
+ */
+static uint32_t minhash_a[GZM_MINHASH_K];
+static uint32_t minhash_b[GZM_MINHASH_K];
+static pthread_once_t minhash_once = PTHREAD_ONCE_INIT;
+
+static void
+minhash_init (void)
+{
+    for (int k = 0; k < GZM_MINHASH_K; k++)
+    {
+        uint64_t r = hash_mix(k + 1);
+        minhash_b[k] = r >> 32;
+        minhash_a[k] = (uint32_t)r | 1;
+    }
+}
+
+static inline uint32_t
+input_word (const struct movie_input *in)
+{
+    return ((uint32_t)in->raw.pad << 16) | ((uint32_t)(uint8_t)in->raw.x << 8) | (uint8_t)in->raw.y;
+}
+
+/* One shingle into all K minimums, written so that the loop over k vectorizes */
+__attribute__((target_clones("avx2", "default")))
+static void
+minhash_update (uint32_t *restrict min, const uint32_t *restrict a, const uint32_t *restrict b, uint32_t h)
+{
+    for (int k = 0; k < GZM_MINHASH_K; k++)
+    {
+        uint32_t v = h * a[k] + b[k];
+        min[k] = (v < min[k]) ? v : min[k];
+    }
+}
+
+/*
+ * Shingles are windows of GZM_MINHASH_SHINGLE consecutive inputs (buttons and stick), hashed with a rolling
+ * polynomial hash so each frame costs O(1) to hash. Runs of identical shingles, as when an input is held,
+ * only update the minimums once.
+ */
+void
+gzm_minhash (struct gzm_signature *sig, const struct gz_macro *gzm)
+{
+    const uint32_t w = GZM_MINHASH_SHINGLE;
+    uint64_t pow = 1;
+    uint64_t roll = 0;
+    uint32_t prev = 0;
+
+    pthread_once(&minhash_once, minhash_init);
+    memset(sig->min, 0xFF, sizeof(sig->min));
+    if (gzm->n_input == 0)
+        return;
+
+    for (uint32_t i = 1; i < w; i++)
+        pow *= SHINGLE_MUL;
+
+    // macros shorter than a shingle are a single shingle
+    uint32_t first = (gzm->n_input < w) ? gzm->n_input : w;
+    for (uint32_t i = 0; i < first; i++)
+        roll = roll * SHINGLE_MUL + input_word(&gzm->input[i]);
+
+    for (uint32_t i = first; ; i++)
+    {
+        uint64_t m = hash_mix(roll);
+        uint32_t h = (uint32_t)(m ^ (m >> 32));
+
+        if (i == first || h != prev)
+            minhash_update(sig->min, minhash_a, minhash_b, h);
+        prev = h;
+
+        if (i == gzm->n_input)
+            break;
+        roll = (roll - input_word(&gzm->input[i - w]) * pow) * SHINGLE_MUL + input_word(&gzm->input[i]);
+    }
+}
+
+/* Estimated Jaccard similarity of the two shingle sets */
+double
+gzm_minhash_similarity (const struct gzm_signature *a, const struct gzm_signature *b)
+{
+    int n = 0;
+
+    for (int k = 0; k < GZM_MINHASH_K; k++)
+        n += (a->min[k] == b->min[k]);
+    return (double)n / GZM_MINHASH_K;
+}
@@ -0,0 +1,23 @@
+#ifndef GZM_MINHASH_H_
+#define GZM_MINHASH_H_
+
+#include <stdint.h>
+
+#include "gzm.h"
+
+#define GZM_MINHASH_K       128     // hash functions per signature
+#define GZM_MINHASH_SHINGLE 8       // consecutive inputs per shingle
+
+// MinHash signature of the set of input shingles of a macro, comparable across macros
+struct gzm_signature
+{
+    uint32_t                 min[GZM_MINHASH_K];
+};
+
+void
+gzm_minhash (struct gzm_signature *sig, const struct gz_macro *gzm);
+
+double
+gzm_minhash_similarity (const struct gzm_signature *a, const struct gzm_signature *b);
+
+#endif
@@ -0,0 +1,120 @@
+#include <pthread.h>
+#include <stdint.h>
+
+#include "gzm_rng.h"
+
+// Baby steps of the index search, the seeds 0 .. BABY_STEPS - 1 steps after seed 0. 24 MiB with the filter,
+// only touched once an index is looked up
+#define BABY_BITS   20
+#define BABY_STEPS  (1u << BABY_BITS)
+#define BABY_SLOTS  (BABY_STEPS * 2)
+
+// Open addressing table, seed and step side by side so a probe touches one cache line
+static struct
+{
+    uint32_t                 seed;
+    uint32_t                 step;              // step + 1, 0 for an empty slot
+} baby[BABY_SLOTS];
+
+// One bit per hash of a baby step seed, so most giant steps are rejected with a single predictable test
+#define FILTER_BITS 26
+static uint64_t filter[(1u << FILTER_BITS) / 64];
+
+static struct gzm_rng_jump giant_back;          // BABY_STEPS steps backwards
+static pthread_once_t baby_once = PTHREAD_ONCE_INIT;
+
+static inline uint32_t
+baby_slot (uint32_t seed)
+{
+    return (seed * 0x9E3779B1u) >> (32 - (BABY_BITS + 1));
+}
+
+static inline uint32_t
+filter_bit (uint32_t seed)
+{
+    return (seed * 0x85EBCA6Bu) >> (32 - FILTER_BITS);
+}
+
+static void
+baby_init (void)
+{
+    uint32_t seed = 0;
+
+    for (uint32_t i = 0; i < BABY_STEPS; i++)
+    {
+        uint32_t slot = baby_slot(seed);
+
+        while (baby[slot].step != 0)
+            slot = (slot + 1) & (BABY_SLOTS - 1);
+        baby[slot].seed = seed;
+        baby[slot].step = i + 1;
+        filter[filter_bit(seed) / 64] |= 1ull << (filter_bit(seed) % 64);
+        seed = gzm_rng_next(seed);
+    }
+    // the period is 2^32, so going back n steps is going forward 2^32 - n
+    giant_back = gzm_rng_jump(0u - BABY_STEPS);
+}
+
+static inline struct gzm_rng_jump
+jump_compose (struct gzm_rng_jump first, struct gzm_rng_jump second)
+{
+    struct gzm_rng_jump j = { first.mul * second.mul, first.add * second.mul + second.add };
+    return j;
+}
+
+/* The map for n steps of the generator, by repeated squaring of a single step */
+struct gzm_rng_jump
+gzm_rng_jump (uint32_t n)
+{
+    struct gzm_rng_jump j = { 1, 0 };
+    struct gzm_rng_jump step = { GZM_RNG_MUL, GZM_RNG_ADD };
+
+    for (; n != 0; n >>= 1)
+    {
+        if (n & 1)
+            j = jump_compose(j, step);
+        step = jump_compose(step, step);
+    }
+    return j;
+}
+
+uint32_t
+gzm_rng_advance (uint32_t seed, uint32_t n)
+{
+    struct gzm_rng_jump j = gzm_rng_jump(n);
+    return seed * j.mul + j.add;
+}
+
+/*
+ * Number of steps from seed 0 to `seed`. Baby-step giant-step: step back BABY_STEPS at a time until landing on
+ * one of the first BABY_STEPS seeds of the sequence, at most 2^32 / BABY_STEPS lookups.
+ */
+uint32_t
+gzm_rng_index (uint32_t seed)
+{
+    pthread_once(&baby_once, baby_init);
+
+    for (uint32_t giant = 0; ; giant++)
+    {
+        uint32_t bit = filter_bit(seed);
+
+        if (!(filter[bit / 64] & (1ull << (bit % 64))))
+        {
+            seed = seed * giant_back.mul + giant_back.add;
+            continue;
+        }
+        for (uint32_t slot = baby_slot(seed); baby[slot].step != 0; slot = (slot + 1) & (BABY_SLOTS - 1))
+        {
+            if (baby[slot].seed == seed)
+                return giant * BABY_STEPS + (baby[slot].step - 1);
+        }
+        seed = seed * giant_back.mul + giant_back.add;
+    }
+}
+
+/* Number of steps from one seed to another, every seed reaches every other within the period */
+uint32_t
+gzm_rng_distance (uint32_t from, uint32_t to)
+{
+    return gzm_rng_index(to) - gzm_rng_index(from);
+}
@@ -0,0 +1,35 @@
+#ifndef GZM_RNG_H_
+#define GZM_RNG_H_
+
+#include <stdint.h>
+
+// The game's random number generator, a 32-bit LCG with full period
+#define GZM_RNG_MUL 1664525u
+#define GZM_RNG_ADD 1013904223u
+
+// Any number of steps of the generator is itself an affine map, seed * mul + add
+struct gzm_rng_jump
+{
+    uint32_t                 mul;
+    uint32_t                 add;
+};
+
+static inline uint32_t
+gzm_rng_next (uint32_t seed)
+{
+    return seed * GZM_RNG_MUL + GZM_RNG_ADD;
+}
+
+struct gzm_rng_jump
+gzm_rng_jump (uint32_t n);
+
+uint32_t
+gzm_rng_advance (uint32_t seed, uint32_t n);
+
+uint32_t
+gzm_rng_index (uint32_t seed);
+
+uint32_t
+gzm_rng_distance (uint32_t from, uint32_t to);
+
+#endif
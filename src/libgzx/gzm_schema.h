@@ -0,0 +1,199 @@
+#ifndef GZM_SCHEMA_H_
+#define GZM_SCHEMA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gzm.h"
+
+/*
+ * Description of the .gzm serial format, used to generate the size computation,
+ * decoders, encoders and version detection in gzm.c.
+ *
+ * All fields are stored big-endian, packed, in the order listed here.
+ *
+ * Record types list their fields as FIELD(type, field).
+ */
+
+#define GZM_CONTROLLER_FIELDS(FIELD, T)         \
+    FIELD(T, pad)                               \
+    FIELD(T, x)                                 \
+    FIELD(T, y)
+
+#define GZM_MOVIE_INPUT_FIELDS(FIELD, T)        \
+    FIELD(T, raw.pad)                           \
+    FIELD(T, raw.x)                             \
+    FIELD(T, raw.y)                             \
+    FIELD(T, pad_delta)
+
+#define GZM_MOVIE_SEED_FIELDS(FIELD, T)         \
+    FIELD(T, frame_idx)                         \
+    FIELD(T, old_seed)                          \
+    FIELD(T, new_seed)
+
+#define GZM_MOVIE_OCA_INPUT_FIELDS(FIELD, T)    \
+    FIELD(T, frame_idx)                         \
+    FIELD(T, pad)                               \
+    FIELD(T, adjusted_x)                        \
+    FIELD(T, adjusted_y)
+
+#define GZM_MOVIE_OCA_SYNC_FIELDS(FIELD, T)     \
+    FIELD(T, frame_idx)                         \
+    FIELD(T, audio_frames)
+
+#define GZM_MOVIE_ROOM_LOAD_FIELDS(FIELD, T)    \
+    FIELD(T, frame_idx)
+
+/*
+ * The macro file itself:
+ *   SCALAR(field)                       a single field of struct gz_macro
+ *   ARRAY(name, count, type, FIELDS)    gzm->name[0 .. gzm->count] of records
+ *   VERSION(v)                          everything that follows only exists from version v
+ *
+ * New versions of the format are added by appending a VERSION marker followed by the new fields.
+ */
+#define GZM_SCHEMA(SCALAR, ARRAY, VERSION)                                          \
+    SCALAR(n_input)                                                                 \
+    SCALAR(n_seed)                                                                  \
+    SCALAR(input_start.pad)                                                         \
+    SCALAR(input_start.x)                                                           \
+    SCALAR(input_start.y)                                                           \
+    ARRAY(input,     n_input,     struct movie_input,     GZM_MOVIE_INPUT_FIELDS)     \
+    ARRAY(seed,      n_seed,      struct movie_seed,      GZM_MOVIE_SEED_FIELDS)      \
+    VERSION(GZM_VERSION_OCA)                                                        \
+    SCALAR(n_oca_input)                                                             \
+    SCALAR(n_oca_sync)                                                              \
+    SCALAR(n_room_load)                                                             \
+    ARRAY(oca_input, n_oca_input, struct movie_oca_input, GZM_MOVIE_OCA_INPUT_FIELDS) \
+    ARRAY(oca_sync,  n_oca_sync,  struct movie_oca_sync,  GZM_MOVIE_OCA_SYNC_FIELDS)  \
+    ARRAY(room_load, n_room_load, struct movie_room_load, GZM_MOVIE_ROOM_LOAD_FIELDS) \
+    VERSION(GZM_VERSION_RERECORDS)                                                  \
+    SCALAR(rerecords)                                                               \
+    SCALAR(last_recorded_frame)
+
+// Helpers for expanding the above
+
+#define GZM_SCHEMA_IGNORE(...)
+
+#define GZM_FIELD_SERIAL_SIZE(type, field) + sizeof(((type *)0)->field)
+
+// Serialized size of one record, this is a constant expression
+#define GZM_RECORD_SERIAL_SIZE(type, FIELDS) (0 FIELDS(GZM_FIELD_SERIAL_SIZE, type))
+
+/*
+ * The serial layout as a struct of byte arrays, one per scalar and a one byte marker per array, so that the
+ * offset of an array's marker is where that array starts in a file with no records before it
+ */
+#define GZM_LAYOUT_CAT_(a, b) a##b
+#define GZM_LAYOUT_CAT(a, b) GZM_LAYOUT_CAT_(a, b)
+#define GZM_LAYOUT_SCALAR(field) uint8_t GZM_LAYOUT_CAT(scalar_, __COUNTER__)[sizeof(((struct gz_macro *)0)->field)];
+#define GZM_LAYOUT_ARRAY(name, count, type, FIELDS) uint8_t name[1];
+
+struct gzm_serial_layout
+{
+    GZM_SCHEMA(GZM_LAYOUT_SCALAR, GZM_LAYOUT_ARRAY, GZM_SCHEMA_IGNORE)
+};
+
+// The scalars up to the inputs (n_input, n_seed and input_start), then the size of one input
+#define GZM_HEADER_SERIAL_SIZE offsetof(struct gzm_serial_layout, input)
+#define GZM_INPUT_SERIAL_SIZE GZM_RECORD_SERIAL_SIZE(struct movie_input, GZM_MOVIE_INPUT_FIELDS)
+
+// Big-endian loads and stores of single fields
+
+static inline const uint8_t *
+serial_load (void *dst, size_t size, const uint8_t *p)
+{
+    switch (size)
+    {
+        case sizeof(uint32_t):
+        {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            v = __builtin_bswap32(v);
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case sizeof(uint16_t):
+        {
+            uint16_t v;
+            memcpy(&v, p, sizeof(v));
+            v = __builtin_bswap16(v);
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case sizeof(uint8_t):
+            *(uint8_t *)dst = *p;
+            break;
+        default:
+            fprintf(stderr, "Bad size: %lu\n", size);
+            exit(EXIT_FAILURE);
+    }
+    return p + size;
+}
+
+static inline uint8_t *
+serial_store (uint8_t *p, const void *src, size_t size)
+{
+    switch (size)
+    {
+        case sizeof(uint32_t):
+        {
+            uint32_t v;
+            memcpy(&v, src, sizeof(v));
+            v = __builtin_bswap32(v);
+            memcpy(p, &v, sizeof(v));
+            break;
+        }
+        case sizeof(uint16_t):
+        {
+            uint16_t v;
+            memcpy(&v, src, sizeof(v));
+            v = __builtin_bswap16(v);
+            memcpy(p, &v, sizeof(v));
+            break;
+        }
+        case sizeof(uint8_t):
+            *p = *(const uint8_t *)src;
+            break;
+        default:
+            fprintf(stderr, "Bad size: %lu\n", size);
+            exit(EXIT_FAILURE);
+    }
+    return p + size;
+}
+
+/*
+ * Generate a decode_<name> and encode_<name> loop for a record array of the schema, expand with
+ * GZM_SCHEMA(GZM_SCHEMA_IGNORE, GZM_ARRAY_CODEC, GZM_SCHEMA_IGNORE). Sizes are constant per field so the
+ * loads and stores reduce to fixed-size byte swaps with no bounds checks, the callers validate the total
+ * size up front.
+ */
+
+#define GZM_FIELD_DECODE(type, field) p = serial_load(&rec->field, sizeof(rec->field), p);
+#define GZM_FIELD_ENCODE(type, field) p = serial_store(p, &rec->field, sizeof(rec->field));
+
+#define GZM_ARRAY_CODEC(name, count, type, FIELDS)              \
+    static inline const uint8_t *                               \
+    decode_##name (type *dst, size_t n, const uint8_t *p)       \
+    {                                                           \
+        for (type *rec = dst; rec < &dst[n]; rec++)             \
+        {                                                       \
+            FIELDS(GZM_FIELD_DECODE, type)                      \
+        }                                                       \
+        return p;                                               \
+    }                                                           \
+                                                                \
+    static inline uint8_t *                                     \
+    encode_##name (uint8_t *p, const type *src, size_t n)       \
+    {                                                           \
+        for (const type *rec = src; rec < &src[n]; rec++)       \
+        {                                                       \
+            FIELDS(GZM_FIELD_ENCODE, type)                      \
+        }                                                       \
+        return p;                                               \
+    }
+
+#endif
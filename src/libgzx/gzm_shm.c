@@ -0,0 +1,307 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gzm_shm.h"
+
+#define ALIGN(x) (((x) + 7) & ~(uint64_t)7)
+
+// How long a reader waits for a republish to finish before giving up with EAGAIN
+#define MAX_WAIT_NS 1000000000ll
+
+struct array_desc
+{
+    size_t                   count_offset;
+    size_t                   array_offset;
+    uint32_t                 record_size;
+};
+
+// Where each array of the segment lives in struct gz_macro
+static const struct array_desc arrays[GZM_SHM_ARRAYS] =
+{
+    [GZM_SHM_INPUT]     = { offsetof(struct gz_macro, n_input),     offsetof(struct gz_macro, input),     sizeof(struct movie_input) },
+    [GZM_SHM_SEED]      = { offsetof(struct gz_macro, n_seed),      offsetof(struct gz_macro, seed),      sizeof(struct movie_seed) },
+    [GZM_SHM_OCA_INPUT] = { offsetof(struct gz_macro, n_oca_input), offsetof(struct gz_macro, oca_input), sizeof(struct movie_oca_input) },
+    [GZM_SHM_OCA_SYNC]  = { offsetof(struct gz_macro, n_oca_sync),  offsetof(struct gz_macro, oca_sync),  sizeof(struct movie_oca_sync) },
+    [GZM_SHM_ROOM_LOAD] = { offsetof(struct gz_macro, n_room_load), offsetof(struct gz_macro, room_load), sizeof(struct movie_room_load) },
+};
+
+#define ARRAY_COUNT(gzm, a) (*(uint32_t *)((uint8_t *)(gzm) + arrays[a].count_offset))
+#define ARRAY_DATA(gzm, a) (*(void **)((uint8_t *)(gzm) + arrays[a].array_offset))
+
+static int
+shm_map (struct gzm_shm *shm, size_t size)
+{
+    void *map = mmap(NULL, size, shm->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, shm->fd, 0);
+
+    if (map == MAP_FAILED)
+        return -1;
+    if (shm->hdr != NULL)
+    {
+        struct gzm_shm_map *retired = realloc(shm->retired, (shm->n_retired + 1) * sizeof(struct gzm_shm_map));
+
+        if (retired == NULL)
+        {
+            munmap(map, size);
+            return -1;
+        }
+        retired[shm->n_retired].addr = shm->hdr;
+        retired[shm->n_retired].size = shm->map_size;
+        shm->retired = retired;
+        shm->n_retired++;
+    }
+    shm->hdr = map;
+    shm->map_size = size;
+    return 0;
+}
+
+/* Open or create the segment `name` (as for shm_open, "/name") to publish a macro in */
+int
+gzm_shm_create (struct gzm_shm *shm, const char *name)
+{
+    struct stat st;
+
+    memset(shm, 0, sizeof(struct gzm_shm));
+    shm->writable = 1;
+    shm->fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (shm->fd < 0)
+        return -1;
+
+    // an existing segment is reused so its readers see the next generation
+    if (fstat(shm->fd, &st) != 0 || (st.st_size >= sizeof(struct gzm_shm_header) && shm_map(shm, st.st_size) != 0))
+    {
+        close(shm->fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* Copy `gzm` into the segment, replacing what was published before */
+int
+gzm_shm_publish (struct gzm_shm *shm, const struct gz_macro *gzm)
+{
+    uint64_t offset[GZM_SHM_ARRAYS];
+    uint64_t size = ALIGN(sizeof(struct gzm_shm_header));
+    uint32_t generation = 0;
+
+    for (int a = 0; a < GZM_SHM_ARRAYS; a++)
+    {
+        offset[a] = size;
+        size = ALIGN(size + (uint64_t)ARRAY_COUNT(gzm, a) * arrays[a].record_size);
+    }
+
+    if (shm->hdr != NULL && shm->hdr->magic == GZM_SHM_MAGIC)
+    {
+        generation = shm->hdr->generation;
+        // left odd by a publisher that died mid-way
+        if (generation & 1)
+            generation++;
+    }
+
+    // grow with room for edits, never shrink as readers may still have the end mapped
+    if (size > shm->map_size)
+    {
+        size_t capacity = size + size / 4;
+
+        if (ftruncate(shm->fd, capacity) != 0 || shm_map(shm, capacity) != 0)
+            return -1;
+    }
+
+    struct gzm_shm_header *hdr = shm->hdr;
+    uint8_t *base = (uint8_t *)hdr;
+
+    __atomic_store_n(&hdr->generation, generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    hdr->magic = GZM_SHM_MAGIC;
+    hdr->format = GZM_SHM_FORMAT;
+    hdr->header_size = sizeof(struct gzm_shm_header);
+    hdr->capacity = shm->map_size;
+    hdr->size = size;
+    hdr->input_start = gzm->input_start;
+    hdr->rerecords = gzm->rerecords;
+    hdr->last_recorded_frame = gzm->last_recorded_frame;
+    hdr->n_arrays = GZM_SHM_ARRAYS;
+    for (int a = 0; a < GZM_SHM_ARRAYS; a++)
+    {
+        uint32_t count = ARRAY_COUNT(gzm, a);
+
+        hdr->array[a].offset = offset[a];
+        hdr->array[a].count = count;
+        hdr->array[a].record_size = arrays[a].record_size;
+        if (count != 0)
+            memcpy(&base[offset[a]], ARRAY_DATA(gzm, a), (size_t)count * arrays[a].record_size);
+    }
+
+    __atomic_store_n(&hdr->generation, generation + 2, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int
+gzm_shm_remove (const char *name)
+{
+    return shm_unlink(name);
+}
+
+/* Map the segment `name` read-only */
+int
+gzm_shm_open (struct gzm_shm *shm, const char *name)
+{
+    struct stat st;
+
+    memset(shm, 0, sizeof(struct gzm_shm));
+    shm->fd = shm_open(name, O_RDONLY, 0);
+    if (shm->fd < 0)
+        return -1;
+
+    if (fstat(shm->fd, &st) != 0)
+    {
+        close(shm->fd);
+        return -1;
+    }
+    if (st.st_size < sizeof(struct gzm_shm_header))
+    {
+        // nothing published yet
+        close(shm->fd);
+        errno = ENODATA;
+        return -1;
+    }
+    if (shm_map(shm, st.st_size) != 0)
+    {
+        close(shm->fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* The current generation, to compare with the one of an earlier view without mapping anything */
+uint32_t
+gzm_shm_generation (const struct gzm_shm *shm)
+{
+    return __atomic_load_n(&shm->hdr->generation, __ATOMIC_ACQUIRE);
+}
+
+static int64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Point `gzm` at the macro in the segment, without copying it. The arrays are mapped read-only and must not
+ * be modified or freed. Check gzm_shm_valid with the generation returned here after using them. Fails with
+ * EAGAIN if the segment is still being republished after a second, as when its publisher died mid-way.
+ */
+int
+gzm_shm_view (struct gzm_shm *shm, struct gz_macro *gzm, uint32_t *generation)
+{
+    struct gzm_shm_header hdr;
+    int64_t deadline = 0;
+
+    while (1)
+    {
+        uint32_t g = __atomic_load_n(&shm->hdr->generation, __ATOMIC_ACQUIRE);
+
+        if (g & 1)
+        {
+            if (deadline == 0)
+                deadline = now_ns() + MAX_WAIT_NS;
+            else if (now_ns() > deadline)
+                break;
+            sched_yield();
+            continue;
+        }
+        memcpy(&hdr, shm->hdr, sizeof(struct gzm_shm_header));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->hdr->generation, __ATOMIC_RELAXED) != g)
+            continue;
+
+        if (hdr.magic != GZM_SHM_MAGIC || hdr.format != GZM_SHM_FORMAT ||
+            hdr.header_size < sizeof(struct gzm_shm_header) || hdr.n_arrays < GZM_SHM_ARRAYS ||
+            hdr.size > hdr.capacity)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        // republished into a larger segment since we mapped it
+        if (hdr.capacity > shm->map_size)
+        {
+            if (shm_map(shm, hdr.capacity) != 0)
+                return -1;
+            continue;
+        }
+
+        memset(gzm, 0, sizeof(struct gz_macro));
+        gzm->input_start = hdr.input_start;
+        gzm->rerecords = hdr.rerecords;
+        gzm->last_recorded_frame = hdr.last_recorded_frame;
+        for (int a = 0; a < GZM_SHM_ARRAYS; a++)
+        {
+            if (hdr.array[a].record_size != arrays[a].record_size ||
+                hdr.array[a].offset > hdr.size ||
+                (uint64_t)hdr.array[a].count * hdr.array[a].record_size > hdr.size - hdr.array[a].offset)
+            {
+                errno = EPROTO;
+                return -1;
+            }
+            ARRAY_COUNT(gzm, a) = hdr.array[a].count;
+            ARRAY_DATA(gzm, a) = (hdr.array[a].count != 0) ? (uint8_t *)shm->hdr + hdr.array[a].offset : NULL;
+        }
+        *generation = g;
+        return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+/* Whether the segment still holds the macro of a view of generation `generation` */
+int
+gzm_shm_valid (const struct gzm_shm *shm, uint32_t generation)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shm->hdr->generation, __ATOMIC_RELAXED) == generation;
+}
+
+/* A private copy of the macro in the segment, free with gzm_free */
+int
+gzm_shm_read (struct gzm_shm *shm, struct gz_macro *gzm, uint32_t *generation)
+{
+    struct gz_macro view;
+    int64_t deadline = now_ns() + MAX_WAIT_NS;
+
+    while (now_ns() <= deadline)
+    {
+        if (gzm_shm_view(shm, &view, generation) != 0 || gzm_dup(gzm, &view) != 0)
+            return -1;
+        if (gzm_shm_valid(shm, *generation))
+            return 0;
+        gzm_free(gzm);
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+void
+gzm_shm_close (struct gzm_shm *shm)
+{
+    if (shm->hdr != NULL)
+        munmap(shm->hdr, shm->map_size);
+    for (size_t i = 0; i < shm->n_retired; i++)
+        munmap(shm->retired[i].addr, shm->retired[i].size);
+    free(shm->retired);
+    close(shm->fd);
+    shm->hdr = NULL;
+    shm->map_size = 0;
+    shm->retired = NULL;
+    shm->n_retired = 0;
+}
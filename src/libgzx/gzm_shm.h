@@ -0,0 +1,101 @@
+#ifndef GZM_SHM_H_
+#define GZM_SHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gzm.h"
+
+/*
+ * A decoded macro published in a POSIX shared memory segment, so several processes can use one copy of it.
+ * The segment holds no pointers: a header gives the scalars and the offset, count and record size of each
+ * array, and the records follow in the same layout as in struct gz_macro.
+ *
+ * The generation in the header is a sequence lock. The publisher makes it odd while it rewrites the segment
+ * and even again when done, so a reader that saw the same even generation before and after using the data
+ * knows it was not republished in between. The segment only ever grows, and a mapping outgrown by it is kept
+ * until gzm_shm_close rather than unmapped, so views stay mapped after a republish, they just no longer
+ * describe the macro.
+ */
+
+#define GZM_SHM_MAGIC 0x475A4D53        // "GZMS"
+#define GZM_SHM_FORMAT 1
+
+enum gzm_shm_array
+{
+    GZM_SHM_INPUT,
+    GZM_SHM_SEED,
+    GZM_SHM_OCA_INPUT,
+    GZM_SHM_OCA_SYNC,
+    GZM_SHM_ROOM_LOAD,
+    GZM_SHM_ARRAYS
+};
+
+struct gzm_shm_header
+{
+    uint32_t                 magic;
+    uint32_t                 format;
+    uint32_t                 generation;        // odd while being republished
+    uint32_t                 header_size;
+    uint64_t                 capacity;          // size of the segment
+    uint64_t                 size;              // bytes used by the macro, header included
+    z64_controller_t         input_start;
+    uint32_t                 rerecords;
+    uint32_t                 last_recorded_frame;
+    uint32_t                 n_arrays;
+    struct
+    {
+        uint64_t             offset;            // from the start of the segment
+        uint32_t             count;
+        uint32_t             record_size;
+    }                        array[GZM_SHM_ARRAYS];
+};
+
+struct gzm_shm_map
+{
+    void                    *addr;
+    size_t                   size;
+};
+
+struct gzm_shm
+{
+    int                      fd;
+    int                      writable;
+    struct gzm_shm_header   *hdr;
+    size_t                   map_size;
+    struct gzm_shm_map      *retired;           // outgrown mappings that earlier views may still point into
+    size_t                   n_retired;
+};
+
+// Publishing
+
+int
+gzm_shm_create (struct gzm_shm *shm, const char *name);
+
+int
+gzm_shm_publish (struct gzm_shm *shm, const struct gz_macro *gzm);
+
+int
+gzm_shm_remove (const char *name);
+
+// Reading
+
+int
+gzm_shm_open (struct gzm_shm *shm, const char *name);
+
+uint32_t
+gzm_shm_generation (const struct gzm_shm *shm);
+
+int
+gzm_shm_view (struct gzm_shm *shm, struct gz_macro *gzm, uint32_t *generation);
+
+int
+gzm_shm_valid (const struct gzm_shm *shm, uint32_t generation);
+
+int
+gzm_shm_read (struct gzm_shm *shm, struct gz_macro *gzm, uint32_t *generation);
+
+void
+gzm_shm_close (struct gzm_shm *shm);
+
+#endif
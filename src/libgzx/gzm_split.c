@@ -0,0 +1,264 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gzm_compact.h"
+#include "gzm_split.h"
+
+// The event arrays of a macro, frame_idx is the first field of every event record
+static const struct
+{
+    size_t       array;
+    size_t       count;
+    size_t       size;
+} event_arrays[] =
+{
+    { offsetof(struct gz_macro, seed),      offsetof(struct gz_macro, n_seed),      sizeof(struct movie_seed)      },
+    { offsetof(struct gz_macro, oca_input), offsetof(struct gz_macro, n_oca_input), sizeof(struct movie_oca_input) },
+    { offsetof(struct gz_macro, oca_sync),  offsetof(struct gz_macro, n_oca_sync),  sizeof(struct movie_oca_sync)  },
+    { offsetof(struct gz_macro, room_load), offsetof(struct gz_macro, n_room_load), sizeof(struct movie_room_load) },
+};
+
+#define N_EVENT_ARRAYS (sizeof(event_arrays) / sizeof(event_arrays[0]))
+
+static inline uint32_t
+event_frame (const uint8_t *events, size_t size, uint32_t i)
+{
+    uint32_t frame_idx;
+    memcpy(&frame_idx, events + i * size, sizeof(frame_idx));
+    return frame_idx;
+}
+
+static int
+cmp_u32 (const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* The frames of every event of one kind, as cut points in *cuts, which must be freed, and their number in *n_cuts */
+int
+gzm_split_cuts (uint32_t **cuts, size_t *n_cuts, const struct gz_macro *gzm, int at)
+{
+    const uint8_t *events;
+    uint32_t n;
+    size_t size;
+
+    if (at == GZM_SPLIT_SEED)
+    {
+        events = (const uint8_t *)gzm->seed;
+        n = gzm->n_seed;
+        size = sizeof(struct movie_seed);
+    }
+    else
+    {
+        events = (const uint8_t *)gzm->room_load;
+        n = gzm->n_room_load;
+        size = sizeof(struct movie_room_load);
+    }
+
+    *n_cuts = 0;
+    *cuts = malloc(n * sizeof(uint32_t) + 1);
+    if (*cuts == NULL)
+        return -1;
+    for (uint32_t i = 0; i < n; i++)
+        (*cuts)[i] = event_frame(events, size, i);
+    *n_cuts = gzm_split_normalize(*cuts, n, gzm->n_input);
+    return 0;
+}
+
+/* Sort cut points and drop repeats and any that would make an empty segment, returns the number left */
+size_t
+gzm_split_normalize (uint32_t *cuts, size_t n_cuts, uint32_t n_input)
+{
+    size_t n = 0;
+
+    qsort(cuts, n_cuts, sizeof(uint32_t), cmp_u32);
+    for (size_t i = 0; i < n_cuts; i++)
+    {
+        if (cuts[i] == 0 || cuts[i] >= n_input || (n != 0 && cuts[i] == cuts[n - 1]))
+            continue;
+        cuts[n++] = cuts[i];
+    }
+    return n;
+}
+
+static bool
+events_sorted (const struct gz_macro *gzm)
+{
+    for (size_t a = 0; a < N_EVENT_ARRAYS; a++)
+    {
+        const uint8_t *events;
+        uint32_t n;
+
+        memcpy(&events, (const uint8_t *)gzm + event_arrays[a].array, sizeof(events));
+        memcpy(&n, (const uint8_t *)gzm + event_arrays[a].count, sizeof(n));
+        for (uint32_t i = 1; i < n; i++)
+        {
+            if (event_frame(events, event_arrays[a].size, i) < event_frame(events, event_arrays[a].size, i - 1))
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Events of segment k are those on frames [bound[k], bound[k + 1]], as gzm_slice takes them, so an event on a
+ * cut belongs to both segments. The segments are in order, so each array is swept once for all of them.
+ * The macro of segment k is at `out` + k * `stride`, so this fills gz_macros and gzm_compacts alike.
+ */
+static int
+split_events (uint8_t *out, size_t stride, size_t n_seg, const uint32_t *bound, const struct gz_macro *gzm)
+{
+    for (size_t a = 0; a < N_EVENT_ARRAYS; a++)
+    {
+        const size_t size = event_arrays[a].size;
+        const uint8_t *events;
+        uint32_t n;
+        uint32_t lo = 0;
+
+        memcpy(&events, (const uint8_t *)gzm + event_arrays[a].array, sizeof(events));
+        memcpy(&n, (const uint8_t *)gzm + event_arrays[a].count, sizeof(n));
+
+        for (size_t k = 0; k < n_seg; k++)
+        {
+            uint32_t hi;
+            uint32_t count;
+            uint8_t *copy = NULL;
+
+            while (lo < n && event_frame(events, size, lo) < bound[k])
+                lo++;
+            for (hi = lo; hi < n && event_frame(events, size, hi) <= bound[k + 1]; hi++)
+                ;
+
+            if (hi > lo)
+            {
+                copy = malloc((hi - lo) * size);
+                if (copy == NULL)
+                    return -1;
+                memcpy(copy, events + lo * size, (hi - lo) * size);
+                for (uint32_t i = 0; i < hi - lo; i++)
+                {
+                    uint32_t frame_idx = event_frame(copy, size, i) - bound[k];
+                    memcpy(copy + i * size, &frame_idx, sizeof(frame_idx));
+                }
+            }
+            count = hi - lo;
+            memcpy(out + k * stride + event_arrays[a].array, &copy, sizeof(copy));
+            memcpy(out + k * stride + event_arrays[a].count, &count, sizeof(count));
+        }
+    }
+    return 0;
+}
+
+/*
+ * Split a macro at the given cut points, which must be sorted, distinct and inside the macro (see
+ * gzm_split_normalize), into n_cuts + 1 macros in `out`. Each one is what gzm_slice would give for its
+ * segment, but the source is read once for all of them and is left unchanged.
+ */
+int
+gzm_split (struct gz_macro *out, const struct gz_macro *gzm, const uint32_t *cuts, size_t n_cuts)
+{
+    size_t n_seg = n_cuts + 1;
+    uint32_t *bound = malloc((n_seg + 1) * sizeof(uint32_t));
+
+    if (bound == NULL)
+        return -1;
+    bound[0] = 0;
+    memcpy(&bound[1], cuts, n_cuts * sizeof(uint32_t));
+    bound[n_seg] = gzm->n_input;
+
+    memset(out, 0, n_seg * sizeof(struct gz_macro));
+    for (size_t k = 0; k < n_seg; k++)
+    {
+        if (bound[k + 1] <= bound[k])
+            goto fail;
+
+        out[k].n_input = bound[k + 1] - bound[k];
+        out[k].input = malloc(out[k].n_input * sizeof(struct movie_input));
+        if (out[k].input == NULL)
+            goto fail;
+        memcpy(out[k].input, &gzm->input[bound[k]], out[k].n_input * sizeof(struct movie_input));
+        out[k].rerecords = gzm->rerecords;
+        out[k].last_recorded_frame = out[k].n_input;
+    }
+
+    // the sweep relies on sorted events, anything else is sliced as gzm_slice does it
+    if (events_sorted(gzm))
+    {
+        if (split_events((uint8_t *)out, sizeof(struct gz_macro), n_seg, bound, gzm) != 0)
+            goto fail;
+    }
+    else
+    {
+        for (size_t k = 0; k < n_seg; k++)
+        {
+            if (gzm_slice_events(&out[k], gzm, bound[k], bound[k + 1]) != 0)
+                goto fail;
+        }
+    }
+
+    free(bound);
+    return 0;
+
+fail:
+    for (size_t k = 0; k < n_seg; k++)
+        gzm_free(&out[k]);
+    free(bound);
+    return -1;
+}
+
+/* gzm_split on a compact macro */
+int
+gzm_compact_split (struct gzm_compact *out, const struct gzm_compact *c, const uint32_t *cuts, size_t n_cuts)
+{
+    size_t n_seg = n_cuts + 1;
+    uint32_t *bound = malloc((n_seg + 1) * sizeof(uint32_t));
+
+    if (bound == NULL)
+        return -1;
+    bound[0] = 0;
+    memcpy(&bound[1], cuts, n_cuts * sizeof(uint32_t));
+    bound[n_seg] = c->gzm.n_input;
+
+    memset(out, 0, n_seg * sizeof(struct gzm_compact));
+    for (size_t k = 0; k < n_seg; k++)
+    {
+        if (bound[k + 1] <= bound[k])
+            goto fail;
+
+        out[k].gzm.n_input = bound[k + 1] - bound[k];
+        out[k].frame = malloc(out[k].gzm.n_input * sizeof(z64_controller_t));
+        if (out[k].frame == NULL)
+            goto fail;
+        memcpy(out[k].frame, &c->frame[bound[k]], out[k].gzm.n_input * sizeof(z64_controller_t));
+        out[k].gzm.rerecords = c->gzm.rerecords;
+        out[k].gzm.last_recorded_frame = out[k].gzm.n_input;
+    }
+
+    if (events_sorted(&c->gzm))
+    {
+        if (split_events((uint8_t *)&out[0].gzm, sizeof(struct gzm_compact), n_seg, bound, &c->gzm) != 0)
+            goto fail;
+    }
+    else
+    {
+        for (size_t k = 0; k < n_seg; k++)
+        {
+            if (gzm_slice_events(&out[k].gzm, &c->gzm, bound[k], bound[k + 1]) != 0)
+                goto fail;
+        }
+    }
+
+    free(bound);
+    return 0;
+
+fail:
+    for (size_t k = 0; k < n_seg; k++)
+        gzm_compact_free(&out[k]);
+    free(bound);
+    return -1;
+}
@@ -0,0 +1,25 @@
+#ifndef GZM_SPLIT_H_
+#define GZM_SPLIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gzm.h"
+
+// Events that can mark where to cut a macro
+enum gzm_split_at
+{
+    GZM_SPLIT_ROOM_LOAD,
+    GZM_SPLIT_SEED,
+};
+
+int
+gzm_split_cuts (uint32_t **cuts, size_t *n_cuts, const struct gz_macro *gzm, int at);
+
+size_t
+gzm_split_normalize (uint32_t *cuts, size_t n_cuts, uint32_t n_input);
+
+int
+gzm_split (struct gz_macro *out, const struct gz_macro *gzm, const uint32_t *cuts, size_t n_cuts);
+
+#endif
@@ -0,0 +1,613 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gzm_stream.h"
+#include "gzm_schema.h"
+
+#define STREAM_CHUNK_SIZE   (64 * 1024)
+#define STREAM_N_CHUNKS     4
+#define STREAM_SINK_BATCH   1024
+
+GZM_SCHEMA(GZM_SCHEMA_IGNORE, GZM_ARRAY_CODEC, GZM_SCHEMA_IGNORE)
+
+/*
+ * The schema flattened into a table, so that the codec can stop and resume at any entry
+ */
+
+enum stream_kind
+{
+    STREAM_SCALAR,
+    STREAM_ARRAY,
+    STREAM_VERSION,
+};
+
+struct stream_field
+{
+    int                      kind;
+    int                      version;       // STREAM_VERSION
+    size_t                   offset;        // field, or array pointer, in struct gz_macro
+    size_t                   size;          // serial size of the field, or of one record
+    size_t                   count_offset;  // STREAM_ARRAY
+    size_t                   elem_size;     // STREAM_ARRAY, in memory size of one record
+    const uint8_t         *(*decode)(void *dst, size_t n, const uint8_t *p);
+    uint8_t               *(*encode)(uint8_t *p, const void *src, size_t n);
+};
+
+#define STREAM_ARRAY_CODEC(name, count, type, FIELDS)                               \
+    static const uint8_t *                                                          \
+    stream_decode_##name (void *dst, size_t n, const uint8_t *p)                    \
+    {                                                                               \
+        return decode_##name(dst, n, p);                                            \
+    }                                                                               \
+                                                                                    \
+    static uint8_t *                                                                \
+    stream_encode_##name (uint8_t *p, const void *src, size_t n)                    \
+    {                                                                               \
+        return encode_##name(p, src, n);                                            \
+    }
+
+GZM_SCHEMA(GZM_SCHEMA_IGNORE, STREAM_ARRAY_CODEC, GZM_SCHEMA_IGNORE)
+
+#define STREAM_FIELD_SCALAR(field)                                                  \
+    { STREAM_SCALAR, 0, offsetof(struct gz_macro, field),                           \
+      sizeof(((struct gz_macro *)0)->field), 0, 0, NULL, NULL },
+#define STREAM_FIELD_ARRAY(name, count, type, FIELDS)                               \
+    { STREAM_ARRAY, 0, offsetof(struct gz_macro, name),                             \
+      GZM_RECORD_SERIAL_SIZE(type, FIELDS), offsetof(struct gz_macro, count),       \
+      sizeof(type), stream_decode_##name, stream_encode_##name },
+#define STREAM_FIELD_VERSION(v)                                                     \
+    { STREAM_VERSION, (v), 0, 0, 0, 0, NULL, NULL },
+
+static const struct stream_field stream_fields[] =
+{
+    GZM_SCHEMA(STREAM_FIELD_SCALAR, STREAM_FIELD_ARRAY, STREAM_FIELD_VERSION)
+};
+
+#define STREAM_N_FIELDS (sizeof(stream_fields) / sizeof(stream_fields[0]))
+
+static uint32_t
+stream_count (const struct gz_macro *gzm, const struct stream_field *f)
+{
+    uint32_t count;
+    memcpy(&count, (const uint8_t *)gzm + f->count_offset, sizeof(count));
+    return count;
+}
+
+static void **
+stream_array (struct gz_macro *gzm, const struct stream_field *f)
+{
+    return (void **)((uint8_t *)gzm + f->offset);
+}
+
+void
+gzm_decoder_init (struct gzm_decoder *dec, struct gz_macro *gzm, gzm_input_sink_t sink, void *sink_arg)
+{
+    memset(dec, 0, sizeof(struct gzm_decoder));
+    memset(gzm, 0, sizeof(struct gz_macro));
+    dec->gzm = gzm;
+    dec->sink = sink;
+    dec->sink_arg = sink_arg;
+}
+
+/* Decode `n` records of the current array from `p` */
+static const uint8_t *
+decoder_records (struct gzm_decoder *dec, const struct stream_field *f, uint32_t count, const uint8_t *p, uint32_t n)
+{
+    void **array = stream_array(dec->gzm, f);
+
+    if (dec->sink != NULL && f->offset == offsetof(struct gz_macro, input))
+    {
+        struct movie_input batch[STREAM_SINK_BATCH];
+
+        while (n != 0)
+        {
+            uint32_t k = (n < STREAM_SINK_BATCH) ? n : STREAM_SINK_BATCH;
+
+            p = f->decode(batch, k, p);
+            dec->sink(dec->sink_arg, dec->done, batch, k);
+            dec->done += k;
+            n -= k;
+        }
+        return p;
+    }
+
+    // Grow as records arrive rather than trusting the count up front
+    if (dec->done + n > dec->cap)
+    {
+        uint64_t cap = (uint64_t)dec->cap * 2;
+        void *mem;
+
+        if (cap < dec->done + n)
+            cap = dec->done + n;
+        if (cap < 1024)
+            cap = 1024;
+        if (cap > count)
+            cap = count;
+        mem = realloc(*array, cap * f->elem_size);
+        if (mem == NULL)
+        {
+            dec->failed = true;
+            return NULL;
+        }
+        *array = mem;
+        dec->cap = cap;
+    }
+    p = f->decode((uint8_t *)*array + (size_t)dec->done * f->elem_size, n, p);
+    dec->done += n;
+    return p;
+}
+
+/* Decode the next chunk of the serialized macro, returns -1 on trailing data or if out of memory */
+int
+gzm_decoder_feed (struct gzm_decoder *dec, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+
+    if (dec->failed || dec->trailing)
+        return -1;
+
+    while (p < end)
+    {
+        const struct stream_field *f;
+
+        if (dec->field == STREAM_N_FIELDS)
+        {
+            dec->trailing = true;
+            return -1;
+        }
+        f = &stream_fields[dec->field];
+
+        if (f->kind == STREAM_VERSION)
+        {
+            dec->boundary = dec->field;
+            dec->field++;
+            continue;
+        }
+        if (f->kind == STREAM_ARRAY && dec->done == stream_count(dec->gzm, f))
+        {
+            dec->field++;
+            dec->done = 0;
+            dec->cap = 0;
+            continue;
+        }
+
+        // A field or record split across chunks is gathered first
+        if (dec->n_partial != 0 || (size_t)(end - p) < f->size)
+        {
+            size_t n = f->size - dec->n_partial;
+
+            if (n > (size_t)(end - p))
+                n = end - p;
+            memcpy(&dec->partial[dec->n_partial], p, n);
+            dec->n_partial += n;
+            p += n;
+            if (dec->n_partial < f->size)
+                break;
+
+            dec->n_partial = 0;
+            if (f->kind == STREAM_SCALAR)
+            {
+                serial_load((uint8_t *)dec->gzm + f->offset, f->size, dec->partial);
+                dec->field++;
+            }
+            else if (decoder_records(dec, f, stream_count(dec->gzm, f), dec->partial, 1) == NULL)
+                return -1;
+            continue;
+        }
+
+        if (f->kind == STREAM_SCALAR)
+        {
+            p = serial_load((uint8_t *)dec->gzm + f->offset, f->size, p);
+            dec->field++;
+        }
+        else
+        {
+            uint32_t count = stream_count(dec->gzm, f);
+            size_t n = (end - p) / f->size;
+
+            if (n > count - dec->done)
+                n = count - dec->done;
+            p = decoder_records(dec, f, count, p, n);
+            if (p == NULL)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * End of input. Returns 0 if the data ended on a version boundary. Otherwise returns -1, and as with
+ * gzm_decode only the longest complete version prefix is kept (or everything, for trailing data).
+ */
+int
+gzm_decoder_finish (struct gzm_decoder *dec)
+{
+    if (dec->failed)
+    {
+        gzm_free(dec->gzm);
+        return -1;
+    }
+    if (dec->trailing)
+        return -1;
+
+    // Empty arrays need no data
+    while (dec->n_partial == 0 && dec->field < STREAM_N_FIELDS &&
+           stream_fields[dec->field].kind == STREAM_ARRAY &&
+           dec->done == stream_count(dec->gzm, &stream_fields[dec->field]))
+    {
+        dec->field++;
+        dec->done = 0;
+    }
+    if (dec->n_partial == 0 && (dec->field == STREAM_N_FIELDS || stream_fields[dec->field].kind == STREAM_VERSION))
+        return 0;
+
+    // Truncated, drop the incomplete version
+    for (size_t i = dec->boundary; i < STREAM_N_FIELDS; i++)
+    {
+        const struct stream_field *f = &stream_fields[i];
+
+        if (f->kind == STREAM_SCALAR)
+        {
+            memset((uint8_t *)dec->gzm + f->offset, 0, f->size);
+        }
+        else if (f->kind == STREAM_ARRAY)
+        {
+            void **array = stream_array(dec->gzm, f);
+            free(*array);
+            *array = NULL;
+        }
+    }
+    return -1;
+}
+
+int
+gzm_encoder_init (struct gzm_encoder *enc, const struct gz_macro *gzm, int version)
+{
+    memset(enc, 0, sizeof(struct gzm_encoder));
+    if (version < GZM_VERSION_BASE || version > GZM_VERSION_LATEST)
+        return -1;
+    enc->gzm = gzm;
+    enc->version = version;
+    return 0;
+}
+
+/* Take the inputs from `source` instead of gzm->input */
+void
+gzm_encoder_set_source (struct gzm_encoder *enc, gzm_input_source_t source, void *source_arg)
+{
+    enc->source = source;
+    enc->source_arg = source_arg;
+}
+
+/* Encode `n` records of the current array to `p` */
+static uint8_t *
+encoder_records (struct gzm_encoder *enc, const struct stream_field *f, uint8_t *p, uint32_t n)
+{
+    const uint8_t *src = *(void * const *)((const uint8_t *)enc->gzm + f->offset);
+
+    if (enc->source != NULL && f->offset == offsetof(struct gz_macro, input))
+    {
+        struct movie_input batch[STREAM_SINK_BATCH];
+
+        while (n != 0)
+        {
+            uint32_t k = (n < STREAM_SINK_BATCH) ? n : STREAM_SINK_BATCH;
+
+            enc->source(enc->source_arg, enc->done, batch, k);
+            p = f->encode(p, batch, k);
+            enc->done += k;
+            n -= k;
+        }
+        return p;
+    }
+
+    p = f->encode(p, src + (size_t)enc->done * f->elem_size, n);
+    enc->done += n;
+    return p;
+}
+
+/* Produce up to `size` bytes of the serialized macro, returns the number of bytes produced, 0 once done */
+size_t
+gzm_encoder_read (struct gzm_encoder *enc, void *buf, size_t size)
+{
+    uint8_t *p = buf;
+    uint8_t *end = p + size;
+
+    while (p < end)
+    {
+        const struct stream_field *f;
+
+        // Rest of a field or record that did not fit last time
+        if (enc->pos_partial < enc->n_partial)
+        {
+            size_t n = enc->n_partial - enc->pos_partial;
+
+            if (n > (size_t)(end - p))
+                n = end - p;
+            memcpy(p, &enc->partial[enc->pos_partial], n);
+            enc->pos_partial += n;
+            p += n;
+            continue;
+        }
+        if (enc->field == STREAM_N_FIELDS)
+            break;
+        f = &stream_fields[enc->field];
+
+        if (f->kind == STREAM_VERSION)
+        {
+            enc->field = (enc->version < f->version) ? STREAM_N_FIELDS : enc->field + 1;
+            continue;
+        }
+
+        if (f->kind == STREAM_SCALAR)
+        {
+            const void *src = (const uint8_t *)enc->gzm + f->offset;
+
+            if ((size_t)(end - p) >= f->size)
+            {
+                p = serial_store(p, src, f->size);
+            }
+            else
+            {
+                serial_store(enc->partial, src, f->size);
+                enc->n_partial = f->size;
+                enc->pos_partial = 0;
+            }
+            enc->field++;
+        }
+        else
+        {
+            uint32_t count = stream_count(enc->gzm, f);
+            size_t n = (end - p) / f->size;
+
+            if (enc->done == count)
+            {
+                enc->field++;
+                enc->done = 0;
+                continue;
+            }
+            if (n > count - enc->done)
+                n = count - enc->done;
+
+            if (n == 0)
+            {
+                encoder_records(enc, f, enc->partial, 1);
+                enc->n_partial = f->size;
+                enc->pos_partial = 0;
+            }
+            else
+            {
+                p = encoder_records(enc, f, p, n);
+            }
+        }
+    }
+    return p - (uint8_t *)buf;
+}
+
+/*
+ * Reading and decoding run on separate threads, handing chunks over through a small ring, so a macro
+ * coming through a pipe is decoded while the rest of it is still arriving. The reader waits in poll
+ * rather than in a blocking read, so that the decoder can wake it through `wake` when it gives up early.
+ * The file is read through its descriptor, it must not have been read from as a FILE before.
+ */
+
+struct stream_reader
+{
+    int                      fd;
+    int                      wake[2];       // closing wake[1] stops a reader waiting for input
+    pthread_mutex_t          lock;
+    pthread_cond_t           cond;
+    uint8_t                 *chunks[STREAM_N_CHUNKS];
+    size_t                   len[STREAM_N_CHUNKS];
+    unsigned                 head;          // next chunk to fill
+    unsigned                 tail;          // next chunk to decode
+    bool                     eof;
+    bool                     error;
+    bool                     stop;
+};
+
+/* Fill a chunk, short at the end of the input, on an error or when woken to stop */
+static size_t
+stream_reader_fill (struct stream_reader *r, uint8_t *chunk, bool *error)
+{
+    size_t len = 0;
+
+    while (len < STREAM_CHUNK_SIZE)
+    {
+        struct pollfd pfd[2] = { { r->fd, POLLIN, 0 }, { r->wake[0], POLLIN, 0 } };
+        ssize_t n;
+
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            *error = true;
+            break;
+        }
+        if (pfd[1].revents != 0)
+            break;
+        n = read(r->fd, &chunk[len], STREAM_CHUNK_SIZE - len);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            *error = true;
+            break;
+        }
+        if (n == 0)
+            break;
+        len += n;
+    }
+    return len;
+}
+
+static void *
+stream_reader_thread (void *arg)
+{
+    struct stream_reader *r = arg;
+
+    while (true)
+    {
+        uint8_t *chunk;
+        size_t len;
+        bool error = false;
+
+        pthread_mutex_lock(&r->lock);
+        while (r->head - r->tail == STREAM_N_CHUNKS && !r->stop)
+            pthread_cond_wait(&r->cond, &r->lock);
+        if (r->stop)
+        {
+            pthread_mutex_unlock(&r->lock);
+            return NULL;
+        }
+        chunk = r->chunks[r->head % STREAM_N_CHUNKS];
+        pthread_mutex_unlock(&r->lock);
+
+        len = stream_reader_fill(r, chunk, &error);
+
+        pthread_mutex_lock(&r->lock);
+        r->len[r->head % STREAM_N_CHUNKS] = len;
+        r->head++;
+        if (len < STREAM_CHUNK_SIZE)
+        {
+            r->eof = true;
+            r->error = error;
+        }
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+
+        if (len < STREAM_CHUNK_SIZE)
+            return NULL;
+    }
+}
+
+/* Decode a macro from a stream that need not be seekable, in memory bounded by the macro itself */
+int
+gzm_stream_read (struct gz_macro *gzm, FILE *file, gzm_input_sink_t sink, void *sink_arg)
+{
+    struct stream_reader r;
+    struct gzm_decoder dec;
+    pthread_t thread;
+    int ret = 0;
+
+    memset(&r, 0, sizeof(r));
+    r.fd = fileno(file);
+    r.wake[0] = r.wake[1] = -1;
+    for (int i = 0; i < STREAM_N_CHUNKS; i++)
+    {
+        r.chunks[i] = malloc(STREAM_CHUNK_SIZE);
+        if (r.chunks[i] == NULL)
+            ret = -1;
+    }
+    gzm_decoder_init(&dec, gzm, sink, sink_arg);
+    if (ret != 0 || r.fd < 0 || pipe(r.wake) != 0)
+    {
+        ret = -1;
+        goto end;
+    }
+
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.cond, NULL);
+    if (pthread_create(&thread, NULL, stream_reader_thread, &r) != 0)
+    {
+        ret = -1;
+        goto destroy;
+    }
+
+    while (true)
+    {
+        uint8_t *chunk;
+        size_t len;
+
+        pthread_mutex_lock(&r.lock);
+        while (r.head == r.tail && !r.eof)
+            pthread_cond_wait(&r.cond, &r.lock);
+        if (r.head == r.tail)
+        {
+            pthread_mutex_unlock(&r.lock);
+            break;
+        }
+        chunk = r.chunks[r.tail % STREAM_N_CHUNKS];
+        len = r.len[r.tail % STREAM_N_CHUNKS];
+        pthread_mutex_unlock(&r.lock);
+
+        if (gzm_decoder_feed(&dec, chunk, len) != 0)
+            ret = -1;
+
+        pthread_mutex_lock(&r.lock);
+        r.tail++;
+        if (dec.failed)
+            r.stop = true;
+        pthread_cond_broadcast(&r.cond);
+        pthread_mutex_unlock(&r.lock);
+        if (dec.failed)
+            break;
+    }
+    // a reader still waiting for input, on a pipe whose writer has not finished, is woken to stop
+    close(r.wake[1]);
+    r.wake[1] = -1;
+    pthread_join(thread, NULL);
+    if (r.error)
+        ret = -1;
+
+destroy:
+    pthread_mutex_destroy(&r.lock);
+    pthread_cond_destroy(&r.cond);
+end:
+    for (int i = 0; i < 2; i++)
+    {
+        if (r.wake[i] >= 0)
+            close(r.wake[i]);
+    }
+    if (gzm_decoder_finish(&dec) != 0)
+        ret = -1;
+    for (int i = 0; i < STREAM_N_CHUNKS; i++)
+        free(r.chunks[i]);
+    return ret;
+}
+
+/* Encode a macro to a stream, without serializing the whole macro in memory first */
+int
+gzm_stream_write (const struct gz_macro *gzm, int version, FILE *file)
+{
+    return gzm_stream_write_inputs(gzm, version, file, NULL, NULL);
+}
+
+/* As gzm_stream_write, with the inputs taken from `source` if it is not NULL */
+int
+gzm_stream_write_inputs (const struct gz_macro *gzm, int version, FILE *file, gzm_input_source_t source, void *source_arg)
+{
+    struct gzm_encoder enc;
+    uint8_t *buf;
+    size_t len;
+    int ret = 0;
+
+    if (gzm_encoder_init(&enc, gzm, version) != 0)
+        return -1;
+    gzm_encoder_set_source(&enc, source, source_arg);
+    buf = malloc(STREAM_CHUNK_SIZE);
+    if (buf == NULL)
+        return -1;
+
+    while ((len = gzm_encoder_read(&enc, buf, STREAM_CHUNK_SIZE)) != 0)
+    {
+        if (fwrite(buf, 1, len, file) != len)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    free(buf);
+    if (fflush(file) != 0)
+        ret = -1;
+    return ret;
+}
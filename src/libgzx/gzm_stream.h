@@ -0,0 +1,77 @@
+#ifndef GZM_STREAM_H_
+#define GZM_STREAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gzm.h"
+
+// Receives decoded inputs [frame, frame + n) as they arrive, instead of them being kept in gzm->input
+typedef void (*gzm_input_sink_t)(void *arg, uint32_t frame, const struct movie_input *input, size_t n);
+
+// Supplies inputs [frame, frame + n) to be encoded, for inputs not held in gzm->input
+typedef void (*gzm_input_source_t)(void *arg, uint32_t frame, struct movie_input *input, size_t n);
+
+/*
+ * Incremental decoder, fed arbitrary chunks of a serialized macro. State is the position in the schema
+ * plus the bytes of at most one field or record split across chunks.
+ */
+struct gzm_decoder
+{
+    struct gz_macro         *gzm;
+    gzm_input_sink_t         sink;
+    void                    *sink_arg;
+    size_t                   field;         // current entry of the schema
+    size_t                   boundary;      // entry of the last version marker passed
+    uint32_t                 done;          // records of the current array decoded
+    uint32_t                 cap;           // records allocated for the current array
+    uint8_t                  partial[16];
+    size_t                   n_partial;
+    bool                     trailing;
+    bool                     failed;
+};
+
+// Incremental encoder, produces the serialized macro in arbitrary chunks
+struct gzm_encoder
+{
+    const struct gz_macro   *gzm;
+    gzm_input_source_t       source;
+    void                    *source_arg;
+    int                      version;
+    size_t                   field;
+    uint32_t                 done;
+    uint8_t                  partial[16];
+    size_t                   n_partial;
+    size_t                   pos_partial;
+};
+
+void
+gzm_decoder_init (struct gzm_decoder *dec, struct gz_macro *gzm, gzm_input_sink_t sink, void *sink_arg);
+
+int
+gzm_decoder_feed (struct gzm_decoder *dec, const void *data, size_t size);
+
+int
+gzm_decoder_finish (struct gzm_decoder *dec);
+
+int
+gzm_encoder_init (struct gzm_encoder *enc, const struct gz_macro *gzm, int version);
+
+void
+gzm_encoder_set_source (struct gzm_encoder *enc, gzm_input_source_t source, void *source_arg);
+
+size_t
+gzm_encoder_read (struct gzm_encoder *enc, void *buf, size_t size);
+
+int
+gzm_stream_read (struct gz_macro *gzm, FILE *file, gzm_input_sink_t sink, void *sink_arg);
+
+int
+gzm_stream_write (const struct gz_macro *gzm, int version, FILE *file);
+
+int
+gzm_stream_write_inputs (const struct gz_macro *gzm, int version, FILE *file, gzm_input_source_t source, void *source_arg);
+
+#endif
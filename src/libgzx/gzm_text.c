@@ -0,0 +1,761 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gzm_text.h"
+
+#define TEXT_BUF_SIZE   (1 << 16)
+#define TEXT_MAX_ROW    256
+
+#define CSV_HEADER      "type,frame,pad,x,y,pad_delta,old_seed,new_seed,audio_frames,rerecords\n"
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+/*
+ * Writing
+ *
+ * Rows are assembled directly in a large output buffer from lookup tables rather than through printf,
+ * the tables cover every value of a pad byte or stick axis.
+ */
+
+struct text_tables
+{
+    char                     dec4[256][4];      // "%4d" of each int8_t, indexed by the uint8_t bit pattern
+    char                     dec[256][4];       // "%d" of each int8_t
+    uint8_t                  dec_len[256];
+    char                     btn_hi[256][23];   // A, B, Z, S, DU, DD, DL, DR columns
+    char                     btn_lo[256][25];   // L, R, CU, CD, CL, CR columns and the reset marker
+    uint8_t                  btn_lo_len[256];
+};
+
+struct text_writer
+{
+    FILE                    *file;
+    char                    *buf;
+    size_t                   pos;
+    int                      error;
+    struct text_tables       tab;
+};
+
+static void
+text_tables_init (struct text_tables *tab)
+{
+    static const char *hi_names[8] = { "DR", "DL", "DD", "DU", "S ", "Z ", "B ", "A " };
+    static const char *lo_names[6] = { "CR", "CL", "CD", "CU", "R ", "L " };
+
+    for (int i = 0; i < 256; i++)
+    {
+        char tmp[8];
+        int v = (int8_t)i;
+
+        snprintf(tmp, sizeof(tmp), "%4d", v);
+        memcpy(tab->dec4[i], tmp, 4);
+        tab->dec_len[i] = snprintf(tmp, sizeof(tmp), "%d", v);
+        memcpy(tab->dec[i], tmp, tab->dec_len[i]);
+
+        // high byte, A first
+        char *p = tab->btn_hi[i];
+        for (int b = 7; b >= 0; b--)
+        {
+            memcpy(p, ((i >> b) & 1) ? hi_names[b] : "  ", 2);
+            p += 2;
+            if (b != 0)
+                *p++ = ' ';
+        }
+
+        // low byte, L first (bit 6 is unused)
+        p = tab->btn_lo[i];
+        for (int b = 5; b >= 0; b--)
+        {
+            memcpy(p, ((i >> b) & 1) ? lo_names[b] : "  ", 2);
+            p += 2;
+            if (b != 0)
+                *p++ = ' ';
+        }
+        if (PAD_RST(i))
+        {
+            memcpy(p, " [RESET]", 8);
+            p += 8;
+        }
+        tab->btn_lo_len[i] = p - tab->btn_lo[i];
+    }
+}
+
+static void
+tw_flush (struct text_writer *tw)
+{
+    if (tw->pos != 0 && fwrite(tw->buf, 1, tw->pos, tw->file) != tw->pos)
+        tw->error = -1;
+    tw->pos = 0;
+}
+
+/* Make room for one row and return where to write it */
+static inline char *
+tw_row (struct text_writer *tw)
+{
+    if (tw->pos + TEXT_MAX_ROW > TEXT_BUF_SIZE)
+        tw_flush(tw);
+    return &tw->buf[tw->pos];
+}
+
+static inline void
+tw_commit (struct text_writer *tw, const char *end)
+{
+    tw->pos = end - tw->buf;
+}
+
+static inline char *
+put_str (char *p, const char *s, size_t len)
+{
+    memcpy(p, s, len);
+    return p + len;
+}
+
+#define PUT_LIT(p, s) put_str((p), (s), sizeof(s) - 1)
+
+static inline char *
+put_hex4 (char *p, uint16_t v)
+{
+    p[0] = hex_digits[(v >> 12) & 0xF];
+    p[1] = hex_digits[(v >>  8) & 0xF];
+    p[2] = hex_digits[(v >>  4) & 0xF];
+    p[3] = hex_digits[(v >>  0) & 0xF];
+    return p + 4;
+}
+
+static inline char *
+put_u32 (char *p, uint32_t v)
+{
+    char tmp[10];
+    int n = 0;
+
+    do
+    {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    while (n > 0)
+        *p++ = tmp[--n];
+    return p;
+}
+
+static inline char *
+put_i32 (char *p, int32_t v)
+{
+    if (v < 0)
+    {
+        *p++ = '-';
+        return put_u32(p, -(uint32_t)v);
+    }
+    return put_u32(p, v);
+}
+
+static inline char *
+put_i8 (char *p, const struct text_tables *tab, int8_t v)
+{
+    return put_str(p, tab->dec[(uint8_t)v], tab->dec_len[(uint8_t)v]);
+}
+
+static void
+write_human (struct text_writer *tw, const struct gz_macro *gzm)
+{
+    const struct text_tables *tab = &tw->tab;
+    char *p = tw_row(tw);
+
+    p += sprintf(p, "gzm has %u inputs:\n", gzm->n_input);
+    tw_commit(tw, p);
+
+    for (uint32_t i = 0; i < gzm->n_input; i++)
+    {
+        const struct movie_input *inp = &gzm->input[i];
+        uint16_t pad = inp->raw.pad;
+
+        p = tw_row(tw);
+        p = PUT_LIT(p, "{ 0x");
+        p = put_hex4(p, inp->pad_delta);
+        p = PUT_LIT(p, " }, { ");
+        p = put_str(p, tab->dec4[(uint8_t)inp->raw.x], 4);
+        p = PUT_LIT(p, ", ");
+        p = put_str(p, tab->dec4[(uint8_t)inp->raw.y], 4);
+        p = PUT_LIT(p, " }, ");
+        p = put_str(p, tab->btn_hi[pad >> 8], sizeof(tab->btn_hi[0]));
+        *p++ = ' ';
+        p = put_str(p, tab->btn_lo[pad & 0xFF], tab->btn_lo_len[pad & 0xFF]);
+        *p++ = '\n';
+        tw_commit(tw, p);
+    }
+}
+
+static void
+write_csv (struct text_writer *tw, const struct gz_macro *gzm)
+{
+    const struct text_tables *tab = &tw->tab;
+    char *p = tw_row(tw);
+
+    p = PUT_LIT(p, CSV_HEADER);
+    p += sprintf(p, "start,,0x%04X,%d,%d,,,,,\n", gzm->input_start.pad, gzm->input_start.x, gzm->input_start.y);
+    tw_commit(tw, p);
+
+    for (uint32_t i = 0; i < gzm->n_input; i++)
+    {
+        const struct movie_input *inp = &gzm->input[i];
+
+        p = tw_row(tw);
+        p = PUT_LIT(p, "input,");
+        p = put_u32(p, i);
+        p = PUT_LIT(p, ",0x");
+        p = put_hex4(p, inp->raw.pad);
+        *p++ = ',';
+        p = put_i8(p, tab, inp->raw.x);
+        *p++ = ',';
+        p = put_i8(p, tab, inp->raw.y);
+        p = PUT_LIT(p, ",0x");
+        p = put_hex4(p, inp->pad_delta);
+        p = PUT_LIT(p, ",,,,\n");
+        tw_commit(tw, p);
+    }
+
+    for (uint32_t i = 0; i < gzm->n_seed; i++)
+    {
+        const struct movie_seed *seed = &gzm->seed[i];
+        p = tw_row(tw);
+        p += sprintf(p, "seed,%d,,,,,0x%08X,0x%08X,,\n", seed->frame_idx, seed->old_seed, seed->new_seed);
+        tw_commit(tw, p);
+    }
+    for (uint32_t i = 0; i < gzm->n_oca_input; i++)
+    {
+        const struct movie_oca_input *oca_input = &gzm->oca_input[i];
+        p = tw_row(tw);
+        p += sprintf(p, "oca_input,%d,0x%04X,%d,%d,,,,,\n", oca_input->frame_idx, oca_input->pad,
+                     oca_input->adjusted_x, oca_input->adjusted_y);
+        tw_commit(tw, p);
+    }
+    for (uint32_t i = 0; i < gzm->n_oca_sync; i++)
+    {
+        const struct movie_oca_sync *oca_sync = &gzm->oca_sync[i];
+        p = tw_row(tw);
+        p += sprintf(p, "oca_sync,%d,,,,,,,%d,\n", oca_sync->frame_idx, oca_sync->audio_frames);
+        tw_commit(tw, p);
+    }
+    for (uint32_t i = 0; i < gzm->n_room_load; i++)
+    {
+        p = tw_row(tw);
+        p += sprintf(p, "room_load,%d,,,,,,,,\n", gzm->room_load[i].frame_idx);
+        tw_commit(tw, p);
+    }
+
+    p = tw_row(tw);
+    p += sprintf(p, "trailer,%u,,,,,,,,%u\n", gzm->last_recorded_frame, gzm->rerecords);
+    tw_commit(tw, p);
+}
+
+static void
+write_jsonl (struct text_writer *tw, const struct gz_macro *gzm)
+{
+    const struct text_tables *tab = &tw->tab;
+    char *p = tw_row(tw);
+
+    p += sprintf(p, "{\"type\":\"start\",\"pad\":%u,\"x\":%d,\"y\":%d}\n",
+                 gzm->input_start.pad, gzm->input_start.x, gzm->input_start.y);
+    tw_commit(tw, p);
+
+    for (uint32_t i = 0; i < gzm->n_input; i++)
+    {
+        const struct movie_input *inp = &gzm->input[i];
+
+        p = tw_row(tw);
+        p = PUT_LIT(p, "{\"type\":\"input\",\"frame\":");
+        p = put_u32(p, i);
+        p = PUT_LIT(p, ",\"pad\":");
+        p = put_u32(p, inp->raw.pad);
+        p = PUT_LIT(p, ",\"x\":");
+        p = put_i8(p, tab, inp->raw.x);
+        p = PUT_LIT(p, ",\"y\":");
+        p = put_i8(p, tab, inp->raw.y);
+        p = PUT_LIT(p, ",\"pad_delta\":");
+        p = put_u32(p, inp->pad_delta);
+        p = PUT_LIT(p, "}\n");
+        tw_commit(tw, p);
+    }
+
+    for (uint32_t i = 0; i < gzm->n_seed; i++)
+    {
+        const struct movie_seed *seed = &gzm->seed[i];
+        p = tw_row(tw);
+        p = PUT_LIT(p, "{\"type\":\"seed\",\"frame\":");
+        p = put_i32(p, seed->frame_idx);
+        p += sprintf(p, ",\"old_seed\":%u,\"new_seed\":%u}\n", seed->old_seed, seed->new_seed);
+        tw_commit(tw, p);
+    }
+    for (uint32_t i = 0; i < gzm->n_oca_input; i++)
+    {
+        const struct movie_oca_input *oca_input = &gzm->oca_input[i];
+        p = tw_row(tw);
+        p += sprintf(p, "{\"type\":\"oca_input\",\"frame\":%d,\"pad\":%u,\"x\":%d,\"y\":%d}\n", oca_input->frame_idx,
+                     oca_input->pad, oca_input->adjusted_x, oca_input->adjusted_y);
+        tw_commit(tw, p);
+    }
+    for (uint32_t i = 0; i < gzm->n_oca_sync; i++)
+    {
+        const struct movie_oca_sync *oca_sync = &gzm->oca_sync[i];
+        p = tw_row(tw);
+        p += sprintf(p, "{\"type\":\"oca_sync\",\"frame\":%d,\"audio_frames\":%d}\n",
+                     oca_sync->frame_idx, oca_sync->audio_frames);
+        tw_commit(tw, p);
+    }
+    for (uint32_t i = 0; i < gzm->n_room_load; i++)
+    {
+        p = tw_row(tw);
+        p += sprintf(p, "{\"type\":\"room_load\",\"frame\":%d}\n", gzm->room_load[i].frame_idx);
+        tw_commit(tw, p);
+    }
+
+    p = tw_row(tw);
+    p += sprintf(p, "{\"type\":\"trailer\",\"rerecords\":%u,\"last_recorded_frame\":%u}\n",
+                 gzm->rerecords, gzm->last_recorded_frame);
+    tw_commit(tw, p);
+}
+
+int
+gzm_text_format_from_name (const char *name)
+{
+    if (strcmp(name, "text") == 0)
+        return GZM_TEXT_HUMAN;
+    if (strcmp(name, "csv") == 0)
+        return GZM_TEXT_CSV;
+    if (strcmp(name, "jsonl") == 0 || strcmp(name, "json") == 0)
+        return GZM_TEXT_JSONL;
+    return -1;
+}
+
+int
+gzm_text_write (const struct gz_macro *gzm, FILE *file, int format)
+{
+    struct text_writer *tw = malloc(sizeof(struct text_writer));
+
+    if (tw == NULL)
+        return -1;
+    tw->buf = malloc(TEXT_BUF_SIZE);
+    if (tw->buf == NULL)
+    {
+        free(tw);
+        return -1;
+    }
+    tw->file = file;
+    tw->pos = 0;
+    tw->error = 0;
+    text_tables_init(&tw->tab);
+
+    switch (format)
+    {
+        case GZM_TEXT_HUMAN:
+            write_human(tw, gzm);
+            break;
+        case GZM_TEXT_CSV:
+            write_csv(tw, gzm);
+            break;
+        case GZM_TEXT_JSONL:
+            write_jsonl(tw, gzm);
+            break;
+        default:
+            tw->error = -1;
+            break;
+    }
+    tw_flush(tw);
+
+    int ret = tw->error;
+    free(tw->buf);
+    free(tw);
+    return ret;
+}
+
+/*
+ * Reading
+ *
+ * CSV and JSON lines are told apart per line, both are parsed into the same set of columns. Records
+ * may appear in any order; input rows are placed by their frame column.
+ */
+
+enum text_column
+{
+    COL_FRAME,
+    COL_PAD,
+    COL_X,
+    COL_Y,
+    COL_PAD_DELTA,
+    COL_OLD_SEED,
+    COL_NEW_SEED,
+    COL_AUDIO_FRAMES,
+    COL_RERECORDS,
+    NUM_COLS
+};
+
+static const char *col_names[NUM_COLS] =
+{
+    "frame", "pad", "x", "y", "pad_delta", "old_seed", "new_seed", "audio_frames", "rerecords",
+};
+
+struct text_row
+{
+    char                     type[16];
+    long long                val[NUM_COLS];
+    bool                     present[NUM_COLS];
+};
+
+struct text_reader
+{
+    FILE                    *file;
+    char                    *buf;
+    size_t                   cap;
+    size_t                   start;
+    size_t                   end;
+    bool                     eof;
+    bool                     error;             // a line could not be buffered
+    size_t                   line_no;
+};
+
+struct text_builder
+{
+    struct gz_macro          gzm;
+    uint32_t                 cap_input;
+    uint32_t                 cap_seed;
+    uint32_t                 cap_oca_input;
+    uint32_t                 cap_oca_sync;
+    uint32_t                 cap_room_load;
+    uint8_t                 *has_delta;         // per input, whether pad_delta was given
+};
+
+/*
+ * Returns the next line, NUL-terminated without its newline, or NULL at the end of the input or when the line
+ * does not fit in memory, which sets error
+ */
+static char *
+tr_line (struct text_reader *tr)
+{
+    while (true)
+    {
+        char *nl = memchr(&tr->buf[tr->start], '\n', tr->end - tr->start);
+
+        if (nl != NULL || (tr->eof && tr->start < tr->end))
+        {
+            char *line = &tr->buf[tr->start];
+
+            if (nl == NULL)
+                nl = &tr->buf[tr->end];
+            *nl = '\0';
+            if (nl > line && nl[-1] == '\r')
+                nl[-1] = '\0';
+            tr->start = nl - tr->buf + 1;
+            if (tr->start > tr->end)
+                tr->start = tr->end;
+            tr->line_no++;
+            return line;
+        }
+        if (tr->eof)
+            return NULL;
+
+        // move the partial line to the front and refill, growing for very long lines
+        memmove(tr->buf, &tr->buf[tr->start], tr->end - tr->start);
+        tr->end -= tr->start;
+        tr->start = 0;
+        if (tr->end + 1 >= tr->cap)
+        {
+            char *buf = realloc(tr->buf, tr->cap * 2);
+            if (buf == NULL)
+            {
+                tr->error = true;
+                return NULL;
+            }
+            tr->buf = buf;
+            tr->cap *= 2;
+        }
+        size_t n = fread(&tr->buf[tr->end], 1, tr->cap - tr->end - 1, tr->file);
+        tr->end += n;
+        if (n == 0)
+            tr->eof = true;
+    }
+}
+
+/* Parse an optionally signed decimal or 0x-prefixed hex integer */
+static const char *
+parse_int (const char *p, long long *out)
+{
+    bool neg = false;
+    unsigned long long v = 0;
+    const char *start;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (*p == '-' || *p == '+')
+        neg = (*p++ == '-');
+
+    start = p;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    {
+        p += 2;
+        start = p;
+        while (true)
+        {
+            char c = *p;
+            if (c >= '0' && c <= '9')
+                v = v * 16 + (c - '0');
+            else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+                v = v * 16 + ((c | 0x20) - 'a' + 10);
+            else
+                break;
+            p++;
+        }
+    }
+    else
+    {
+        while (*p >= '0' && *p <= '9')
+            v = v * 10 + (*p++ - '0');
+    }
+    if (p == start)
+        return NULL;
+
+    *out = neg ? -(long long)v : (long long)v;
+    return p;
+}
+
+static int
+parse_csv (char *line, struct text_row *row)
+{
+    char *p = line;
+    size_t len = strcspn(p, ",");
+
+    if (len >= sizeof(row->type))
+        return -1;
+    memcpy(row->type, p, len);
+    row->type[len] = '\0';
+    p += len;
+
+    for (int col = 0; col < NUM_COLS && *p == ','; col++)
+    {
+        p++;
+        if (*p == ',' || *p == '\0')
+            continue;
+        p = (char *)parse_int(p, &row->val[col]);
+        if (p == NULL)
+            return -1;
+        row->present[col] = true;
+    }
+    return (*p == '\0') ? 0 : -1;
+}
+
+static int
+parse_jsonl (char *line, struct text_row *row)
+{
+    char *p = line + 1;
+
+    while (true)
+    {
+        char *key;
+        size_t key_len;
+
+        p += strspn(p, " \t,");
+        if (*p == '}')
+            return 0;
+        if (*p != '"')
+            return -1;
+        key = ++p;
+        p = strchr(p, '"');
+        if (p == NULL)
+            return -1;
+        key_len = p - key;
+        p++;
+        p += strspn(p, " \t");
+        if (*p++ != ':')
+            return -1;
+        p += strspn(p, " \t");
+
+        if (*p == '"')
+        {
+            char *val = ++p;
+            p = strchr(p, '"');
+            if (p == NULL || key_len != 4 || memcmp(key, "type", 4) != 0 || (size_t)(p - val) >= sizeof(row->type))
+                return -1;
+            memcpy(row->type, val, p - val);
+            row->type[p - val] = '\0';
+            p++;
+            continue;
+        }
+
+        int col = -1;
+        for (int i = 0; i < NUM_COLS; i++)
+        {
+            if (strlen(col_names[i]) == key_len && memcmp(key, col_names[i], key_len) == 0)
+                col = i;
+        }
+        if (key_len == 19 && memcmp(key, "last_recorded_frame", 19) == 0)
+            col = COL_FRAME;
+        if (col < 0)
+            return -1;
+
+        p = (char *)parse_int(p, &row->val[col]);
+        if (p == NULL)
+            return -1;
+        row->present[col] = true;
+    }
+}
+
+/* Grow `*arr` to hold at least `n` elements of `elem_size` */
+static int
+builder_reserve (void **arr, uint32_t *cap, uint32_t n, size_t elem_size)
+{
+    if (n <= *cap)
+        return 0;
+
+    uint32_t new_cap = (*cap != 0) ? *cap : 64;
+    while (new_cap < n)
+        new_cap *= 2;
+    void *p = realloc(*arr, (size_t)new_cap * elem_size);
+    if (p == NULL)
+        return -1;
+    *arr = p;
+    *cap = new_cap;
+    return 0;
+}
+
+#define BUILDER_PUSH(b, name)                                                                   \
+    (builder_reserve((void **)&(b)->gzm.name, &(b)->cap_##name, (b)->gzm.n_##name + 1,          \
+                     sizeof(*(b)->gzm.name)) == 0 ? &(b)->gzm.name[(b)->gzm.n_##name++] : NULL)
+
+static int
+builder_add (struct text_builder *b, const struct text_row *row)
+{
+    const long long *v = row->val;
+    const bool *has = row->present;
+
+    if (strcmp(row->type, "input") == 0)
+    {
+        if (!has[COL_FRAME] || v[COL_FRAME] < 0 || v[COL_FRAME] >= UINT32_MAX)
+            return -1;
+
+        uint32_t frame = v[COL_FRAME];
+        if (frame >= b->gzm.n_input)
+        {
+            uint32_t old_cap = b->cap_input;
+
+            if (builder_reserve((void **)&b->gzm.input, &b->cap_input, frame + 1, sizeof(struct movie_input)) != 0)
+                return -1;
+            if (b->cap_input != old_cap)
+            {
+                uint8_t *has_delta = realloc(b->has_delta, b->cap_input);
+                if (has_delta == NULL)
+                    return -1;
+                b->has_delta = has_delta;
+            }
+            memset(&b->gzm.input[b->gzm.n_input], 0, (frame + 1 - b->gzm.n_input) * sizeof(struct movie_input));
+            memset(&b->has_delta[b->gzm.n_input], 0, frame + 1 - b->gzm.n_input);
+            b->gzm.n_input = frame + 1;
+        }
+
+        struct movie_input *inp = &b->gzm.input[frame];
+        inp->raw.pad = v[COL_PAD];
+        inp->raw.x = v[COL_X];
+        inp->raw.y = v[COL_Y];
+        inp->pad_delta = v[COL_PAD_DELTA];
+        b->has_delta[frame] = has[COL_PAD_DELTA];
+    }
+    else if (strcmp(row->type, "seed") == 0)
+    {
+        struct movie_seed *seed = BUILDER_PUSH(b, seed);
+        if (seed == NULL)
+            return -1;
+        seed->frame_idx = v[COL_FRAME];
+        seed->old_seed = v[COL_OLD_SEED];
+        seed->new_seed = v[COL_NEW_SEED];
+    }
+    else if (strcmp(row->type, "oca_input") == 0)
+    {
+        struct movie_oca_input *oca_input = BUILDER_PUSH(b, oca_input);
+        if (oca_input == NULL)
+            return -1;
+        oca_input->frame_idx = v[COL_FRAME];
+        oca_input->pad = v[COL_PAD];
+        oca_input->adjusted_x = v[COL_X];
+        oca_input->adjusted_y = v[COL_Y];
+    }
+    else if (strcmp(row->type, "oca_sync") == 0)
+    {
+        struct movie_oca_sync *oca_sync = BUILDER_PUSH(b, oca_sync);
+        if (oca_sync == NULL)
+            return -1;
+        oca_sync->frame_idx = v[COL_FRAME];
+        oca_sync->audio_frames = v[COL_AUDIO_FRAMES];
+    }
+    else if (strcmp(row->type, "room_load") == 0)
+    {
+        struct movie_room_load *room_load = BUILDER_PUSH(b, room_load);
+        if (room_load == NULL)
+            return -1;
+        room_load->frame_idx = v[COL_FRAME];
+    }
+    else if (strcmp(row->type, "start") == 0)
+    {
+        b->gzm.input_start.pad = v[COL_PAD];
+        b->gzm.input_start.x = v[COL_X];
+        b->gzm.input_start.y = v[COL_Y];
+    }
+    else if (strcmp(row->type, "trailer") == 0)
+    {
+        b->gzm.last_recorded_frame = v[COL_FRAME];
+        b->gzm.rerecords = v[COL_RERECORDS];
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int
+gzm_text_read (struct gz_macro *gzm, FILE *file)
+{
+    struct text_reader tr = { .file = file, .cap = TEXT_BUF_SIZE };
+    struct text_builder b;
+    char *line;
+    int ret = 0;
+
+    memset(&b, 0, sizeof(struct text_builder));
+    tr.buf = malloc(tr.cap);
+    if (tr.buf == NULL)
+        return -1;
+
+    while ((line = tr_line(&tr)) != NULL)
+    {
+        struct text_row row;
+
+        if (line[0] == '\0' || line[0] == '#' || strncmp(line, "type,", 5) == 0)
+            continue;
+
+        memset(&row, 0, sizeof(struct text_row));
+        if ((line[0] == '{' ? parse_jsonl(line, &row) : parse_csv(line, &row)) != 0 || builder_add(&b, &row) != 0)
+        {
+            fprintf(stderr, "error: line %zu: invalid record\n", tr.line_no);
+            ret = -1;
+            break;
+        }
+    }
+    if (ferror(file) || tr.error)
+        ret = -1;
+
+    // Fill in any pad_delta that was left out
+    uint16_t prev = b.gzm.input_start.pad;
+    for (uint32_t i = 0; i < b.gzm.n_input; i++)
+    {
+        if (!b.has_delta[i])
+            b.gzm.input[i].pad_delta = PAD_DELTA(prev, b.gzm.input[i].raw.pad);
+        prev = b.gzm.input[i].raw.pad;
+    }
+
+    free(b.has_delta);
+    free(tr.buf);
+    *gzm = b.gzm;
+    if (ret != 0)
+        gzm_free(gzm);
+    return ret;
+}
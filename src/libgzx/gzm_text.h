@@ -0,0 +1,24 @@
+#ifndef GZM_TEXT_H_
+#define GZM_TEXT_H_
+
+#include <stdio.h>
+
+#include "gzm.h"
+
+enum gzm_text_format
+{
+    GZM_TEXT_HUMAN,     // the gzm_print_inputs layout, export only
+    GZM_TEXT_CSV,       // one row per record, with a type column
+    GZM_TEXT_JSONL,     // one object per record, with a type member
+};
+
+int
+gzm_text_format_from_name (const char *name);
+
+int
+gzm_text_write (const struct gz_macro *gzm, FILE *file, int format);
+
+int
+gzm_text_read (struct gz_macro *gzm, FILE *file);
+
+#endif
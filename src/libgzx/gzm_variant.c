@@ -0,0 +1,307 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gzm_journal.h"
+#include "gzm_schema.h"
+#include "gzm_variant.h"
+
+#define ARCHIVE_MAGIC "GZMV"
+#define ARCHIVE_FORMAT 1
+#define ARCHIVE_HEADER_SIZE (4 + sizeof(uint32_t) + 4 * sizeof(uint64_t))
+
+#define MAX_CANDIDATES (1ull << 40)
+
+static const struct
+{
+    const char              *name;
+    long                     min;
+    long                     max;
+} fields[] =
+{
+    [GZM_VARIANT_PAD] = { "pad", 0,    0xFFFF },
+    [GZM_VARIANT_X]   = { "x",   -128, 127    },
+    [GZM_VARIANT_Y]   = { "y",   -128, 127    },
+};
+
+/* Parse `str` as <frame>:<field>=<values>, values being a comma separated list of <v> or <from>..<to>[/<step>] */
+int
+gzm_variant_parse_axis (struct gzm_variant_axis *axis, const char *str)
+{
+    const char *p;
+    char *end;
+    unsigned long frame = strtoul(str, &end, 0);
+    size_t cap = 16;
+
+    memset(axis, 0, sizeof(struct gzm_variant_axis));
+    if (end == str || *end != ':' || frame > UINT32_MAX)
+        return -1;
+    axis->frame = frame;
+
+    p = end + 1;
+    axis->field = -1;
+    for (int f = 0; f < sizeof(fields) / sizeof(fields[0]); f++)
+    {
+        size_t len = strlen(fields[f].name);
+
+        if (strncmp(p, fields[f].name, len) == 0 && p[len] == '=')
+        {
+            axis->field = f;
+            p += len + 1;
+        }
+    }
+    if (axis->field < 0)
+        return -1;
+
+    axis->values = malloc(cap * sizeof(int32_t));
+    if (axis->values == NULL)
+        return -1;
+    while (true)
+    {
+        long from = strtol(p, &end, 0);
+        long to = from;
+        long step = 1;
+
+        if (end == p)
+            goto fail;
+        p = end;
+        if (strncmp(p, "..", 2) == 0)
+        {
+            to = strtol(p + 2, &end, 0);
+            if (end == p + 2)
+                goto fail;
+            p = end;
+            if (*p == '/')
+            {
+                step = strtol(p + 1, &end, 0);
+                if (end == p + 1 || step < 1)
+                    goto fail;
+                p = end;
+            }
+        }
+        if (from < fields[axis->field].min || from > fields[axis->field].max ||
+            to < fields[axis->field].min || to > fields[axis->field].max)
+            goto fail;
+
+        for (long v = from; (from <= to) ? v <= to : v >= to; v += (from <= to) ? step : -step)
+        {
+            if (axis->n_values == cap)
+            {
+                int32_t *values = realloc(axis->values, cap * 2 * sizeof(int32_t));
+
+                if (values == NULL)
+                    goto fail;
+                axis->values = values;
+                cap *= 2;
+            }
+            axis->values[axis->n_values++] = v;
+        }
+
+        if (*p == '\0')
+            return 0;
+        if (*p != ',')
+            goto fail;
+        p++;
+    }
+
+fail:
+    gzm_variant_free_axis(axis);
+    return -1;
+}
+
+void
+gzm_variant_free_axis (struct gzm_variant_axis *axis)
+{
+    free(axis->values);
+    memset(axis, 0, sizeof(struct gzm_variant_axis));
+}
+
+/* Serialize the base and find the window the axes vary, the axes must outlive `v` */
+int
+gzm_variant_init (struct gzm_variant *v, const struct gz_macro *gzm, const struct gzm_variant_axis *axes, size_t n_axes)
+{
+    uint32_t last = 0;
+
+    memset(v, 0, sizeof(struct gzm_variant));
+    if (n_axes == 0)
+        return -1;
+
+    v->frame_start = UINT32_MAX;
+    v->n_candidates = 1;
+    for (size_t a = 0; a < n_axes; a++)
+    {
+        if (axes[a].frame >= gzm->n_input || axes[a].n_values == 0 ||
+            v->n_candidates > MAX_CANDIDATES / axes[a].n_values)
+            return -1;
+        if (axes[a].frame < v->frame_start)
+            v->frame_start = axes[a].frame;
+        if (axes[a].frame > last)
+            last = axes[a].frame;
+        v->n_candidates *= axes[a].n_values;
+    }
+    // the frame after the last varied one only changes in pad_delta
+    v->frame_end = (last + 1 < gzm->n_input) ? last + 2 : last + 1;
+    v->axes = axes;
+    v->n_axes = n_axes;
+
+    v->size = GZM_SERIAL_SIZE(gzm);
+    v->data = malloc(v->size);
+    if (v->data == NULL || gzm_encode(gzm, GZM_VERSION_LATEST, v->data, v->size) != 0)
+    {
+        gzm_variant_free(v);
+        return -1;
+    }
+    v->window_offset = GZM_HEADER_SERIAL_SIZE + (size_t)v->frame_start * GZM_INPUT_SERIAL_SIZE;
+    v->window_size = (size_t)(v->frame_end - v->frame_start) * GZM_INPUT_SERIAL_SIZE;
+
+    v->window = malloc((v->frame_end - v->frame_start) * sizeof(struct movie_input));
+    if (v->window == NULL)
+    {
+        gzm_variant_free(v);
+        return -1;
+    }
+    memcpy(v->window, &gzm->input[v->frame_start], (v->frame_end - v->frame_start) * sizeof(struct movie_input));
+    v->prev_pad = (v->frame_start == 0) ? gzm->input_start.pad : gzm->input[v->frame_start - 1].raw.pad;
+    return 0;
+}
+
+/*
+ * Encode the window of candidate `k` into `window`, which holds v->window_size bytes. `input` is scratch space
+ * for frame_end - frame_start inputs, kept by the caller across candidates.
+ */
+void
+gzm_variant_encode (const struct gzm_variant *v, uint64_t k, void *window, struct movie_input *input)
+{
+    uint32_t n = v->frame_end - v->frame_start;
+    uint16_t prev_pad = v->prev_pad;
+
+    memcpy(input, v->window, n * sizeof(struct movie_input));
+    for (size_t a = v->n_axes; a-- > 0; )
+    {
+        const struct gzm_variant_axis *axis = &v->axes[a];
+        z64_controller_t *raw = &input[axis->frame - v->frame_start].raw;
+        int32_t value = axis->values[k % axis->n_values];
+
+        k /= axis->n_values;
+        switch (axis->field)
+        {
+            case GZM_VARIANT_PAD:
+                raw->pad = value;
+                break;
+            case GZM_VARIANT_X:
+                raw->x = value;
+                break;
+            case GZM_VARIANT_Y:
+                raw->y = value;
+                break;
+        }
+    }
+    for (uint32_t i = 0; i < n; i++)
+    {
+        input[i].pad_delta = PAD_DELTA(prev_pad, input[i].raw.pad);
+        prev_pad = input[i].raw.pad;
+    }
+
+    gzm_encode_inputs(window, input, n);
+}
+
+static int
+write_spliced (const uint8_t *data, size_t size, size_t offset, const void *window, size_t window_size,
+               const char *file_name)
+{
+    FILE *file = fopen(file_name, "wb");
+    int ret = 0;
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "error: failed to open file '%s' for writing: %s\n", file_name, strerror(errno));
+        return -1;
+    }
+    if (fwrite(data, 1, offset, file) != offset ||
+        fwrite(window, 1, window_size, file) != window_size ||
+        fwrite(&data[offset + window_size], 1, size - offset - window_size, file) != size - offset - window_size)
+        ret = -1;
+    if (fclose(file) != 0 || ret != 0)
+        return -1;
+
+    // as gzm_write, the file now holds everything
+    return gzm_journal_discard(file_name);
+}
+
+/* Write the candidate whose window was encoded into `window` */
+int
+gzm_variant_write (const struct gzm_variant *v, const void *window, const char *file_name)
+{
+    return write_spliced(v->data, v->size, v->window_offset, window, v->window_size, file_name);
+}
+
+void
+gzm_variant_free (struct gzm_variant *v)
+{
+    free(v->data);
+    free(v->window);
+    memset(v, 0, sizeof(struct gzm_variant));
+}
+
+/* Write the archive header and the base, the windows then go at gzm_variant_archive_offset */
+int
+gzm_variant_archive_begin (const struct gzm_variant *v, FILE *file)
+{
+    uint32_t format = ARCHIVE_FORMAT;
+    uint64_t header[4] = { v->size, v->window_offset, v->window_size, v->n_candidates };
+
+    fwrite(ARCHIVE_MAGIC, 4, 1, file);
+    fwrite(&format, sizeof(format), 1, file);
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(v->data, 1, v->size, file);
+    return (fflush(file) != 0 || ferror(file)) ? -1 : 0;
+}
+
+uint64_t
+gzm_variant_archive_offset (const struct gzm_variant *v, uint64_t k)
+{
+    return ARCHIVE_HEADER_SIZE + v->size + k * v->window_size;
+}
+
+/* Write candidate `k` of an archive as a macro file */
+int
+gzm_variant_archive_extract (const char *archive_name, uint64_t k, const char *file_name)
+{
+    FILE *file = fopen(archive_name, "rb");
+    char magic[4];
+    uint32_t format;
+    uint64_t header[4];
+    uint8_t *data = NULL;
+    int ret = -1;
+
+    if (file == NULL)
+        return -1;
+    if (fread(magic, 4, 1, file) != 1 || memcmp(magic, ARCHIVE_MAGIC, 4) != 0 ||
+        fread(&format, sizeof(format), 1, file) != 1 || format != ARCHIVE_FORMAT ||
+        fread(header, sizeof(header), 1, file) != 1)
+        goto end;
+
+    uint64_t size = header[0];
+    uint64_t window_offset = header[1];
+    uint64_t window_size = header[2];
+    uint64_t n_candidates = header[3];
+
+    if (k >= n_candidates || window_offset > size || window_size > size - window_offset ||
+        (data = malloc(size + window_size + 1)) == NULL)
+        goto end;
+
+    // the base, then the candidate's window after it
+    if (fread(data, 1, size, file) != size ||
+        fseeko(file, ARCHIVE_HEADER_SIZE + size + k * window_size, SEEK_SET) != 0 ||
+        fread(&data[size], 1, window_size, file) != window_size)
+        goto end;
+    ret = write_spliced(data, size, window_offset, &data[size], window_size, file_name);
+
+end:
+    free(data);
+    fclose(file);
+    return ret;
+}
@@ -0,0 +1,82 @@
+#ifndef GZM_VARIANT_H_
+#define GZM_VARIANT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gzm.h"
+
+/*
+ * Candidate macros that differ from a base macro only in the inputs of a few frames. Each axis gives the
+ * values one field of one frame takes, the candidates are all combinations of them, numbered with the last
+ * axis varying fastest.
+ *
+ * The base is serialized once. A candidate is the bytes of the base before the window of frames the axes
+ * touch, the window re-encoded with the candidate's values and the pad_delta of the frame after it, and the
+ * bytes of the base after that.
+ */
+
+enum gzm_variant_field
+{
+    GZM_VARIANT_PAD,
+    GZM_VARIANT_X,
+    GZM_VARIANT_Y,
+};
+
+struct gzm_variant_axis
+{
+    uint32_t                 frame;
+    int                      field;
+    int32_t                 *values;
+    uint32_t                 n_values;
+};
+
+struct gzm_variant
+{
+    uint8_t                 *data;              // the serialized base
+    size_t                   size;
+    uint32_t                 frame_start;       // the window, [frame_start, frame_end)
+    uint32_t                 frame_end;
+    size_t                   window_offset;     // of the window in data
+    size_t                   window_size;
+    struct movie_input      *window;            // the base inputs of the window
+    uint16_t                 prev_pad;          // pad before the window
+    const struct gzm_variant_axis *axes;
+    size_t                   n_axes;
+    uint64_t                 n_candidates;
+};
+
+int
+gzm_variant_parse_axis (struct gzm_variant_axis *axis, const char *str);
+
+void
+gzm_variant_free_axis (struct gzm_variant_axis *axis);
+
+int
+gzm_variant_init (struct gzm_variant *v, const struct gz_macro *gzm, const struct gzm_variant_axis *axes, size_t n_axes);
+
+void
+gzm_variant_encode (const struct gzm_variant *v, uint64_t k, void *window, struct movie_input *input);
+
+int
+gzm_variant_write (const struct gzm_variant *v, const void *window, const char *file_name);
+
+void
+gzm_variant_free (struct gzm_variant *v);
+
+/*
+ * A packed archive of candidates: a header, the serialized base once, then the window of each candidate in
+ * order, so candidate k is found without an index.
+ */
+
+int
+gzm_variant_archive_begin (const struct gzm_variant *v, FILE *file);
+
+uint64_t
+gzm_variant_archive_offset (const struct gzm_variant *v, uint64_t k);
+
+int
+gzm_variant_archive_extract (const char *archive_name, uint64_t k, const char *file_name);
+
+#endif
@@ -0,0 +1,42 @@
+#include <string.h>
+
+#include "hash.h"
+
+#define HASH_MUL 0x9E3779B97F4A7C15ull
+
+/* Fast non-cryptographic 64-bit hash, consumes 4 words per round so the lanes are independent */
+uint64_t
+hash64 (const void *data, size_t size, uint64_t seed)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+    uint64_t h[4] = { seed, seed + HASH_MUL, seed ^ HASH_MUL, seed - HASH_MUL };
+    uint64_t w;
+
+    while (end - p >= 32)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            memcpy(&w, p + i * 8, sizeof(w));
+            h[i] = (h[i] ^ w) * HASH_MUL;
+            h[i] ^= h[i] >> 29;
+        }
+        p += 32;
+    }
+
+    uint64_t r = hash_mix(h[0]) ^ hash_mix(h[1] + 1) ^ hash_mix(h[2] + 2) ^ hash_mix(h[3] + 3);
+
+    while (end - p >= 8)
+    {
+        memcpy(&w, p, sizeof(w));
+        r = hash_mix(r ^ w);
+        p += 8;
+    }
+    if (p < end)
+    {
+        w = 0;
+        memcpy(&w, p, end - p);
+        r = hash_mix(r ^ w ^ ((uint64_t)(end - p) << 56));
+    }
+    return hash_mix(r ^ size);
+}
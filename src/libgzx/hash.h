@@ -0,0 +1,22 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Finalizer of a 64-bit hash, every input bit affects every output bit
+static inline uint64_t
+hash_mix (uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t
+hash64 (const void *data, size_t size, uint64_t seed);
+
+#endif